@@ -25,6 +25,7 @@ opt-12 -load-pass-plugin ./libfeature_pass.so  --passes="print<feature>" -disabl
 
 #echo
 #echo "$(tput setaf 1) Feature extraction from LLVM IR with the extractor utility $(tput sgr 0)"
-#./feature_ext -i samples/vecadd.bc
-#./feature_ext -i samples/vecadd.bc -fe kofler13   
-
+#./feature_ext samples/vecadd.bc
+#./feature_ext -fanal=kofler13 -j 4 "samples/*.bc"
+#./feature_ext -fanal=kofler13 -o features.cfm "samples/*.bc"
+#./read_feature_matrix.py features.cfm
@@ -17,6 +17,8 @@ for bc in *.bc; do
     ../features -i $bc 
     ../features -i $bc -fe kofler
     ../features -i $bc -fs full
+    # device modules carry many helper functions: load lazily, only the kernels and their callees
+    #../feature_ext -lazy -v $bc
 done
 
 cd ..
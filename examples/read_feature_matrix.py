@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+# Reads a binary feature matrix file (.cfm) written by feature_ext -o or by the feature-matrix pass.
+# The file is memory-mapped, feature columns are numpy views on the mapping (no parsing, no copies).
+# Usage: ./read_feature_matrix.py features.cfm
+import sys
+import numpy as np
+
+HEADER = np.dtype([('magic', 'S8'), ('version', '<u4'), ('byte_order', '<u4'),
+                   ('num_features', '<u4'), ('num_modules', '<u4'), ('num_rows', '<u8'),
+                   ('chunk_size', '<u8'), ('string_offset', '<u8'), ('string_size', '<u8'),
+                   ('module_offset', '<u8'), ('raw_offset', '<u8'), ('feat_offset', '<u8')])
+
+
+def read_chunks(filename):
+    data = np.memmap(filename, dtype=np.uint8, mode='r')
+    offset = 0
+    while offset < len(data):
+        h = data[offset:offset + HEADER.itemsize].view(HEADER)[0]
+        assert h['magic'] == b'CELFMAT' and h['version'] == 1 and h['byte_order'] == 0x01020304
+        nf, nm, nr = int(h['num_features']), int(h['num_modules']), int(h['num_rows'])
+        start = offset + int(h['string_offset'])
+        strings = bytes(data[start:start + int(h['string_size'])]).split(b'\0')
+        strings = [s.decode() for s in strings]
+        raw = data[offset + int(h['raw_offset']):][:4 * nf * nr].view('<u4').reshape(nf, nr)
+        feat = data[offset + int(h['feat_offset']):][:4 * nf * nr].view('<f4').reshape(nf, nr)
+        modules = data[offset + int(h['module_offset']):][:4 * nr].view('<u4')
+        yield {
+            'feature_set': strings[0], 'analysis': strings[1],
+            'features': strings[2:2 + nf],
+            'modules': [strings[2 + nf + m] for m in modules],
+            'kernels': strings[2 + nf + nm:2 + nf + nm + nr],
+            'raw': raw, 'feat': feat,   # one row per feature (column-major matrix)
+        }
+        offset += int(h['chunk_size'])
+
+
+if __name__ == '__main__':
+    for chunk in read_chunks(sys.argv[1]):
+        print(chunk['feature_set'], chunk['analysis'], len(chunk['kernels']), 'kernels')
+        print(' '.join(chunk['features']))
+        for row, kernel in enumerate(chunk['kernels']):
+            print(chunk['modules'][row], kernel, chunk['feat'][:, row])
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/ValueMap.h>
+
+namespace celerity {
+
+/// Work-item and synchronization builtins recognized by the analyses, for both OpenCL names (get_global_size)
+/// and the SPIR-V names used by SYCL (__spirv_GlobalSize_x).
+enum class BuiltinKind : uint8_t {
+    none,
+    global_id, local_id, group_id,            // work-item coordinates
+    global_size, local_size, num_groups,      // kernel invariants with a dimension
+    num_sub_groups, sub_group_size, max_sub_group_size,
+    barrier
+};
+
+/// Classification of a called function, derived from its name only.
+struct CalleeInfo {
+    std::string name;            // demangled base name, e.g. "sqrt" for _Z4sqrtf, the plain name if not mangled
+    BuiltinKind builtin = BuiltinKind::none;
+    int dimension = -1;          // dimension encoded in the name (SPIR-V builtins), -1 if given by the first argument
+    bool math = false;           // special math function (sqrt, exp, ...)
+    bool barrier = false;        // synchronization (barrier, sub-group reductions)
+    bool opencl = false;         // OpenCL builtin that is not a feature (get_global_id, ...)
+};
+
+/// Memoized classification of called functions.
+/// Each function is demangled and classified on its first query, later queries are a single map lookup.
+/// Entries are keyed by the function and dropped when the function is deleted, thus a classification
+/// can be shared by all the functions of a module and survives the deletion of the module.
+/// Functions renamed after their classification keep the old classification.
+class CalleeClassification {
+public:
+    CalleeClassification() : callees(std::make_unique<CalleeMap>()) {}
+
+    /// classification of a called function, the reference is valid until the next query
+    const CalleeInfo &classify(const llvm::Function &callee){
+        auto it = callees->find(&callee);
+        if(it != callees->end())
+            return it->second;
+        return callees->insert(std::make_pair(&callee, compute(callee))).first->second;
+    }
+
+    void clear(){ callees->clear(); }
+    unsigned size() const { return callees->size(); }
+
+    /// classify a function from scratch, without memoization
+    static CalleeInfo compute(const llvm::Function &callee);
+    /// demangled name of a function (e.g., "sqrt(float)"), the plain name if it is not mangled
+    static std::string demangle(llvm::StringRef name);
+    /// base name of a function (e.g., "sqrt"), without scope, template and function arguments
+    static std::string demangleBaseName(llvm::StringRef name);
+
+    /// The classification depends on function names only and tracks deleted functions, thus it is never invalidated.
+    /// This is also required to query it from function analyses, which only see immutable module results.
+    bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &, llvm::ModuleAnalysisManager::Invalidator &){
+        return false;
+    }
+
+private:
+    /// entries are not moved to the replacement of a function (RAUW), which may have a different name
+    struct CalleeMapConfig : llvm::ValueMapConfig<const llvm::Function*> {
+        enum { FollowRAUW = false };
+    };
+    using CalleeMap = llvm::ValueMap<const llvm::Function*, CalleeInfo, CalleeMapConfig>;
+    std::unique_ptr<CalleeMap> callees; // the map is not movable, analysis results are
+};
+
+/// Module analysis classifying all the function declarations of a module once.
+/// Feature analyses use the cached result when available, e.g., if the module pass or the tool requested it before.
+struct CalleeClassificationAnalysis : public llvm::AnalysisInfoMixin<CalleeClassificationAnalysis> {
+    using Result = CalleeClassification;
+    CalleeClassification run(llvm::Module &module, llvm::ModuleAnalysisManager &mam);
+
+    static llvm::AnalysisKey Key;
+    static bool isRequired() { return true; }
+};
+
+} // end namespace celerity
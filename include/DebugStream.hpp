@@ -0,0 +1,32 @@
+#pragma once
+
+#include <llvm/Support/raw_ostream.h>
+
+namespace celerity {
+
+/// Per-thread destination of the diagnostic output (nullptr means llvm::outs())
+inline llvm::raw_ostream *&debug_stream_slot(){
+    static thread_local llvm::raw_ostream *stream = nullptr;
+    return stream;
+}
+
+/// Stream used by analyses and feature sets for diagnostic output. 
+/// It defaults to llvm::outs() and can be redirected per thread, so that concurrent extractions do not share a stream.
+inline llvm::raw_ostream &debugs(){
+    llvm::raw_ostream *stream = debug_stream_slot();
+    return stream ? *stream : llvm::outs();
+}
+
+/// Redirects the diagnostic output of the calling thread for the lifetime of the object
+struct DebugStreamRedirect {
+    explicit DebugStreamRedirect(llvm::raw_ostream &stream) : previous(debug_stream_slot()) { 
+        debug_stream_slot() = &stream; 
+    }
+    ~DebugStreamRedirect(){ debug_stream_slot() = previous; }
+    DebugStreamRedirect(const DebugStreamRedirect &) = delete;
+    DebugStreamRedirect &operator=(const DebugStreamRedirect &) = delete;
+ private:
+    llvm::raw_ostream *previous;
+};
+
+} // end namespace celerity
@@ -15,12 +15,11 @@ namespace celerity {
 struct DefaultFeatureAnalysis : public FeatureAnalysis, llvm::AnalysisInfoMixin<DefaultFeatureAnalysis> {
     
  public:
-    DefaultFeatureAnalysis(string feature_set = "fan19") { 
+    DefaultFeatureAnalysis(const string &feature_set = "fan19") : FeatureAnalysis(feature_set) { 
       analysis_name="default";
-      features = FSRegistry::dispatch(feature_set);
+      analysis_key = ID();
       assert(features != nullptr);      
     }
-    virtual ~DefaultFeatureAnalysis(){}
 
   friend struct llvm::AnalysisInfoMixin<DefaultFeatureAnalysis>;   
   static llvm::AnalysisKey Key;
@@ -11,36 +11,58 @@ using namespace llvm;
 namespace celerity
 {
 
-  /// Results of a feature analysis
+  /// Results of a feature analysis. 
+  /// Values are indexed by the feature IDs of the schema, which is owned by the feature set class.
   struct ResultFeatureAnalysis
   {
-    llvm::StringMap<unsigned> raw;
-    llvm::StringMap<float> feat;
+    const FeatureSchema *schema;
+    std::vector<unsigned> raw;
+    std::vector<float> feat;
+    llvm::AnalysisKey *analysis_key; // analysis that computed the result
+    bool loop_dependent;             // the result depends on loop info and scalar evolution
+    string feature_set_name;
+    string analysis_name;
+
+    /// The features count all the instructions of a function, any change of the IR can change them: the result
+    /// survives a pass only if the pass preserves all the analyses, or this analysis explicitly, and the loop
+    /// analyses the result depends on. Preserving AllAnalysesOn<Function> is not enough, the callee classification
+    /// of the module is an input too.
+    bool invalidate(llvm::Function &fun, const llvm::PreservedAnalyses &PA, llvm::FunctionAnalysisManager::Invalidator &inv);
   };
 
   /// Abstract class for analyses that extract static code features.
   /// The extraction of features from a single instruction is delegated to a feature set class.
+  /// Each analysis owns its feature set, so that analyses running on different threads never share counters.
   struct FeatureAnalysis {
    protected:
-    FeatureSet *features;
+    std::unique_ptr<FeatureSet> features;
     string analysis_name;
+    llvm::AnalysisKey *analysis_key = nullptr; // set by the concrete analysis, used for invalidation
+    bool loop_dependent = false;
+    // callee classification used if the module classification is not cached
+    CalleeClassification local_callees;
   
    public:
-    FeatureAnalysis(string feature_set = "fan19") : analysis_name("default")
-    {
-      features = FSRegistry::dispatch(feature_set);
-    }
+    FeatureAnalysis(const string &feature_set = "fan19") 
+      : features(FSRegistry::dispatch(feature_set)), analysis_name("default") {}
+    FeatureAnalysis(FeatureAnalysis &&) = default;
+    FeatureAnalysis &operator=(FeatureAnalysis &&) = default;
     virtual ~FeatureAnalysis();
 
     /// this methods allow to change the underlying feature set
-    void setFeatureSet(string &feature_set) { features = FSRegistry::dispatch(feature_set); }
-    FeatureSet *getFeatureSet() { return features; }
+    void setFeatureSet(const string &feature_set) { features = FSRegistry::dispatch(feature_set); }
+    void setFeatureSet(std::unique_ptr<FeatureSet> feature_set) { features = std::move(feature_set); }
+    FeatureSet *getFeatureSet() { return features.get(); }
     string getName() { return analysis_name; }
      
-    /// runs the analysis on a specific function, returns a StringMap
+    /// runs the analysis on a specific function, returns the feature vectors
     using Result = ResultFeatureAnalysis;
     ResultFeatureAnalysis run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam);
 
+    /// add the IR canonicalization passes the analysis requires, they must run before the analysis.
+    /// Analyses never modify the IR themselves, so that their results can be cached by the analysis manager.
+    virtual void addCanonicalizationPasses(llvm::FunctionPassManager &) const {}
+
     /// feature extraction for basic block
     virtual void extract(llvm::BasicBlock &bb);
     /// feature extraction for function
@@ -58,12 +80,15 @@ namespace celerity
     FeatureSetOptions feature_set;
     string analysis;
     string normalization;
-    string filename;
+    std::vector<string> filenames;
+    unsigned threads;
     bool help;
     bool verbose;
+    string feature_set_name; // registry key of the extracted set: feature_set or a loaded definition
   };
 
-  using FARegistry = Registry<celerity::FeatureAnalysis *>;
+  /// Registry of feature analysis factories, taking the name of the feature set to be used
+  using FARegistry = Registry<celerity::FeatureAnalysis, const string &>;
 
 
 } // end namespace celerity
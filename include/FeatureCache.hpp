@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <memory>
+using namespace std;
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "FeatureSet.hpp"
+
+namespace llvm { class Function; }
+
+namespace celerity {
+
+/// Version of the extraction results, part of every cache key.
+/// Bump it whenever a change in the feature sets or analyses alters the extracted values.
+inline constexpr const char feature_cache_version[] = "celerity-features-1";
+
+/// Hit/miss counters of a feature cache
+struct FeatureCacheStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> stores{0};
+    std::atomic<uint64_t> errors{0};   // unreadable or corrupted entries, failed writes
+};
+
+/// Content-addressed, on-disk cache of feature extraction results.
+/// Entries are keyed by a structural hash of the function IR, combined with feature set, analysis and tool version;
+/// an unchanged function is thus answered without running the analysis.
+/// Entries are written to a temporary file and renamed into place, so that several processes can share the
+/// cache directory: a reader sees either a complete entry or no entry. The directory size is bounded by
+/// pruning it with an LLVM cache pruning policy (e.g., "cache_size_bytes=64m:prune_after=168h"), every
+/// prune_interval stores and when the cache is destroyed. Long-running processes (the feature server) thus
+/// prune as they go; the pruning interval of the policy still limits how often the directory is scanned.
+class FeatureCache {
+public:
+    FeatureCache(llvm::StringRef cache_dir, llvm::CachePruningPolicy pruning_policy);
+    ~FeatureCache();
+
+    /// Cache shared by all the analyses of the process, configured with -feature-cache-dir. Returns nullptr if disabled.
+    static FeatureCache *getGlobalCache();
+
+    /// Structural hash of a function: names of local values are ignored, everything affecting the features is hashed
+    static std::string hashFunction(const llvm::Function &fun);
+    /// Cache key for the features of a function extracted with a feature set and an analysis
+    static std::string getKey(const llvm::Function &fun, llvm::StringRef feature_set, llvm::StringRef analysis);
+    /// Cache key from a function hash, to extract several feature sets without hashing the function again
+    static std::string getKey(llvm::StringRef function_hash, llvm::StringRef feature_set, llvm::StringRef analysis);
+
+    /// Fill the feature set with the cached values for the key, returns false on a miss
+    bool lookup(llvm::StringRef key, FeatureSet &features);
+    /// Store the values of the feature set for the key
+    void store(llvm::StringRef key, const FeatureSet &features);
+    /// Read an entry stored as an opaque block (e.g., encoded polynomial features), returns false on a miss.
+    /// The buffer is mapped or allocated by MemoryBuffer, thus 16-byte aligned; the reader validates the content.
+    bool lookup(llvm::StringRef key, std::unique_ptr<llvm::MemoryBuffer> &block);
+    /// The block of the last lookup was rejected by its reader: counted as a corrupted entry and a miss
+    void reportCorrupted();
+    /// Store an opaque block for the key
+    void store(llvm::StringRef key, llvm::ArrayRef<char> block);
+    /// Remove entries according to the pruning policy
+    void prune();
+
+    /// stores between two prunings
+    static constexpr uint64_t prune_interval = 1024;
+
+    const FeatureCacheStats &getStats() const { return stats; }
+    void printStats(llvm::raw_ostream &out_stream) const;
+
+private:
+    std::string getEntryPath(llvm::StringRef key) const;
+    /// write an entry with a temporary file renamed into place
+    void storeEntry(llvm::StringRef key, llvm::function_ref<void(llvm::raw_ostream &out)> write);
+
+    std::string cache_dir;
+    llvm::CachePruningPolicy policy;
+    FeatureCacheStats stats;
+};
+
+} // end namespace celerity
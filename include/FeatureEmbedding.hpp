@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "FeatureSet.hpp"
+
+namespace llvm { class Function; class Module; class MDTuple; }
+
+namespace celerity {
+
+/// Named metadata of the module holding the embedded features
+inline constexpr const char feature_embedding_md[] = "celerity.features";
+
+/// Features embedded into the module they were extracted from. They travel with the bitcode (e.g., into the fat
+/// binary of an application) and answer later extractions of the same functions without running the analysis.
+/// Each entry is a tuple of the named metadata celerity.features:
+///   !{ptr @function, !"<function hash>", !"<feature set>", !"<analysis>",
+///     !{!"<feature name>", ...}, !{i32 <raw count>, ...}, !{float <value>, ...}, !"<polynomials>"}
+/// The feature set is named as in the cache keys (FeatureSet::getCacheName). The schema is a tuple of its own,
+/// uniqued by LLVM, thus stored once for all the functions. Raw counts are empty for polynomial features, whose
+/// counters are the binary block of encodePolFeatures (PolFeatEncoding); the block is empty for the scalar ones.
+/// An entry is stale, and ignored, when the structural hash of the function (FeatureCache::hashFunction) no longer
+/// matches, e.g., after further optimizations. The entries of deleted functions are dropped at the next embedding.
+class FeatureEmbedding {
+public:
+    /// Embedded features of a function, as read from the module
+    struct Entry {
+        std::vector<std::string> names;
+        std::vector<unsigned> raw;
+        std::vector<float> feat;
+        std::string polynomials; // encoded polynomial features, not aligned
+    };
+
+    /// Entry of the features of a function, to be added to its module by embed
+    static llvm::MDTuple *createEntry(llvm::Function &fun, llvm::StringRef feature_set, llvm::StringRef analysis,
+                                      const FeatureSchema &schema, llvm::ArrayRef<unsigned> raw,
+                                      llvm::ArrayRef<float> feat, llvm::StringRef polynomials = "");
+    /// Embed the entries of a pass run, each one replacing the entry of the same function, feature set and analysis.
+    /// The named metadata is rebuilt once for all the entries.
+    static void embed(llvm::Module &module, llvm::ArrayRef<llvm::MDTuple*> entries);
+
+    /// the module holds embedded features, checked before hashing any function
+    static bool hasEmbeddedFeatures(const llvm::Module &module);
+    /// Read the features of a function; false if there is no entry for the feature set and analysis, if it is stale
+    /// or malformed.
+    /// function_hash: hash of the function if already known, computed otherwise
+    static bool lookup(const llvm::Function &fun, llvm::StringRef feature_set, llvm::StringRef analysis, Entry &entry,
+                       llvm::StringRef function_hash = "");
+    /// Fill the feature set with the embedded values, the schema of the entry must match the one of the set
+    static bool lookup(const llvm::Function &fun, llvm::StringRef analysis, FeatureSet &features, llvm::StringRef function_hash = "");
+
+private:
+    /// entry of a function for a feature set and an analysis, nullptr if there is none
+    static llvm::MDTuple *find(const llvm::Function &fun, llvm::StringRef feature_set, llvm::StringRef analysis);
+};
+
+} // end namespace celerity
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <type_traits>
+
+#include <llvm/ADT/SetVector.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+using namespace llvm;
+
+#include "FeatureAnalysis.hpp"
+#include "FeatureEmbedding.hpp"
+#include "FeatureExtraction.hpp"
+#include "CalleeClassification.hpp"
+#ifdef CELERITY_POLFEAT
+#include "PolFeatAnalysis.hpp"
+#include "PolFeatEncoding.hpp"
+#endif
+#include "Logging.hpp"
+
+namespace celerity {
+
+/// Functions whose features are embedded: the kernels of the module, or all the defined functions if it has none
+/// (e.g., C code), as for the kernel-only loading of feature_ext
+inline SetVector<Function*> embedded_functions(Module &module) {
+   SetVector<Function*> functions = find_kernels(module);
+   if (functions.empty())
+      for (Function &fun : module)
+         functions.insert(&fun);
+   functions.remove_if([](Function *fun) { return fun->isDeclaration(); });
+   return functions;
+}
+
+/// name of a feature set in the cache keys and in the embedded features
+inline string feature_set_cache_name(const string &feature_set) {
+   std::unique_ptr<FeatureSet> fs = FSRegistry::dispatch(feature_set);
+   return fs ? fs->getCacheName() : feature_set;
+}
+
+// Module pass embedding the results of a feature analysis into the module (see FeatureEmbedding), to be run last:
+// the embedded features are valid as long as the functions are not changed.
+template <typename AnalysisType>
+struct FeatureEmbeddingPass : public llvm::PassInfoMixin<celerity::FeatureEmbeddingPass<AnalysisType> > {
+   static_assert(std::is_base_of<FeatureAnalysis, AnalysisType>::value, "AnalysisType must derive from FeatureAnalysis");
+
+ public:
+   llvm::PreservedAnalyses run(llvm::Module &module, llvm::ModuleAnalysisManager &mam) {
+      FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+      // classify the called functions once, the feature analyses use the cached classification
+      mam.getResult<CalleeClassificationAnalysis>(module);
+      string feature_set;
+      // the named metadata is rebuilt once, with the entries of all the functions
+      SmallVector<MDTuple*, 16> entries;
+      for (Function *fun : embedded_functions(module)) {
+         ResultFeatureAnalysis &result = fam.getResult<AnalysisType>(*fun);
+         if (feature_set.empty())
+            feature_set = feature_set_cache_name(result.feature_set_name);
+         entries.push_back(FeatureEmbedding::createEntry(*fun, feature_set, result.analysis_name, *result.schema,
+                                                         result.raw, result.feat));
+      }
+      FeatureEmbedding::embed(module, entries);
+      // only module metadata is added
+      return PreservedAnalyses::all();
+   }
+
+   static bool isRequired() { return true; }
+};
+
+#ifdef CELERITY_POLFEAT
+// Module pass embedding the polynomial features into the module, the polynomials as the binary block of
+// encodePolFeatures, read back by PolFeatAnalysis without parsing
+struct PolFeatEmbeddingPass : public llvm::PassInfoMixin<PolFeatEmbeddingPass> {
+
+ public:
+   llvm::PreservedAnalyses run(llvm::Module &module, llvm::ModuleAnalysisManager &mam) {
+      FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+      mam.getResult<CalleeClassificationAnalysis>(module);
+      string feature_set;
+      std::vector<char> polynomials;
+      SmallVector<MDTuple*, 16> entries;
+      for (Function *fun : embedded_functions(module)) {
+         ResultPolFeatSet &result = fam.getResult<PolFeatAnalysis>(*fun);
+         if (feature_set.empty())
+            feature_set = feature_set_cache_name(result.feature_set_name);
+         polynomials.clear();
+         if (Error err = encodePolFeatures(result, polynomials)) {
+            CELERITY_LOG(cache, warning) << "WARNING: features of " << fun->getName() << " not embedded: "
+                                         << toString(std::move(err)) << "\n";
+            continue;
+         }
+         entries.push_back(FeatureEmbedding::createEntry(*fun, feature_set, "polfeat", *result.schema, {}, result.feat,
+                                                         StringRef(polynomials.data(), polynomials.size())));
+      }
+      FeatureEmbedding::embed(module, entries);
+      return PreservedAnalyses::all();
+   }
+
+   static bool isRequired() { return true; }
+};
+#endif
+
+} // end namespace celerity
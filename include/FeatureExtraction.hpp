@@ -0,0 +1,108 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "FeatureSet.hpp"
+#include "FeatureAnalysis.hpp"
+
+namespace celerity {
+
+#ifdef CELERITY_POLFEAT
+struct PolFeatAnalysis;
+class IMPoly;
+#endif
+
+/// Kernels of a module: functions with the SPIR kernel calling convention or listed in the opencl.kernels metadata.
+/// Both are available without materializing any function body.
+llvm::SetVector<llvm::Function*> find_kernels(llvm::Module &module);
+
+/// Materialize the kernels of a lazily loaded module and the functions reachable from them,
+/// the bodies of all the other functions are dropped. Modules without kernels (e.g., C code) are fully materialized.
+/// Returns the number of materialized functions.
+llvm::Expected<unsigned> materialize_kernels(llvm::Module &module);
+
+
+/// In-process feature extraction, for runtimes embedding the analyses (libcelerity_features).
+/// An extractor owns its analysis managers and analysis, thus it is used by one thread at a time;
+/// threads extracting concurrently use an extractor each. Nothing is written to the standard output:
+/// warnings and debug messages go to the diagnostic stream.
+///
+/// Results are written into buffers provided by the caller: row i holds the getNumFeatures() values of the
+/// i-th function defined in the module (in module order). Extracting a module returns the number of rows
+/// available, which can exceed the capacity of the buffers; only the rows that fit are written.
+class FeatureExtractor {
+ public:
+    /// analysis: a registered feature analysis (e.g., "default", "kofler13") or "polfeat"; feature_set: e.g., "fan19"
+    static llvm::Expected<std::unique_ptr<FeatureExtractor>> create(llvm::StringRef analysis = "default", llvm::StringRef feature_set = "fan19");
+    ~FeatureExtractor();
+    FeatureExtractor(const FeatureExtractor &) = delete;
+    FeatureExtractor &operator=(const FeatureExtractor &) = delete;
+
+    const FeatureSchema &getSchema() const { return *schema; }
+    unsigned getNumFeatures() const { return schema->size(); }
+    llvm::StringRef getAnalysisName() const { return analysis_name; }
+    llvm::StringRef getFeatureSetName() const { return feature_set_name; }
+
+    /// bitcode input: materialize only the kernels and their callees (default: all the functions)
+    void setKernelsOnly(bool kernels_only) { only_kernels = kernels_only; }
+    /// destination of warnings and debug messages (default: llvm::errs())
+    void setDiagnosticStream(llvm::raw_ostream &stream) { diagnostics = &stream; }
+
+    /// Extract the features of a function of an existing module. raw and feat hold getNumFeatures() values each,
+    /// either can be empty if not needed. The canonicalization passes of the analysis (e.g., LCSSA for kofler13)
+    /// run on the function in place.
+    llvm::Error extract(llvm::Function &fun, llvm::MutableArrayRef<unsigned> raw, llvm::MutableArrayRef<float> feat);
+    /// Extract the features of all the functions defined in an existing module, which is not copied.
+    /// Function names are appended to names, if not null.
+    llvm::Expected<size_t> extract(llvm::Module &module, llvm::MutableArrayRef<unsigned> raw, llvm::MutableArrayRef<float> feat,
+                                   std::vector<std::string> *names = nullptr);
+    /// Extract the features of a bitcode module held in memory. The buffer is parsed in place (not copied),
+    /// it only needs to be valid during the call.
+    llvm::Expected<size_t> extract(llvm::MemoryBufferRef bitcode, llvm::MutableArrayRef<unsigned> raw, llvm::MutableArrayRef<float> feat,
+                                   std::vector<std::string> *names = nullptr);
+
+#ifdef CELERITY_POLFEAT
+    /// Polynomial counters of a function (polfeat analysis only), polys holds getNumFeatures() values
+    llvm::Error extractPolynomials(llvm::Function &fun, llvm::MutableArrayRef<IMPoly> polys);
+#endif
+
+ private:
+    FeatureExtractor() = default;
+    /// runs the analysis on a function and copies the results; raw counters are not available for polfeat
+    llvm::Error run(llvm::Function &fun, llvm::MutableArrayRef<unsigned> raw, llvm::MutableArrayRef<float> feat);
+
+    std::string analysis_name;
+    std::string feature_set_name;
+    const FeatureSchema *schema = nullptr;
+    bool only_kernels = false;
+    llvm::raw_ostream *diagnostics = &llvm::errs();
+
+    llvm::PassBuilder PB;
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::FunctionPassManager canonicalization;
+    std::unique_ptr<FeatureAnalysis> analysis;
+#ifdef CELERITY_POLFEAT
+    std::unique_ptr<PolFeatAnalysis> polfeat;
+#endif
+};
+
+} // end namespace celerity
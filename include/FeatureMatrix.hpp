@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "FeatureSet.hpp"
+
+namespace celerity {
+
+/// Binary, columnar feature matrix file (".cfm"), designed to be memory-mapped by training jobs.
+/// A file is a sequence of self-contained chunks; every run appends a new chunk, thus a file is never rewritten.
+/// All sections are 8-byte aligned and all the offsets are relative to the beginning of the chunk:
+///
+///   FeatureMatrixHeader
+///   strings:  feature set name, analysis name, feature names (num_features), module names (num_modules),
+///             kernel names (num_rows), all NUL-terminated, at string_offset
+///   uint32 module_id[num_rows]                                  at module_offset
+///   uint32 raw[num_features][num_rows]  (one column per feature) at raw_offset
+///   float  feat[num_features][num_rows] (one column per feature) at feat_offset
+///
+/// The next chunk starts at chunk_size. Values are stored in the byte order of the writer, which is recorded in
+/// byte_order; the reader rejects files written with a different one.
+struct FeatureMatrixHeader {
+    char     magic[8];      // "CELFMAT\0"
+    uint32_t version;
+    uint32_t byte_order;    // 0x01020304 in the writer's byte order
+    uint32_t num_features;
+    uint32_t num_modules;
+    uint64_t num_rows;
+    uint64_t chunk_size;
+    uint64_t string_offset;
+    uint64_t string_size;
+    uint64_t module_offset;
+    uint64_t raw_offset;
+    uint64_t feat_offset;
+};
+
+/// Collects the features of many kernels and writes them as a chunk of a feature matrix file
+class FeatureMatrixWriter {
+public:
+    FeatureMatrixWriter(llvm::StringRef feature_set, llvm::StringRef analysis, const FeatureSchema &schema);
+
+    /// add the features of a kernel; rows are written in insertion order
+    void addRow(llvm::StringRef module, llvm::StringRef kernel, llvm::ArrayRef<unsigned> raw, llvm::ArrayRef<float> feat);
+    size_t getNumRows() const { return kernels.size(); }
+
+    /// write the rows as a chunk; with append, the chunk is added at the end of an existing file.
+    /// The chunk is emitted with a single write, so that concurrent appends of different processes do not interleave.
+    llvm::Error write(llvm::StringRef filename, bool append) const;
+    /// serialize the rows as a chunk in memory
+    void serialize(std::vector<char> &buffer) const;
+
+private:
+    string feature_set_name;
+    string analysis_name;
+    const FeatureSchema *schema;
+    std::vector<string> modules;
+    std::vector<uint32_t> module_ids;
+    std::vector<string> kernels;
+    std::vector<uint32_t> raw;   // row-major while collecting, transposed when written
+    std::vector<float> feat;
+};
+
+/// Zero-copy view of a chunk of a feature matrix file
+class FeatureMatrixChunk {
+public:
+    FeatureMatrixChunk(const FeatureMatrixHeader *header, std::vector<llvm::StringRef> strings);
+
+    llvm::StringRef getFeatureSetName() const { return strings[0]; }
+    llvm::StringRef getAnalysisName() const { return strings[1]; }
+    unsigned getNumFeatures() const { return header->num_features; }
+    uint64_t getNumRows() const { return header->num_rows; }
+    llvm::StringRef getFeatureName(unsigned feature_id) const { return strings[2 + feature_id]; }
+    llvm::StringRef getKernelName(uint64_t row) const { return strings[2 + header->num_features + header->num_modules + row]; }
+    llvm::StringRef getModuleName(uint64_t row) const { return strings[2 + header->num_features + getModuleIds()[row]]; }
+
+    const uint32_t *getModuleIds() const { return column<uint32_t>(header->module_offset, 0); }
+    /// contiguous column of the raw counters of a feature
+    const uint32_t *getRawColumn(unsigned feature_id) const { return column<uint32_t>(header->raw_offset, feature_id); }
+    /// contiguous column of the normalized values of a feature
+    const float *getFeatColumn(unsigned feature_id) const { return column<float>(header->feat_offset, feature_id); }
+
+private:
+    template <typename T>
+    const T *column(uint64_t offset, unsigned column_id) const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const char*>(header) + offset) + column_id * header->num_rows;
+    }
+
+    const FeatureMatrixHeader *header;
+    std::vector<llvm::StringRef> strings;
+};
+
+/// Reader of feature matrix files: the file is memory-mapped and the chunks are validated, values are not copied
+class FeatureMatrixReader {
+public:
+    static llvm::Expected<FeatureMatrixReader> open(llvm::StringRef filename);
+    static llvm::Expected<FeatureMatrixReader> read(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+    const std::vector<FeatureMatrixChunk> &getChunks() const { return chunks; }
+    uint64_t getNumRows() const;
+
+private:
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    std::vector<FeatureMatrixChunk> chunks;
+};
+
+} // end namespace celerity
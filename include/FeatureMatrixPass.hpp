@@ -0,0 +1,50 @@
+#pragma once
+
+#include <type_traits>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+using namespace llvm;
+
+#include "FeatureAnalysis.hpp"
+#include "CalleeClassification.hpp"
+#include "FeatureMatrix.hpp"
+
+namespace celerity {
+
+// Module pass appending the results of a feature analysis, one row per defined function, to a feature matrix file.
+template <typename AnalysisType>
+struct FeatureMatrixPass : public llvm::PassInfoMixin<celerity::FeatureMatrixPass<AnalysisType> > {
+   static_assert(std::is_base_of<FeatureAnalysis, AnalysisType>::value, "AnalysisType must derive from FeatureAnalysis");
+
+ public:
+   explicit FeatureMatrixPass(string output_filename) : filename(std::move(output_filename)) {}
+
+   llvm::PreservedAnalyses run(llvm::Module &module, llvm::ModuleAnalysisManager &mam) {
+      FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+      // classify the called functions once, the feature analyses use the cached classification
+      mam.getResult<CalleeClassificationAnalysis>(module);
+      std::unique_ptr<FeatureMatrixWriter> writer;
+      for (Function &fun : module) {
+         if (fun.isDeclaration())
+            continue;
+         ResultFeatureAnalysis &result = fam.getResult<AnalysisType>(fun);
+         if (!writer)
+            writer = std::make_unique<FeatureMatrixWriter>(result.feature_set_name, result.analysis_name, *result.schema);
+         writer->addRow(module.getName(), fun.getName(), result.raw, result.feat);
+      }
+      if (writer) {
+         if (Error err = writer->write(filename, true))
+            errs() << "error: " << toString(std::move(err)) << "\n";
+      }
+      return PreservedAnalyses::all();
+   }
+
+   static bool isRequired() { return true; }
+
+ private:
+   string filename;
+};
+
+} // end namespace celerity
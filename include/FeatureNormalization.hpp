@@ -20,19 +20,10 @@ void normalize(FeatureSet &fs){
     if(fs.instruction_tot_contrib == 0) 
         instructionContribution = 0.f; // we don't like NAN
         
-    //for(auto entry : fs.raw){
-    //for(llvm::StringMap<unsigned>::const_iterator it = fs.raw.begin();
-    //    it != fs.raw.end();
-    //    it++)
-    auto f_names = fs.raw.keys();
-    for(auto feature_name : f_names)
+    for(unsigned feature_id = 0; feature_id < fs.raw.size(); feature_id++)
     {
-        //for(std::pair<std::string, unsigned> entry : fs.raw){            
-        //const string feature_name = it->first; 
-        //float instTypeNum = float(it->second);
-        int inst_int_val = fs.raw[feature_name];
-        float inst_flt_val = float(inst_int_val);
-        fs.feat[feature_name] = inst_flt_val * instructionContribution;
+        float inst_flt_val = float(fs.raw[feature_id]);
+        fs.feat[feature_id] = inst_flt_val * instructionContribution;
     }
 }
 
@@ -9,6 +9,7 @@ using namespace llvm;
 
 #include "FeatureSet.hpp"
 #include "FeatureAnalysis.hpp"
+#include "FusedFeatureAnalysis.hpp"
 #include "FeaturePrinter.hpp"
 #include "FeatureNormalization.hpp"
 
@@ -32,11 +33,11 @@ struct FeaturePrinterPass : public llvm::PassInfoMixin<celerity::FeaturePrinterP
       ResultFeatureAnalysis &feature_set = fam.getResult<AnalysisType>(fun);    
       
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, true);
-      print_feature_names(feature_set.raw, out_stream);
+      print_feature_names(*feature_set.schema, out_stream);
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
       print_feature_values(feature_set.raw, out_stream);
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, true);
-      print_feature_names(feature_set.feat, out_stream);
+      print_feature_names(*feature_set.schema, out_stream);
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
       print_feature_values(feature_set.feat, out_stream);
       
@@ -49,4 +50,32 @@ struct FeaturePrinterPass : public llvm::PassInfoMixin<celerity::FeaturePrinterP
     llvm::raw_ostream &out_stream;
 };
 
+// Pass printing the results of a fused feature analysis, one block per (analysis, feature set) pair.
+struct FusedFeaturePrinterPass : public llvm::PassInfoMixin<FusedFeaturePrinterPass> {
+ public:
+   explicit FusedFeaturePrinterPass(llvm::raw_ostream &stream) : out_stream(stream) {}
+
+   llvm::PreservedAnalyses run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam) {
+      out_stream.changeColor(llvm::raw_null_ostream::Colors::MAGENTA);
+      out_stream << "Print features for function: " << fun.getName() << "\n";
+
+      ResultFusedFeatureAnalysis &fused = fam.getResult<FusedFeatureAnalysis>(fun);
+      for(ResultFeatureAnalysis &feature_set : fused.results){
+         out_stream.changeColor(llvm::raw_null_ostream::Colors::YELLOW);
+         out_stream << feature_set.analysis_name << " " << feature_set.feature_set_name << "\n";
+         out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, true);
+         print_feature_names(*feature_set.schema, out_stream);
+         out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
+         print_feature_values(feature_set.raw, out_stream);
+         print_feature_values(feature_set.feat, out_stream);
+      }
+      return PreservedAnalyses::all();
+   }
+
+   static bool isRequired() { return true; }
+
+ private:
+    llvm::raw_ostream &out_stream;
+};
+
 } // end namespace celerity
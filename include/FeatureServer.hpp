@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace celerity {
+
+//-----------------------------------------------------------------------------
+// Wire format of the feature extraction server (local Unix socket, host byte order).
+// A client sends requests, each one a header followed by a bitcode (or textual IR) module, and may send
+// further requests before receiving the replies (pipelining). Replies carry the request ID and may arrive
+// in any order: a header, a string table, padding to 4 bytes and the feature values, one row per kernel.
+//-----------------------------------------------------------------------------
+static const char feature_request_magic[4] = {'C', 'F', 'R', 'Q'};
+static const char feature_reply_magic[4]   = {'C', 'F', 'R', 'P'};
+/// largest module accepted by the server
+static const uint64_t feature_request_max_size = 1ull << 30;
+
+struct FeatureRequestHeader {
+    char magic[4];
+    uint32_t request_id;   // chosen by the client, returned in the reply
+    uint64_t module_size;  // bytes of the module following the header
+};
+static_assert(sizeof(FeatureRequestHeader) == 16, "unexpected padding in the request header");
+
+/// Reply status
+enum class FeatureReplyStatus : uint32_t { ok, error };
+
+struct FeatureReplyHeader {
+    char magic[4];
+    uint32_t request_id;
+    uint32_t status;       // FeatureReplyStatus
+    uint32_t num_features;
+    uint32_t num_rows;     // one row per extracted kernel
+    uint32_t string_size;  // kernel names (NUL terminated), or the error message if status is error
+};
+static_assert(sizeof(FeatureReplyHeader) == 24, "unexpected padding in the reply header");
+
+/// Decoded reply: feature values are stored row-major, num_features values per kernel
+struct FeatureReply {
+    uint32_t request_id = 0;
+    FeatureReplyStatus status = FeatureReplyStatus::ok;
+    uint32_t num_features = 0;
+    std::vector<std::string> kernels;
+    std::vector<float> feat;
+    std::string error;
+
+    /// append the encoded reply to a buffer
+    void serialize(std::vector<char> &buffer) const;
+};
+
+
+/// Long-running extraction server. A fixed number of workers keep their extraction state warm
+/// (LLVM context, pass builder, analysis managers) and process the requests of all the connections.
+/// Each connection has a reader thread that queues its requests; the queue is bounded, thus a client sending
+/// faster than the workers extract is slowed down by the socket instead of filling the server memory.
+class FeatureServer {
+ public:
+    /// Extracts the features of a module on the worker with the given ID; the reply is filled except for the ID.
+    /// The handler is called concurrently by different workers, never twice at once with the same worker ID.
+    using Handler = std::function<void(unsigned worker_id, std::unique_ptr<llvm::MemoryBuffer> module, FeatureReply &reply)>;
+
+    FeatureServer(unsigned num_workers, unsigned max_pending, Handler request_handler);
+    ~FeatureServer();
+    FeatureServer(const FeatureServer &) = delete;
+    FeatureServer &operator=(const FeatureServer &) = delete;
+
+    /// bind the socket (a stale socket file is replaced) and start the workers
+    llvm::Error listen(llvm::StringRef socket_path);
+    /// accept connections until stop() is called
+    llvm::Error serve();
+    /// stop accepting connections, the pending requests are completed by the destructor.
+    /// Async-signal-safe: may be called by a SIGINT/SIGTERM handler to shut the server down cleanly.
+    void stop();
+
+    /// number of requests completed so far
+    uint64_t getNumRequests() const { return completed_requests; }
+
+ private:
+    struct Connection;
+    struct Job {
+        std::shared_ptr<Connection> connection;
+        uint32_t request_id;
+        std::unique_ptr<llvm::MemoryBuffer> module;
+    };
+
+    /// reader thread of a connection, joined once the connection is closed
+    struct Reader {
+        std::thread thread;
+        std::weak_ptr<Connection> connection;
+        bool finished = false;
+    };
+
+    void readRequests(std::shared_ptr<Connection> connection);
+    void runWorker(unsigned worker_id);
+
+    unsigned num_workers;
+    unsigned max_pending;
+    Handler handler;
+    std::string path;
+    int listen_fd = -1;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> completed_requests{0};
+
+    // bounded job queue shared by the workers, the lock also guards the readers
+    std::mutex queue_lock;
+    std::condition_variable queue_not_empty;
+    std::condition_variable queue_not_full;
+    std::deque<Job> queue;
+    bool closing = false;
+    std::vector<std::thread> workers;
+    std::list<Reader> readers; // one per connection, a list keeps the references of the running threads valid
+};
+
+
+/// Client side of the protocol, used by the latency benchmark
+class FeatureClient {
+ public:
+    FeatureClient() = default;
+    ~FeatureClient();
+    FeatureClient(const FeatureClient &) = delete;
+    FeatureClient &operator=(const FeatureClient &) = delete;
+
+    llvm::Error connect(llvm::StringRef socket_path);
+    /// send a request without waiting for the reply
+    llvm::Error send(uint32_t request_id, llvm::StringRef module);
+    /// wait for the next reply
+    llvm::Expected<FeatureReply> receive();
+    /// shut the connection down, a receive() blocked on another thread fails
+    void shutdown();
+
+ private:
+    int fd = -1;
+};
+
+} // end namespace celerity
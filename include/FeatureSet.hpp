@@ -6,111 +6,314 @@
 #include <sstream>
 #include <type_traits>
 #include <cstdint>
+#include <vector>
+#include <algorithm>
 using namespace std;
 
+#include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Intrinsics.h>
 
 #include "Registry.hpp"
+#include "CalleeClassification.hpp"
 
 namespace celerity {
 
 // Supported feature sets
 enum FeatureSetOptions { fan19, grewe13, full };
 
+/// Registry key of a feature set option
+inline string getFeatureSetName(FeatureSetOptions option){
+    switch(option){
+        case grewe13: return "grewe11";
+        case full:    return "full";
+        default:      return "fan19";
+    }
+}
+
+/// Ordered list of the features exposed by a feature set. 
+/// A feature ID is the index of the feature in this list; names are only used for printing.
+class FeatureSchema {
+public:
+    FeatureSchema(std::vector<std::string> feature_names) : names(std::move(feature_names)) {}
+
+    unsigned size() const { return names.size(); }
+    llvm::StringRef getName(unsigned feature_id) const { return names[feature_id]; }
+    const std::vector<std::string> &getNames() const { return names; }
+
+    /// returns the ID of a feature by name, or -1 if the feature is not part of the schema
+    int getId(llvm::StringRef feature_name) const {
+        for(unsigned i=0; i<names.size(); i++)
+            if(names[i] == feature_name)
+                return i;
+        return -1;
+    }
+
+private:
+    std::vector<std::string> names;
+};
+
+
 /// A set of features, including both raw values and normalized ones. 
-/// Abstract class, with different subslasses
+/// Abstract class, with different subslasses. 
+/// Values are stored in contiguous arrays indexed by the feature IDs of the set's schema.
 class FeatureSet {
 public:
-    llvm::StringMap<unsigned> raw; // features as counters, before normalization
-    llvm::StringMap<float> feat;   // features after normalization, they should not necessarily be the same features as the raw
+    std::vector<unsigned> raw; // features as counters, before normalization
+    std::vector<float> feat;   // features after normalization, they follow the same schema as the raw counters
     int instruction_num;
     int instruction_tot_contrib;
     string name;
 
+protected:
+    const FeatureSchema *schema;
+    CalleeClassification *callees = nullptr; // memoized callee classification, not owned
+    CalleeInfo callee_scratch;                // classification of the last callee, if not memoized
+
 public:
-    FeatureSet() : name("default"){}
-    FeatureSet(string feature_set_name) : name(feature_set_name){}
+    FeatureSet(string feature_set_name, const FeatureSchema &feature_schema) 
+      : raw(feature_schema.size(), 0), feat(feature_schema.size(), 0.f), 
+        instruction_num(0), instruction_tot_contrib(0), name(feature_set_name), schema(&feature_schema) {}
     virtual ~FeatureSet(){}
 
-    llvm::StringMap<unsigned> getFeatureCounts(){ return raw; }
-    llvm::StringMap<float> getFeatureValues(){ return feat; }
+    const std::vector<unsigned> &getFeatureCounts() const { return raw; }
+    const std::vector<float> &getFeatureValues() const { return feat; }
+    const FeatureSchema &getSchema() const { return *schema; }
     string getName(){ return name; }
+    /// name of the set in the feature cache keys, it changes with the definition of the features
+    virtual string getCacheName(){ return name; }
+
+    /// set the classification used for the called functions, it must outlive the evaluation of the module.
+    /// Without a classification (nullptr) every call is demangled and classified again.
+    void setCalleeClassification(CalleeClassification *classification){ callees = classification; }
+    CalleeClassification *getCalleeClassification(){ return callees; }
+    /// classification of a called function
+    const CalleeInfo &classifyCallee(const llvm::Function &callee){
+        if(callees)
+            return callees->classify(callee);
+        callee_scratch = CalleeClassification::compute(callee);
+        return callee_scratch;
+    }
 
     /// set all features to zero
     virtual void reset(){
-        for(StringRef rkey : raw.keys())
-            raw[rkey] = 0;
-        for(StringRef fkey : feat.keys())
-            feat[fkey] = 0;
+        std::fill(raw.begin(), raw.end(), 0);
+        std::fill(feat.begin(), feat.end(), 0.f);
         instruction_num = 0;
         instruction_tot_contrib = 0;
     }
 
-    virtual void add(const string &feature_name, int contribution = 1){
-        int old = raw[feature_name];
-        raw[feature_name] = old + contribution;
+    void add(unsigned feature_id, int contribution = 1){
+        raw[feature_id] += contribution;
         instruction_num += 1;
         instruction_tot_contrib += contribution;
     }
 
+    /// add the counters of a set with the same schema, each contribution multiplied by weight.
+    /// Equivalent to evaluating again the instructions counted by the other set, with the given contribution.
+    void accumulate(const FeatureSet &counts, int weight = 1){
+        assert(counts.raw.size() == raw.size());
+        for(size_t i = 0; i < raw.size(); i++)
+            raw[i] += counts.raw[i] * weight;
+        instruction_num += counts.instruction_num;
+        instruction_tot_contrib += counts.instruction_tot_contrib * weight;
+    }
+
     virtual void eval(llvm::Instruction &inst, int contribution = 1) = 0;
+    /// evaluate all the instructions of a basic block with the same contribution
+    virtual void eval(llvm::BasicBlock &bb, int contribution = 1){
+        for(llvm::Instruction &inst : bb)
+            eval(inst, contribution);
+    }
     virtual void normalize(llvm::Function &fun);
     virtual void print(llvm::raw_ostream &out_stream);     
 };
 
 
+/// Base of the feature sets written as an llvm::InstVisitor (CRTP): Derived implements visitXXX methods,
+/// the fallback visitInstruction handles the instructions without a more specific visit method.
+/// The opcode dispatch is resolved at compile time, and a basic block costs a single virtual call:
+/// the visit methods are inlined into the block loop. Visit methods count features with count().
+template <typename Derived>
+class FeatureSetVisitor : public FeatureSet, public llvm::InstVisitor<Derived> {
+protected:
+    int contribution = 1; // contribution of the instructions being visited
+
+    void count(unsigned feature_id){ add(feature_id, contribution); }
+
+private:
+    /// same dispatch as InstVisitor::visit(Instruction&), forced inline into the block loop
+    /// (the compilers keep the switch of InstVisitor out of line, one call per instruction)
+    LLVM_ATTRIBUTE_ALWAYS_INLINE void dispatch(llvm::Instruction &inst){
+        switch(inst.getOpcode()){
+#define HANDLE_INST(NUM, OPCODE, CLASS) \
+        case llvm::Instruction::OPCODE: \
+            return static_cast<Derived*>(this)->visit##OPCODE(static_cast<llvm::CLASS&>(inst));
+#include <llvm/IR/Instruction.def>
+        default: llvm_unreachable("unknown instruction type");
+        }
+    }
+
+public:
+    FeatureSetVisitor(string feature_set_name, const FeatureSchema &feature_schema) : FeatureSet(feature_set_name, feature_schema) {}
+
+    void eval(llvm::Instruction &inst, int contribution = 1) override;
+    void eval(llvm::BasicBlock &bb, int contribution = 1) override;
+};
+
+// defined out of line, so that they are only instantiated with the visit methods, see FeatureSet.cpp
+template <typename Derived>
+void FeatureSetVisitor<Derived>::eval(llvm::Instruction &inst, int inst_contribution){
+    contribution = inst_contribution;
+    dispatch(inst);
+}
+
+template <typename Derived>
+void FeatureSetVisitor<Derived>::eval(llvm::BasicBlock &bb, int bb_contribution){
+    contribution = bb_contribution;
+    for(llvm::Instruction &inst : bb)
+        dispatch(inst);
+}
+
+
 /// Feature set based on Fan's work, specifically designed for GPU architecture. 
-class Fan19FeatureSet : public FeatureSet {
+class Fan19FeatureSet : public FeatureSetVisitor<Fan19FeatureSet> {
  public:
-    Fan19FeatureSet() : FeatureSet("fan19"){}
+    /// feature IDs, in schema order
+    enum Feature : unsigned { int_add, int_mul, int_div, int_bw, flt_add, flt_mul, flt_div, sp_fun, mem_gl, mem_loc };
+    static const FeatureSchema &featureSchema();
+
+    Fan19FeatureSet() : FeatureSetVisitor("fan19", featureSchema()){}
     virtual ~Fan19FeatureSet(){}
-    virtual void reset();
-    virtual void eval(llvm::Instruction &inst, int contribution = 1);   
-     
+
+    // integer and floating point arithmetic
+    void visitAdd(llvm::BinaryOperator &) { count(int_add); }
+    void visitSub(llvm::BinaryOperator &) { count(int_add); }
+    void visitMul(llvm::BinaryOperator &) { count(int_mul); }
+    void visitUDiv(llvm::BinaryOperator &) { count(int_div); }
+    void visitSDiv(llvm::BinaryOperator &) { count(int_div); }
+    void visitShl(llvm::BinaryOperator &) { count(int_bw); }
+    void visitLShr(llvm::BinaryOperator &) { count(int_bw); }
+    void visitAShr(llvm::BinaryOperator &) { count(int_bw); }
+    void visitAnd(llvm::BinaryOperator &) { count(int_bw); }
+    void visitOr(llvm::BinaryOperator &) { count(int_bw); }
+    void visitXor(llvm::BinaryOperator &) { count(int_bw); }
+    void visitFAdd(llvm::BinaryOperator &) { count(flt_add); }
+    void visitFSub(llvm::BinaryOperator &) { count(flt_add); }
+    void visitFMul(llvm::BinaryOperator &) { count(flt_mul); }
+    void visitFDiv(llvm::BinaryOperator &) { count(flt_div); }
+    // special functions
+    void visitCallInst(llvm::CallInst &call);
+    // global & local memory access
+    void visitLoadInst(llvm::LoadInst &load) { countMemAccess(load.getPointerAddressSpace()); }
+    void visitStoreInst(llvm::StoreInst &store) { countMemAccess(store.getPointerAddressSpace()); }
+    // instructions ignored: control flow, conversions, vector and aggregate operations, addressing, comparisons
+    void visitPHINode(llvm::PHINode &) {}
+    void visitBranchInst(llvm::BranchInst &) {}
+    void visitIndirectBrInst(llvm::IndirectBrInst &) {}
+    void visitReturnInst(llvm::ReturnInst &) {}
+    void visitUIToFPInst(llvm::UIToFPInst &) {}
+    void visitFPToSIInst(llvm::FPToSIInst &) {}
+    void visitSIToFPInst(llvm::SIToFPInst &) {}
+    void visitBitCastInst(llvm::BitCastInst &) {}
+    void visitSExtInst(llvm::SExtInst &) {}
+    void visitZExtInst(llvm::ZExtInst &) {}
+    void visitTruncInst(llvm::TruncInst &) {}
+    void visitExtractElementInst(llvm::ExtractElementInst &) {}
+    void visitInsertElementInst(llvm::InsertElementInst &) {}
+    void visitShuffleVectorInst(llvm::ShuffleVectorInst &) {}
+    void visitExtractValueInst(llvm::ExtractValueInst &) {}
+    void visitInsertValueInst(llvm::InsertValueInst &) {}
+    void visitGetElementPtrInst(llvm::GetElementPtrInst &) {}
+    void visitAllocaInst(llvm::AllocaInst &) {}
+    void visitICmpInst(llvm::ICmpInst &) {}
+    void visitFCmpInst(llvm::FCmpInst &) {}
+    // anything missing?
+    void visitInstruction(llvm::Instruction &inst);
+ private:
+    void countMemAccess(unsigned address_space);
 };
 
 /// Feature set used by Grewe & O'Boyle. It is very generic and mainly designed to catch mem. vs comp. 
-class Grewe11FeatureSet : public FeatureSet {
+class Grewe11FeatureSet : public FeatureSetVisitor<Grewe11FeatureSet> {
  public:
-    Grewe11FeatureSet() : FeatureSet("grewe11"){}
+    /// feature IDs, in schema order
+    enum Feature : unsigned { int_op, int4_op, float_op, float4_op, math, barrier, mem_acc, mem_loc, mem_coal };
+    static const FeatureSchema &featureSchema();
+
+    Grewe11FeatureSet() : FeatureSetVisitor("grewe11", featureSchema()){}
     virtual ~Grewe11FeatureSet(){}
-    virtual void reset();
-    virtual void eval(llvm::Instruction &inst, int contribution = 1);
     virtual void normalize(llvm::Function &fun);
+
+    // int
+    void visitAdd(llvm::BinaryOperator &) { count(int_op); }
+    void visitSub(llvm::BinaryOperator &) { count(int_op); }
+    void visitMul(llvm::BinaryOperator &) { count(int_op); }
+    void visitUDiv(llvm::BinaryOperator &) { count(int_op); }
+    void visitSDiv(llvm::BinaryOperator &) { count(int_op); }
+    void visitShl(llvm::BinaryOperator &) { count(int_op); }
+    void visitLShr(llvm::BinaryOperator &) { count(int_op); }
+    void visitAShr(llvm::BinaryOperator &) { count(int_op); }
+    void visitAnd(llvm::BinaryOperator &) { count(int_op); }
+    void visitOr(llvm::BinaryOperator &) { count(int_op); }
+    void visitXor(llvm::BinaryOperator &) { count(int_op); }
+    // float
+    void visitFAdd(llvm::BinaryOperator &) { count(float_op); }
+    void visitFSub(llvm::BinaryOperator &) { count(float_op); }
+    void visitFMul(llvm::BinaryOperator &) { count(float_op); }
+    void visitFDiv(llvm::BinaryOperator &) { count(float_op); }
+    // int4 TODO
+    // float4 TODO
+    // math and barriers: only the calls that are neither math, barrier nor OpenCL builtins are reported as not
+    // recognized (before the opcode dispatch, recognized math and barrier calls were reported too)
+    void visitCallInst(llvm::CallInst &call);
+    // mem access, local mem access
+    void visitLoadInst(llvm::LoadInst &load) { countMemAccess(load.getPointerAddressSpace()); }
+    void visitStoreInst(llvm::StoreInst &store) { countMemAccess(store.getPointerAddressSpace()); }
+    // grewe11 does not report the other instructions
+    void visitInstruction(llvm::Instruction &) {}
+ private:
+    void countMemAccess(unsigned address_space);
 }; 
 
-/// Feature set used by Fan, designed for GPU architecture. 
+/// Feature set with one feature per LLVM IR opcode; the feature ID is the opcode minus one. 
+/// No visitor: the opcode is the feature, a dispatch on it would only add a branch per instruction.
 class FullFeatureSet : public FeatureSet {
  public:
-    FullFeatureSet() : FeatureSet("full"){}
+    static const FeatureSchema &featureSchema();
+
+    FullFeatureSet() : FeatureSet("full", featureSchema()){}
     virtual ~FullFeatureSet(){}
     //virtual void reset(); we are fine the the super class reset()
     virtual void eval(llvm::Instruction &inst, int contribution = 1);
+    virtual void eval(llvm::BasicBlock &bb, int contribution = 1);
 };
 
-/// Registry of feature sets
-using FSRegistry = Registry<celerity::FeatureSet*>;
+// the visitors are instantiated once, in FeatureSet.cpp
+extern template class FeatureSetVisitor<Fan19FeatureSet>;
+extern template class FeatureSetVisitor<Grewe11FeatureSet>;
+
+/// Registry of feature set factories, every dispatch returns a new feature set
+using FSRegistry = Registry<celerity::FeatureSet>;
 
 
 /// Printing utilities
-/// Print all feature names in one line
-template <typename T>
-void print_feature_names(llvm::StringMap<T> &feature_map, llvm::raw_ostream &out_stream){
-    auto keys = feature_map.keys();
+/// Print all feature names in one line, following the schema order
+inline void print_feature_names(const FeatureSchema &schema, llvm::raw_ostream &out_stream){
     stringstream ss;
-    for(StringRef &f : keys){
-        ss << std::setw(7) << f.str() << " ";
+    for(const string &f : schema.getNames()){
+        ss << std::setw(7) << f << " ";
     }
     ss << "\n";
     out_stream << ss.str();
 }
 
-/// Print all feature unsigned values in one line
+/// Print all feature values in one line
 template <typename T>
-void print_feature_values(llvm::StringMap<T> &feature_map, llvm::raw_ostream &out_stream){
-    auto keys = feature_map.keys();
+void print_feature_values(const std::vector<T> &feature_values, llvm::raw_ostream &out_stream){
     stringstream ss;    
-    for(StringRef &f : keys){
+    for(const T &value : feature_values){
         if constexpr(std::is_same<float,T>::value){            
             ss << std::setprecision(3) 
                << std::setfill(' ') 
@@ -118,7 +321,7 @@ void print_feature_values(llvm::StringMap<T> &feature_map, llvm::raw_ostream &ou
         }
         else
             ss <<  std::setw(7);  
-        ss << feature_map[f] << " ";
+        ss << value << " ";
     }
     ss << "\n";
     out_stream << ss.str();
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/ValueMap.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/GlobPattern.h>
+
+#include "FeatureSet.hpp"
+
+namespace celerity {
+
+/// Feature set declared in a definition file (.fset) instead of a FeatureSet subclass, e.g.:
+///
+///   # comments start with '#'
+///   featureset vec                              registry key of the set
+///   features int_op flt_op flt4_op sp_fun mem_loc
+///   count int_op  opcode add sub mul            LLVM opcode names
+///   count flt_op  opcode fadd fmul lanes 1      conditions restrict a rule, here to scalar operations
+///   count flt4_op opcode fadd fmul lanes 4
+///   count sp_fun  intrinsic sqrt fma            intrinsic names, without "llvm." and type suffixes
+///   count sp_fun  builtin sqrt native_*         direct callees, glob patterns on the demangled base name
+///   count sp_fun  callee math                   direct callees by CalleeClassification: math, barrier, opencl
+///   count mem_loc opcode load store addrspace local
+///   ignore opcode br phi ret                    instructions known not to be features
+///   ignore callee opencl
+///   unknown warn                                warn about instructions matched by no rule (default: ignore)
+///
+/// Conditions: "type int|float|pointer" and "width <bits>" of the scalar type, "lanes <n>" (1 for scalars);
+/// the type is the one of the result, of the stored value for stores. "addrspace <n>" applies to loads and
+/// stores, address spaces are numbered as in MemAccessFeature.hpp (generic, global, region, local, constant, private).
+/// Features are counted once for each matching rule, the rules of an instruction are applied in file order.
+///
+/// Loading compiles the rules once into dense tables indexed by opcode and intrinsic ID, so that the evaluation
+/// of an instruction is a table load followed by the rules of its opcode. Callees are resolved once per name.
+class FeatureSetDefinition {
+ public:
+    /// a rule counting (or ignoring) the instructions that satisfy its conditions
+    struct Rule {
+        static const unsigned ignore = ~0u;   // feature of the ignore rules
+        static const unsigned any = ~0u;      // unconstrained width, lanes and address space
+        enum class TypeKind : uint8_t { any, integer, floating, pointer };
+
+        unsigned feature = ignore;
+        TypeKind type = TypeKind::any;
+        unsigned width = any;
+        unsigned lanes = any;
+        unsigned addrspace = any;
+        bool conditional = false;             // any of the above is constrained
+        bool typed = false;                   // type, width or lanes is constrained
+
+        bool matches(const llvm::Instruction &inst) const {
+            if(addrspace != any){
+                const llvm::Value *pointer = llvm::getLoadStorePointerOperand(&inst);
+                if(!pointer || pointer->getType()->getPointerAddressSpace() != addrspace)
+                    return false;
+            }
+            return !typed || matchesType(inst);
+        }
+        bool matchesType(const llvm::Instruction &inst) const;
+    };
+    /// counting rules of an opcode or an intrinsic, contiguous in the rule list.
+    /// Ignore rules are not kept, they only make the opcode or intrinsic known.
+    struct Range {
+        uint32_t first = 0;
+        uint32_t single = Rule::ignore;  // feature of a single unconditional rule, the common case
+        uint16_t size = 0;
+        bool known = false;
+    };
+    /// callee classes of CalleeClassification usable in rules
+    enum class CalleeClass : uint8_t { math, barrier, opencl };
+
+    /// parse and compile a definition, errors are reported as "source:line: message"
+    static llvm::Expected<std::shared_ptr<const FeatureSetDefinition>> parse(llvm::StringRef text, llvm::StringRef source = "<definition>");
+    static llvm::Expected<std::shared_ptr<const FeatureSetDefinition>> load(llvm::StringRef filename);
+
+    const std::string &getName() const { return name; }
+    const FeatureSchema &getSchema() const { return schema; }
+    /// hash of the definition text, part of the cache keys of the set
+    const std::string &getHash() const { return hash; }
+    bool warnUnknown() const { return warn_unknown; }
+
+    Range lookup(unsigned opcode) const { return opcodes[opcode]; }
+    Range lookupIntrinsic(llvm::Intrinsic::ID id) const { return intrinsics[id]; }
+    /// rules of a range: getRules() + range.first, ...
+    const Rule *getRules() const { return rules.data(); }
+    const Rule &getCalleeRule(unsigned rule) const { return callee_rules[rule].rule; }
+    /// indices of the callee rules matching a called function, in file order
+    void matchCallee(const CalleeInfo &callee, llvm::SmallVectorImpl<unsigned> &matching) const;
+
+ private:
+    FeatureSetDefinition() : schema(std::vector<std::string>()) {}
+
+    /// callee rule: exact name or glob pattern or class
+    struct CalleeRule {
+        Rule rule;
+        std::string name;                         // exact name, empty for patterns and classes
+        llvm::Optional<llvm::GlobPattern> pattern;
+        llvm::Optional<CalleeClass> callee_class;
+    };
+
+    std::string name;
+    FeatureSchema schema;
+    std::string hash;
+    bool warn_unknown = false;
+    std::vector<Rule> rules;                      // opcode and intrinsic rules, grouped by opcode and intrinsic
+    std::array<Range, llvm::Instruction::OtherOpsEnd> opcodes;
+    std::vector<Range> intrinsics;                // indexed by intrinsic ID
+    std::vector<CalleeRule> callee_rules;         // file order
+
+    friend class FeatureSetParser;
+};
+
+
+/// Feature set evaluating the rules of a FeatureSetDefinition. Instances share the compiled definition.
+class DeclarativeFeatureSet : public FeatureSet {
+ public:
+    explicit DeclarativeFeatureSet(std::shared_ptr<const FeatureSetDefinition> feature_set_definition)
+      : FeatureSet(feature_set_definition->getName(), feature_set_definition->getSchema()),
+        definition(std::move(feature_set_definition)) {}
+
+    void eval(llvm::Instruction &inst, int contribution = 1) override { evaluate(inst, contribution); }
+    void eval(llvm::BasicBlock &bb, int contribution = 1) override {
+        for(llvm::Instruction &inst : bb)
+            evaluate(inst, contribution);
+    }
+    string getCacheName() override { return name + "@" + definition->getHash(); }
+
+ private:
+    void evaluate(llvm::Instruction &inst, int contribution){
+        FeatureSetDefinition::Range range = definition->lookup(inst.getOpcode());
+        countRules(range, inst, contribution);
+        if(llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&inst))
+            evalCall(*call, contribution, range.known);
+        else if(!range.known && definition->warnUnknown())
+            warnUnknown("opcode", inst.getOpcodeName());
+    }
+    void countRules(FeatureSetDefinition::Range range, const llvm::Instruction &inst, int contribution){
+        if(range.single != FeatureSetDefinition::Rule::ignore){
+            add(range.single, contribution);
+            return;
+        }
+        // the rule pointers are loaded once, the counters written by add() could alias the definition
+        const FeatureSetDefinition::Rule *rule = definition->getRules() + range.first, *end = rule + range.size;
+        for(; rule != end; ++rule)
+            if(!rule->conditional || rule->matches(inst))
+                add(rule->feature, contribution);
+    }
+    void evalCall(llvm::CallInst &call, int contribution, bool matched);
+    void warnUnknown(llvm::StringRef kind, llvm::StringRef what);
+
+    std::shared_ptr<const FeatureSetDefinition> definition;
+    /// entries are dropped with their function, as in CalleeClassification
+    struct CalleeRulesConfig : llvm::ValueMapConfig<const llvm::Function*> {
+        enum { FollowRAUW = false };
+    };
+    llvm::ValueMap<const llvm::Function*, llvm::SmallVector<unsigned, 2>, CalleeRulesConfig> callee_rules; // matching callee rules, memoized per callee
+};
+
+
+/// Load a definition file and register its feature set in FSRegistry, replacing a set with the same name.
+/// Returns the name of the registered set.
+llvm::Expected<std::string> registerFeatureSetFile(llvm::StringRef filename);
+
+} // end namespace celerity
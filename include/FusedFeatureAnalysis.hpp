@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/BasicBlock.h>
+using namespace llvm;
+
+#include "FeatureSet.hpp"
+#include "FeatureAnalysis.hpp"
+#include "Kofler13Analysis.hpp"
+
+namespace celerity {
+
+/// Results of a fused feature analysis, one per (analysis, feature set) pair: analyses major, in the requested order.
+struct ResultFusedFeatureAnalysis
+{
+  std::vector<ResultFeatureAnalysis> results;
+  bool loop_dependent; // some results depend on loop info and scalar evolution
+
+  /// result of a pair, nullptr if the pair was not requested
+  const ResultFeatureAnalysis *find(llvm::StringRef analysis, llvm::StringRef feature_set) const;
+
+  bool invalidate(llvm::Function &fun, const llvm::PreservedAnalyses &PA, llvm::FunctionAnalysisManager::Invalidator &inv);
+};
+
+/// Extraction of several feature sets with several analyses in a single traversal of the function.
+/// Each basic block is evaluated once per feature set into block counters,
+/// which are then added to every analysis with the block weight of that analysis (1 for default, the loop
+/// multiplier for kofler13). The weights are computed once per function, the instructions are never visited again
+/// for another analysis, thus adding analyses costs a few additions per block and feature.
+/// Results are identical to running each analysis separately (raw counters are linear in the contribution).
+struct FusedFeatureAnalysis : llvm::AnalysisInfoMixin<FusedFeatureAnalysis> {
+ public:
+   /// block weight of an analysis
+   enum class Weighting { flat, kofler13 };
+
+   FusedFeatureAnalysis(const std::vector<string> &feature_sets = {"fan19", "grewe11", "full"},
+                        const std::vector<string> &analyses = {"default", "kofler13"});
+   FusedFeatureAnalysis(FusedFeatureAnalysis &&) = default;
+   FusedFeatureAnalysis &operator=(FusedFeatureAnalysis &&) = default;
+
+   /// analyses whose block weighting is supported by the fused traversal
+   static bool isSupported(llvm::StringRef analysis);
+
+   /// loop simplification and LCSSA if an analysis needs the loop bounds, see Kofler13Analysis
+   void addCanonicalizationPasses(llvm::FunctionPassManager &fpm) const;
+
+   using Result = ResultFusedFeatureAnalysis;
+   ResultFusedFeatureAnalysis run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam);
+
+   static bool isRequired() { return true; }
+
+   friend struct llvm::AnalysisInfoMixin<FusedFeatureAnalysis>;
+   static llvm::AnalysisKey Key;
+
+ private:
+   /// evaluate the blocks of the function into the feature sets of all the pairs
+   void extract(llvm::Function &fun, llvm::FunctionAnalysisManager &fam);
+   ResultFusedFeatureAnalysis getResult() const;
+
+   std::vector<string> analysis_names;
+   std::vector<Weighting> weightings;                 // per analysis
+   std::vector<std::unique_ptr<FeatureSet>> block_counts; // per feature set, counters of the current block
+   std::vector<std::unique_ptr<FeatureSet>> features;     // per pair, features[a * num_sets + s]
+   std::unique_ptr<Kofler13Analysis> kofler;          // loop multipliers, only if requested
+   std::unordered_map<const llvm::BasicBlock *, unsigned> multiplier;
+   // callee classification used if the module classification is not cached
+   CalleeClassification local_callees;
+};
+
+} // end namespace celerity
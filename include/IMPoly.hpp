@@ -1,47 +1,123 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <ostream>
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#ifdef CELERITY_IMPOLY_PACKED
+#include <llvm/ADT/SmallVector.h>
+#else
 #include <flint/fmpz_mpoly.h>
+#endif
 
 namespace celerity
 {
 
   const unsigned IMPOLY_MAX_DEGREE = 3;
 
-  /// Multivariate Polinomial with variable based on invariants
+  /// Multivariate Polinomial with variable based on invariants.
+  /// Coefficients are rational (e.g., n*(n-1)/2 from a triangular loop): an integer polynomial over a common denominator.
+  /// Two backends store the numerator, selected at build time: FLINT (arbitrary precision, default) and the packed
+  /// monomials of CELERITY_IMPOLY_PACKED (int64 coefficients, total degree up to 15, no external library).
+  /// An operation whose result the backend cannot represent (a coefficient of the packed backend or the denominator
+  /// beyond 64 bits, a degree beyond the packed monomials) gives an overflowed polynomial: as a NaN, it propagates
+  /// through the following operations and the callers check overflowed() once the computation is done.
   class IMPoly
   {
   private:
-    fmpz_mpoly_ctx_t ctx;
-    fmpz_mpoly_t mpoly;
+#ifdef CELERITY_IMPOLY_PACKED
+    /// Exponents of a monomial packed in one integer: the total degree in the highest bits, then 4 bits for each
+    /// variable, from x1 down. Comparing two keys compares the monomials in degree-lexicographic order.
+    using Monomial = unsigned __int128;
+    struct Term {
+      Monomial monomial;
+      int64_t coeff;
+    };
+    llvm::SmallVector<Term, 4> terms; // numerator, decreasing monomials without zero coefficients
+#else
+    fmpz_mpoly_t mpoly;  // numerator
 
-    void initContext();
+    /// context shared by all the polynomials
+    static const fmpz_mpoly_ctx_struct *context();
+#endif
+    uint64_t den;        // positive denominator, without common factors with the numerator coefficients
+    bool overflow = false; // an operation exceeded the backend, the numerator is zero
+
+    /// product of two denominators, false if it exceeds INT64_MAX (denominators are also used as divisors)
+    static bool multiply_denominators(uint64_t lhs, uint64_t rhs, uint64_t &product);
+
+    // backend primitives, the common operations (sum, max, str, ...) are built on them
+    /// zero numerator, flagged as overflowed
+    void setOverflow();
+    void reduce();
+    void add(const IMPoly &poly, bool subtract);
+    void negate();
+    /// numerator split by the powers of x_invariant: numerator = sum_k coeffs[k] * x_invariant^k
+    void split(unsigned invariant, std::vector<IMPoly> &coeffs) const;
+    /// numerator in the FLINT pretty format (e.g., "2*a0^2*gs0 - a1 + 3")
+    std::string numerator_str() const;
 
   public:
     /// Zero polynomial
     IMPoly(); 
     /// Polynominal initialized with a single term: <coeff> * x_invariant ^ exponent
     IMPoly(unsigned coeff, unsigned invariant, unsigned exponent = 1); 
+    /// Constant polynomial
+    explicit IMPoly(long constant);
     /// Copy constructor
     IMPoly(const IMPoly &); 
-    /// Dtor
+    /// Move constructor, the moved-from polynomial is zero
+    IMPoly(IMPoly &&) noexcept;
+    /// Dtor, releases the terms
     ~IMPoly();
 
     
     std::string str() const;
-    //unsigned evaluate(int []) const;
+    /// value of the polynomial, values[i] is the value of the invariant i (InvariantType, i.e. x_{i+1});
+    /// NaN if the polynomial overflowed
+    double evaluate(const double values[]) const;
+    /// an operation of the computation of this polynomial exceeded the backend, the polynomial is zero
+    bool overflowed() const { return overflow; }
+    /// calls visit for each term of the numerator with its coefficient and its exponents, exponents[i] of the
+    /// invariant i, the terms come in decreasing degree-lexicographic order
+    void visitTerms(llvm::function_ref<void(double coeff, llvm::ArrayRef<unsigned> exponents)> visit) const;
+    /// positive common denominator of the coefficients
+    uint64_t denominator() const { return den; }
+    /// calls visit for each term of the numerator with its exact coefficient, as visitTerms; false if a coefficient
+    /// does not fit 64 bits (FLINT backend), the visit stops at that term
+    bool visitIntegerTerms(llvm::function_ref<void(int64_t coeff, llvm::ArrayRef<unsigned> exponents)> visit) const;
+    /// Replaces the polynomial by the sum of the terms coeffs[t] * x^exponents[t * num_vars ...] over den. Terms
+    /// may come in any order and repeat a monomial, num_vars must not exceed the invariants. False, and the zero
+    /// polynomial, if the backend cannot represent a term (total degree beyond the packed monomials, coefficients of a
+    /// repeated monomial whose sum overflows), if den is zero or exceeds INT64_MAX.
+    bool setTerms(llvm::ArrayRef<int64_t> coeffs, llvm::ArrayRef<uint8_t> exponents, unsigned num_vars, uint64_t den);
 
     void abs();
-    void divide_by_two();
+
+    /// the polynomial has no variables
+    bool isConstant() const;
+    /// total degree, -1 for the zero polynomial
+    long degree() const;
+    /// degree in x_invariant
+    long degree(unsigned invariant) const;
+
+    /// sum of the polynomial for x_invariant = 0, ..., count - 1 (Faulhaber's formulas).
+    /// count must not depend on x_invariant, the degree in x_invariant must not exceed IMPOLY_MAX_DEGREE.
+    IMPoly sum(unsigned invariant, const IMPoly &count) const;
 
     static IMPoly max(const IMPoly &poly1, const IMPoly &poly2);
 
     IMPoly& operator+=(const IMPoly &poly);
     IMPoly& operator-=(const IMPoly &poly);
     IMPoly& operator*=(const IMPoly &poly);
+    IMPoly& operator*=(long scalar);
+    /// exact division, the coefficients become rational if needed
+    IMPoly& operator/=(long divisor);
     IMPoly& operator= (const IMPoly & other);
+    IMPoly& operator= (IMPoly && other) noexcept;
 
     friend IMPoly operator+(IMPoly lhs, const IMPoly& rhs){
       lhs += rhs; // reuse compound assignment
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <ostream>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "IMPoly.hpp"
+
+namespace celerity
+{
+
+  /// Flat evaluation plan of the polynomial features of a kernel, built once after the extraction and evaluated at
+  /// each launch, when the runtime knows the ND-range and the scalar arguments.
+  /// The monomials of all the features share a table: each monomial is a previous monomial of the table times one
+  /// invariant (multivariate Horner scheme), thus the table costs one multiplication per distinct monomial and a
+  /// feature is the dot product of its coefficients with the table. The rational coefficients are divided by their
+  /// denominator in advance. Evaluation neither allocates nor calls into the polynomial backend.
+  class PolFeatView;
+
+  class IMPolyEvaluator
+  {
+  public:
+    IMPolyEvaluator(llvm::ArrayRef<IMPoly> polys);
+    /// plan of the features of an encoded block, the terms are read in place without building polynomials
+    IMPolyEvaluator(const PolFeatView &features);
+
+    unsigned getNumFeatures() const { return term_begin.size() - 1; }
+    /// distinct monomials of the features, including the constant 1
+    unsigned getNumMonomials() const { return steps.size() + 1; }
+
+    /// values[i] is the value of the invariant i (InvariantType), features receives getNumFeatures() values.
+    /// monomials is a scratch buffer of getNumMonomials() values: one for each thread evaluating the plan.
+    void evaluate(const double values[], double features[], double monomials[]) const;
+    /// evaluation with the scratch buffer of the plan, not thread-safe
+    void evaluate(const double values[], double features[]);
+
+    /// candidates evaluated together by evaluateBatch, the inner loops run over a block of candidates
+    static constexpr unsigned BatchBlock = 64;
+    /// size of the scratch buffer of evaluateBatch: a block of candidates for each monomial
+    unsigned getBatchScratchSize() const { return getNumMonomials() * BatchBlock; }
+
+    /// Evaluation over count candidates in structure-of-arrays layout: values[i][c] is the value of the invariant i
+    /// for the candidate c (one array for each InvariantType), features[f][c] receives the feature f of the
+    /// candidate c. monomials is a scratch buffer of getBatchScratchSize() values.
+    void evaluateBatch(const double *const values[], unsigned count, double *const features[], double monomials[]) const;
+    /// batch evaluation with the scratch buffer of the plan, not thread-safe
+    void evaluateBatch(const double *const values[], unsigned count, double *const features[]);
+
+    /// Writes the plan as straight-line C++ statements, one per line prefixed by indent: the monomials as local
+    /// constants m1, m2, ..., then the assignment of each feature to features_name[f]. value_name(i) is a C++
+    /// expression of type double for the value of the invariant i, only the invariants used by the plan are named.
+    void printCode(std::ostream &out, llvm::function_ref<std::string(unsigned invariant)> value_name,
+                   llvm::StringRef features_name, llvm::StringRef indent) const;
+
+  private:
+    using TermVisitor = llvm::function_ref<void(double coeff, llvm::ArrayRef<unsigned> exponents)>;
+    /// builds the plan from the terms of each feature, the coefficients already divided by the denominator
+    void build(unsigned num_features, llvm::function_ref<void(unsigned feature, TermVisitor visit)> feature_terms);
+
+    /// monomial = monomials[factor] * values[invariant]
+    struct Step {
+      uint32_t factor;
+      uint32_t invariant;
+    };
+    std::vector<Step> steps;            // monomials[1], monomials[2], ...; monomials[0] is the constant 1
+    std::vector<uint32_t> term_begin;   // terms of the feature f: [term_begin[f], term_begin[f+1])
+    std::vector<uint32_t> term_monomial;
+    std::vector<double> term_coeff;     // coefficient / denominator
+    std::vector<double> scratch;
+    std::vector<double> batch_scratch;
+  };
+
+} // namespace
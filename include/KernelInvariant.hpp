@@ -14,12 +14,15 @@ namespace llvm
 
 namespace celerity
 {
+    class CalleeClassification;
 
     /// Invariants recognized in typical OpenCL applications:
     ///   kernel arguments: "a0", "a1", ...
     ///   global sizes: "g0", "g1", "g2" for get_global_size(0), ...
     ///   local sizes:  "l0, "l1", "l2" get_local_size(0), ...
     ///   subgroups:  "sg"  get_sub_group_size(), get_num_sub_groups()
+    /// The loop iteration counters are not invariants: they are the polynomial variables of the iterations of the
+    /// enclosing loops (at depth 1, 2, 3), summed out when counting triangular loop nests.
     enum InvariantType
     {
         a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, // support up to 10 arguments
@@ -27,17 +30,20 @@ namespace celerity
         ng0, ng1, ng2, // get_num_groups(uint dimindx)
         ls0, ls1, ls2, // get_local_size(uint dimindx)
         nsg, sgs, msgs, // get_num_sub_groups(), get_sub_group_size(), get_max_sub_group_size
+        it0, it1, it2, // loop iteration counters
         none  // value used for returning invalid invariant
     };
 
-    static unsigned InvariantTypeNum = 24;
-    static const char *InvariantTypeName[] = {
+    constexpr unsigned InvariantTypeNum = InvariantType::none + 1;
+    inline constexpr const char *InvariantTypeName[] = {
         "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "a8", "a9",
         "gs0", "gs1", "gs2",
         "ng0", "ng1", "ng2",
         "ls0", "ls1", "ls2",
         "nsg", "sgs", "msgs",
+        "it0", "it1", "it2",
         "none"};
+    static_assert(sizeof(InvariantTypeName) / sizeof(InvariantTypeName[0]) == InvariantTypeNum, "one name per invariant");
 
     /// Struct for collecting all kernel invariants for a given function (e.g., OpenCL kernel).
     /// Invariants are store in a map that associates the InvariantType to a a Value.
@@ -49,7 +55,8 @@ namespace celerity
         std::map<InvariantType, llvm::Value *> invariants;
 
     public:
-        KernelInvariant(llvm::Function &fun);
+        /// collect the invariants of a function, the builtins are looked up in the callee classification if given
+        KernelInvariant(llvm::Function &fun, CalleeClassification *callees = nullptr);
 
         /// Return an int for an enumerated invariant type. Important: enumeration starts from x1.
         static unsigned enumerate(enum InvariantType it)
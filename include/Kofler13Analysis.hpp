@@ -1,7 +1,11 @@
 #pragma once
 
+#include <unordered_map>
+
 #include <llvm/IR/Function.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/Transforms/Utils/LCSSA.h>
+#include <llvm/Transforms/Utils/LoopSimplify.h>
 
 #include "FeatureAnalysis.hpp"
 #include "FeatureSet.hpp"
@@ -12,22 +16,32 @@ namespace celerity {
 
 /// An LLVM analysis pass to extract features using [Kofler et al., 13] loop heuristics.
 /// The heuristic gives more important (x100) to the features inside a loop.
-/// It requires the loop analysis pass ("loops") to be executed before of that pass.
+/// Loops must be in simplified and LCSSA form, see addCanonicalizationPasses().
 struct Kofler13Analysis : public FeatureAnalysis, llvm::AnalysisInfoMixin<Kofler13Analysis> {
  private:
    const int default_loop_contribution = 100;
 
  public:
-    Kofler13Analysis(string feature_set = "fan19") : FeatureAnalysis() { 
+    Kofler13Analysis(const string &feature_set = "fan19") : FeatureAnalysis(feature_set) { 
       analysis_name="kofler13"; 
-      features = FSRegistry::dispatch(feature_set);
+      analysis_key = ID();
+      loop_dependent = true;
+      assert(features != nullptr);
+    }
+
+    /// loop simplification and LCSSA, required to find the loop bounds
+    virtual void addCanonicalizationPasses(llvm::FunctionPassManager &fpm) const {
+      fpm.addPass(LoopSimplifyPass());
+      fpm.addPass(LCSSAPass());
     }
-    virtual ~Kofler13Analysis(){}
 
     //PreservedAnalyses run(Loop &L, LoopAnalysisManager &AM, LoopStandardAnalysisResults &AR, LPMUpdater &U);
 
     /// overwrite feature extraction for function
     virtual void extract(llvm::Function &fun, llvm::FunctionAnalysisManager &fam);
+    /// loop multiplier of each basic block: the product of the trip counts of the enclosing loops
+    void blockWeights(llvm::Function &fun, llvm::FunctionAnalysisManager &fam,
+                      std::unordered_map<const llvm::BasicBlock *, unsigned> &multiplier);
     // calculate the loop contribution of a given loop (assume non nesting, which is calculated later)
     int loopContribution(const Loop &loop, LoopInfo &LI, ScalarEvolution &SE);
 
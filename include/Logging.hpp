@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "DebugStream.hpp"
+
+// Messages above this level are removed at compile time (0: none, 1: error, 2: warning, 3: info, 4: debug)
+#ifndef CELERITY_MAX_LOG_LEVEL
+#define CELERITY_MAX_LOG_LEVEL 4
+#endif
+
+namespace celerity {
+
+/// Severity of a log message. A message is emitted if its level does not exceed the level of its component.
+enum class LogLevel : uint8_t { none, error, warning, info, debug };
+
+/// Components with an independent log level
+enum class LogComponent : uint8_t { analysis, featureset, invariant, memaccess, loops, cache, num_components };
+
+/// Log level of each component. Constant-initialized, thus checking a level is a single load without guards.
+/// Levels are set from the command line options, before any extraction starts.
+inline uint8_t log_levels[(unsigned)LogComponent::num_components] = {
+    (uint8_t)LogLevel::warning, (uint8_t)LogLevel::warning, (uint8_t)LogLevel::warning,
+    (uint8_t)LogLevel::warning, (uint8_t)LogLevel::warning, (uint8_t)LogLevel::warning };
+
+/// Test whether a message of a component would be emitted
+inline bool log_enabled(LogComponent component, LogLevel level){
+    return (unsigned)level <= CELERITY_MAX_LOG_LEVEL && (uint8_t)level <= log_levels[(unsigned)component];
+}
+
+/// Stream of the log messages: the debug stream of the thread if redirected,
+/// otherwise errors and warnings go to llvm::errs() and other messages to llvm::outs()
+inline llvm::raw_ostream &log_stream(LogLevel level){
+    if(llvm::raw_ostream *stream = debug_stream_slot())
+        return *stream;
+    return level <= LogLevel::warning ? llvm::errs() : llvm::outs();
+}
+
+/// set the level of all the components
+void set_log_level(LogLevel level);
+/// set the level of a component by name (e.g., "loops"), returns false if the component does not exist
+bool set_log_level(llvm::StringRef component, LogLevel level);
+
+} // end namespace celerity
+
+/// Log stream for a message of a component, e.g. CELERITY_LOG(loops, debug) << "trip count " << n << "\n";
+/// The message operands are not evaluated if the message is disabled. The macro is a single for statement, whose
+/// body is the message: it nests in an unbraced if/else without capturing the else.
+#define CELERITY_LOG(component, level)                                                                              \
+    for (bool celerity_log_on = ::celerity::log_enabled(::celerity::LogComponent::component,                          \
+                                                        ::celerity::LogLevel::level);                                \
+         celerity_log_on; celerity_log_on = false)                                                                   \
+        ::celerity::log_stream(::celerity::LogLevel::level)
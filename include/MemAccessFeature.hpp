@@ -1,16 +1,19 @@
 #pragma once
 
+#include <set>
 #include <stack>
 
 #include <llvm/IR/Argument.h>
 #include <llvm/IR/Operator.h>
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/BasicBlock.h>
 //0#include <llvm/IR/InstrTypes.h>
 #include <llvm/Support/MemoryBuffer.h>
 
-#include "FeatureSet.hpp" // for demanglng utility
+#include "CalleeClassification.hpp"
+#include "Logging.hpp"
 
 
 namespace celerity {
@@ -21,13 +24,10 @@ struct CoalescedMemAccess {
     int mem_coalesced;
 };
 
-/// Uses a simple heuristics to calculate how many mem access are coalesced
-CoalescedMemAccess getCoalescedMemAccess(Function &fun) {
+/// Uses a simple heuristics to calculate how many mem access are coalesced.
+/// Callees are looked up in the classification, if given, otherwise classified on the fly.
+CoalescedMemAccess getCoalescedMemAccess(Function &fun, CalleeClassification *callees = nullptr) {
     CoalescedMemAccess cma = {0, 0};
-    llvm::raw_ostream &debug = outs(); // raw_null_ostream;
-    debug.changeColor(llvm::raw_null_ostream::Colors::MAGENTA, true);
-    debug << "coalesced mem access: "; 
-    debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
     // 1. Search for pointer arguments   
     std::set<GetElementPtrInst*> gep_set;
     for (unsigned i=0; i< fun.arg_size(); i++) {            
@@ -48,8 +48,11 @@ CoalescedMemAccess getCoalescedMemAccess(Function &fun) {
     for (BasicBlock &bb : fun) {
         for (Instruction &inst: bb) {
             if (const CallInst *call_inst = dyn_cast<CallInst>(&inst)){
-                string fun_name = call_inst->getCalledFunction()->getGlobalIdentifier();
-                if(fun_name.find("get_global_id")!= std::string::npos){
+                const Function *callee = call_inst->getCalledFunction();
+                if(!callee) // indirect call
+                    continue;
+                BuiltinKind builtin = callees ? callees->classify(*callee).builtin : CalleeClassification::compute(*callee).builtin;
+                if(builtin == BuiltinKind::global_id){
                     //debug << "global_id\n";
                     // 4. We collcet all uses of <get_global_id> 
                     std::stack<const User*> id_worklist;  
@@ -84,13 +87,19 @@ CoalescedMemAccess getCoalescedMemAccess(Function &fun) {
     // 6. Further check gep with constant index
     for(GetElementPtrInst* gep : gep_set){
         const Value *gep_op = gep->getOperand(1);
-        if(const ConstantInt *cont_int = dyn_cast<ConstantInt>(gep_op)){
+        if(isa<ConstantInt>(gep_op)){
             //debug << "  *coalesced for constant* " << "\n";     
             cma.mem_coalesced++; 
         }
     }
     assert(cma.mem_coalesced <= cma.mem_access);
-    debug << cma.mem_coalesced << "/" << cma.mem_access << "\n"; 
+    if (log_enabled(LogComponent::memaccess, LogLevel::debug)) {
+        llvm::raw_ostream &debug = log_stream(LogLevel::debug);
+        debug.changeColor(llvm::raw_null_ostream::Colors::MAGENTA, true);
+        debug << "coalesced mem access: "; 
+        debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
+        debug << cma.mem_coalesced << "/" << cma.mem_access << "\n"; 
+    }
     return cma;
 }
 
@@ -109,7 +118,7 @@ cl_address_space_type get_cl_address_space_type(const unsigned addrSpaceId) {
         case 4: return cl_address_space_type::Constant;
         case 5: return cl_address_space_type::Private;
         default: 
-            errs() << "WARNING: unkwnown address space id: " << addrSpaceId << "\n";
+            CELERITY_LOG(memaccess, warning) << "WARNING: unkwnown address space id: " << addrSpaceId << "\n";
             return cl_address_space_type::Generic;
     }
 }
@@ -2,10 +2,17 @@
 
 #include <llvm/IR/Function.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Transforms/Utils/LCSSA.h>
+#include <llvm/Transforms/Utils/LoopSimplify.h>
 using namespace llvm;
 
 #include "IMPoly.hpp"
 #include "FeatureSet.hpp"
+#include "CalleeClassification.hpp"
+#include "KernelInvariant.hpp"
 
 
 
@@ -13,68 +20,123 @@ namespace celerity {
 
 
 /// Feature set representation based multivariate polynomials. 
+/// Polynomial counters follow the schema of the scalar feature set they are derived from: the scalar set
+/// counts the instructions of a basic block, the counts are then multiplied by the polynomial number of
+/// executions of the block.
 class PolFeatSet {
  private:
-   llvm::StringMap<IMPoly> raw;   // features as multivariate polynomial counters, before normalization
-   llvm::StringMap<float> feat;   // features after normalization and runtime resolution
+   std::unique_ptr<FeatureSet> scalar; // scalar counters of the evaluated instructions
+   std::vector<IMPoly> raw;   // features as multivariate polynomial counters, before normalization
+   std::vector<float> feat;   // features after normalization and runtime resolution
    int instruction_num;
    /// int instruction_tot_contrib; NOTE normalization after ?
    string name;
+   const FeatureSchema *schema;
  public:
-   PolFeatSet() : name("default") {}
-   PolFeatSet(string feature_set_name) : name(feature_set_name){}
-   virtual ~PolFeatSet();
-
-   llvm::StringMap<IMPoly> getFeatureCounts(){ return raw; }
-   llvm::StringMap<float> getFeatureValues(){ return feat; }
+   explicit PolFeatSet(std::unique_ptr<FeatureSet> scalar_features) 
+     : scalar(std::move(scalar_features)), raw(scalar->getSchema().size()), feat(scalar->getSchema().size(), 0.f),
+       instruction_num(0), name(scalar->getName()), schema(&scalar->getSchema()) {}
+   virtual ~PolFeatSet(){}
+
+   const std::vector<IMPoly> &getFeatureCounts() const { return raw; }
+   const std::vector<float> &getFeatureValues() const { return feat; }
+   const FeatureSchema &getSchema() const { return *schema; }
    string getName(){ return name; }
+   /// a counter overflowed the polynomial backend
+   bool overflowed() const {
+      return std::any_of(raw.begin(), raw.end(), [](const IMPoly &poly){ return poly.overflowed(); });
+   }
+   FeatureSet &getScalarFeatureSet(){ return *scalar; }
 
    /// Set all features to zero
    virtual void reset(){
-        for(StringRef rkey : raw.keys())
-            raw[rkey] = IMPoly();
-        for(StringRef fkey : feat.keys())
-            feat[fkey] = 0;
+      for(IMPoly &poly : raw)
+         poly = IMPoly();
+      std::fill(feat.begin(), feat.end(), 0.f);
       instruction_num = 0;
       //instruction_tot_contrib = 0; TO FIX XXX ???
     }
    
+   /// Set a feature to known counters, e.g., read from the embedded features
+   void set(unsigned feature_id, IMPoly counter, float value){
+        raw[feature_id] = std::move(counter);
+        feat[feature_id] = value;
+   }
+
    /// Add a feature contribution to the feature set
-   virtual void add(const string &feature_name, IMPoly &contribution /*= 1*/){
-        raw[feature_name] += contribution;
+   virtual void add(unsigned feature_id, const IMPoly &contribution /*= 1*/){
+        raw[feature_id] += contribution;
         instruction_num += 1;
         //instruction_tot_contrib += contribution; TO FIX XXX ???
    }
 
-   virtual void eval(llvm::Instruction &inst, IMPoly &contribution /*= 1*/) {}
+   /// Evaluate an instruction executed contribution times
+   virtual void eval(llvm::Instruction &inst, const IMPoly &contribution /*= 1*/);
+   /// Evaluate the instructions of a basic block executed contribution times
+   virtual void eval(llvm::BasicBlock &bb, const IMPoly &contribution /*= 1*/);
    
-   virtual void normalize(llvm::Function &fun){}
+   virtual void normalize(llvm::Function &){}
    
-   virtual void print(llvm::raw_ostream &out_stream){}    
+   virtual void print(llvm::raw_ostream &){}    
+
+ private:
+   /// add the scalar counters multiplied by contribution
+   void accumulate(const IMPoly &contribution);
 };
 
 
   /// Results of a PolFeat feature analysis
   struct ResultPolFeatSet
   {
-    llvm::StringMap<IMPoly> raw;
-    llvm::StringMap<float> feat;
+    const FeatureSchema *schema;
+    std::vector<IMPoly> raw;
+    std::vector<float> feat;
+    string feature_set_name; // scalar feature set the polynomial counters follow
+
+    /// Polynomial features depend on all the instructions, on the loops and on their trip counts (SCEV)
+    bool invalidate(llvm::Function &fun, const llvm::PreservedAnalyses &PA, llvm::FunctionAnalysisManager::Invalidator &inv);
   };
 
 
 /// An LLVM analysis to extract features using multivariate polynomal as cost relation features.
+/// The instructions of a loop are counted trip count times, the trip counts are the symbolic backedge-taken
+/// counts of ScalarEvolution expressed over the kernel invariants (arguments, global and local sizes, ...).
+/// Nested loops multiply the trip counts of the enclosing loops. Trip counts affine in the induction variables of
+/// the enclosing loops (triangular and trapezoidal nests) are summed over their iterations in closed form, up to
+/// IMPOLY_MAX_DEGREE. Loops without a trip count expressible as polynomial count default_loop_contribution times,
+/// as in Kofler13Analysis.
+/// Trip counts require promoted IR (e.g., clang -O1 or mem2reg), in simplified loop form.
+/// As for the scalar analyses, the results of unchanged functions come from the embedded features or from the
+/// feature cache, where they are stored as encoded blocks (encodePolFeatures).
 struct PolFeatAnalysis : public llvm::AnalysisInfoMixin<PolFeatAnalysis> {
  protected:
-  PolFeatSet *features;
+  std::unique_ptr<PolFeatSet> features;
   string analysis_name;
+  CalleeClassification local_callees; // used if the module classification is not available
+  static constexpr int default_loop_contribution = 100;
  public:
+   /// polynomial counters follow the schema of the given scalar feature set
    PolFeatAnalysis(string feature_set = "fan19") { 
       analysis_name ="polfeat"; 
-      //features = FSRegistry::dispatch(feature_set); TODO FIX
+      std::unique_ptr<FeatureSet> scalar_features = FSRegistry::dispatch(feature_set);
+      if(!scalar_features)
+         report_fatal_error(Twine("polfeat: unknown feature set ") + feature_set);
+      features = std::make_unique<PolFeatSet>(std::move(scalar_features));
    }
+   PolFeatAnalysis(PolFeatAnalysis &&) = default;
+   PolFeatAnalysis &operator=(PolFeatAnalysis &&) = default;
    virtual ~PolFeatAnalysis(){}
 
-  /// runs the analysis on a specific function, returns a StringMap
+   PolFeatSet *getFeatureSet() { return features.get(); }
+   string getName() { return analysis_name; }
+
+   /// loop simplification and LCSSA, as for Kofler13Analysis
+   virtual void addCanonicalizationPasses(llvm::FunctionPassManager &fpm) const {
+      fpm.addPass(LoopSimplifyPass());
+      fpm.addPass(LCSSAPass());
+   }
+
+  /// runs the analysis on a specific function, returns the feature vectors
   using Result = ResultPolFeatSet;
   ResultPolFeatSet run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam);
 
@@ -82,7 +144,18 @@ struct PolFeatAnalysis : public llvm::AnalysisInfoMixin<PolFeatAnalysis> {
    virtual void extract(llvm::Function &fun, llvm::FunctionAnalysisManager &fam);
    
    // calculate the loop contribution of a given loop (assume non nesting, which is calculated later)
-   IMPoly loopContribution(const Loop &loop, LoopInfo &LI, ScalarEvolution &SE);
+   IMPoly loopContribution(const Loop &loop, KernelInvariant &invariants, ScalarEvolution &SE);
+   /// executions of a loop body counting default_loop_contribution per nesting level, as Kofler13Analysis
+   static IMPoly defaultExecutions(const Loop &loop);
+
+ private:
+   /// features embedded into the module (PolFeatEmbeddingPass), false if there are none for the function
+   bool lookupEmbedded(llvm::Function &fun);
+   /// set the features to those of an encoded block (embedded or cached), false if the block does not match the
+   /// feature set; source names the block in the warnings
+   bool readFeatures(llvm::Function &fun, llvm::StringRef block, const char *source);
+
+ public:
    
    friend struct llvm::AnalysisInfoMixin<PolFeatAnalysis>;   
    static llvm::AnalysisKey Key;
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+#include "IMPoly.hpp"
+#include "FeatureSet.hpp"
+
+namespace celerity {
+
+struct ResultPolFeatSet;
+
+/// Binary encoding of polynomial features, the counterpart of IMPoly::str() without string parsing. A block holds
+/// the features of a kernel (or a single polynomial) with the terms of all the features in shared arrays, as the
+/// evaluation plans use them. All sections are 8-byte aligned and all the offsets are relative to the block:
+///
+///   PolFeatHeader
+///   strings:  feature set name, feature names (num_features), invariant names (num_vars), NUL-terminated
+///   float    feat[num_features]                       normalized values
+///   uint64   den[num_features]                        positive denominator of each feature
+///   uint64   term_begin[num_features + 1]             terms of the feature f: [term_begin[f], term_begin[f+1])
+///   int64    coeff[num_terms]                         numerator coefficients
+///   uint8    exponents[num_terms][num_vars]           exponents[t][i] of the invariant i (InvariantType)
+///
+/// The invariant names are those of InvariantTypeName: a reader rejects a block whose variables are not a prefix of
+/// its own invariants. Values are stored in the byte order of the writer, recorded in byte_order.
+struct PolFeatHeader {
+    char     magic[8];      // "CELPOLY\0"
+    uint32_t version;
+    uint32_t byte_order;    // 0x01020304 in the writer's byte order
+    uint32_t num_features;
+    uint32_t num_vars;
+    uint64_t num_terms;
+    uint64_t block_size;
+    uint64_t string_offset;
+    uint64_t string_size;
+    uint64_t feat_offset;
+    uint64_t den_offset;
+    uint64_t term_offset;
+    uint64_t coeff_offset;
+    uint64_t exponent_offset;
+};
+
+/// Append a block of polynomial features to buffer. Fails if a coefficient exceeds 64 bits or an exponent 8 bits.
+llvm::Error encodePolFeatures(llvm::StringRef feature_set, const FeatureSchema &schema, llvm::ArrayRef<IMPoly> polys,
+                              llvm::ArrayRef<float> feat, std::vector<char> &buffer);
+/// Append the block of the results of a polynomial feature analysis
+llvm::Error encodePolFeatures(const ResultPolFeatSet &result, std::vector<char> &buffer);
+/// Append a block of a single polynomial: one unnamed feature
+llvm::Error encodeIMPoly(const IMPoly &poly, std::vector<char> &buffer);
+
+/// Zero-copy view of a block: the terms are read in place, e.g., by IMPolyEvaluator
+class PolFeatView {
+public:
+    /// Validate the block at the beginning of data, which must be 8-byte aligned and outlive the view
+    static llvm::Expected<PolFeatView> read(llvm::StringRef data);
+
+    /// size of the block, the next block of a sequence starts there
+    uint64_t getSize() const { return header->block_size; }
+    llvm::StringRef getFeatureSetName() const { return strings[0]; }
+    unsigned getNumFeatures() const { return header->num_features; }
+    llvm::StringRef getFeatureName(unsigned feature_id) const { return strings[1 + feature_id]; }
+    /// exponents per term
+    unsigned getNumVars() const { return header->num_vars; }
+
+    llvm::ArrayRef<float> getFeatValues() const { return {section<float>(header->feat_offset), header->num_features}; }
+    uint64_t getDenominator(unsigned feature_id) const { return section<uint64_t>(header->den_offset)[feature_id]; }
+    llvm::ArrayRef<int64_t> getCoefficients(unsigned feature_id) const {
+        const uint64_t *term_begin = section<uint64_t>(header->term_offset);
+        return {section<int64_t>(header->coeff_offset) + term_begin[feature_id], size_t(term_begin[feature_id + 1] - term_begin[feature_id])};
+    }
+    /// exponents of the terms of a feature, getNumVars() for each term
+    llvm::ArrayRef<uint8_t> getExponents(unsigned feature_id) const {
+        const uint64_t *term_begin = section<uint64_t>(header->term_offset);
+        return {section<uint8_t>(header->exponent_offset) + term_begin[feature_id] * header->num_vars,
+                size_t((term_begin[feature_id + 1] - term_begin[feature_id]) * header->num_vars)};
+    }
+    /// polynomial of a feature, fails if the backend cannot represent it
+    llvm::Expected<IMPoly> getPolynomial(unsigned feature_id) const;
+
+private:
+    PolFeatView(const PolFeatHeader *block_header, std::vector<llvm::StringRef> block_strings)
+      : header(block_header), strings(std::move(block_strings)) {}
+
+    template <typename T>
+    const T *section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const char*>(header) + offset);
+    }
+
+    const PolFeatHeader *header;
+    std::vector<llvm::StringRef> strings;
+};
+
+/// Decode a block of a single polynomial
+llvm::Expected<IMPoly> decodeIMPoly(llvm::StringRef data);
+
+} // end namespace celerity
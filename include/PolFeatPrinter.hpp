@@ -29,11 +29,11 @@ struct PolFeatPrinterPass : public llvm::PassInfoMixin<PolFeatPrinterPass> {
       ResultPolFeatSet &feature_set = fam.getResult<PolFeatAnalysis>(fun);    
       
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, true);
-      print_feature_names(feature_set.raw, out_stream);
+      print_feature_names(*feature_set.schema, out_stream);
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
       print_feature_values(feature_set.raw, out_stream);
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, true);
-      print_feature_names(feature_set.feat, out_stream);
+      print_feature_names(*feature_set.schema, out_stream);
       out_stream.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
       print_feature_values(feature_set.feat, out_stream);
       
@@ -1,64 +1,97 @@
 #pragma once
 
 #include <list>
+#include <memory>
+#include <mutex>
+#include <functional>
 
 #include <llvm/ADT/StringMap.h>
 
 namespace celerity
 {
 
-  /// A templatized, singleton Registry for type T, which maps a String key to a T object.
-  template <typename T>
-  class Registry 
+  /// A templatized, singleton Registry for type T, which maps a String key to a factory of T objects.
+  /// Every dispatch creates a new instance, thus objects are never shared between analyses or threads.
+  /// Args are the arguments forwarded to the factory.
+  template <typename T, typename... Args>
+  class Registry
   {
   public:
+    using Factory = std::function<std::unique_ptr<T>(Args...)>;
+
     Registry() = delete;
     Registry(const Registry &) = delete;
     Registry(Registry &&) noexcept = delete;
     Registry &operator=(const Registry &) = delete;
     Registry &operator=(Registry &&) noexcept = delete;
 
-    /// Returns a T object if already registered by key, otherwise returns a default-constructed T object if the key does not exist.
-    template <typename... Args>
-    static T dispatch(const llvm::StringRef &key, Args &&...args)
+    /// Returns a new T object created by the factory registered for key, or nullptr if the key does not exist.
+    static std::unique_ptr<T> dispatch(const llvm::StringRef &key, Args... args)
     {
-      return map()[key]; 
-      /*
-      auto it = map().find(key);
-      if (it == map().end())
-        return T();
-      return it->second(std::forward<Args>(args)...);
-      */
+      Factory factory;
+      {
+        std::lock_guard<std::mutex> guard(lock());
+        auto it = map().find(key);
+        if (it == map().end())
+          return nullptr;
+        factory = it->second;
+      }
+      return factory(std::forward<Args>(args)...);
     }
 
-    /// Register a T value for the string key
-    static bool registerByKey(const llvm::StringRef &key, T &value)
+    /// Register a factory for the string key
+    static bool registerByKey(const llvm::StringRef &key, Factory factory)
     {
-      map()[key] = value;
+      std::lock_guard<std::mutex> guard(lock());
+      map()[key] = std::move(factory);
       return true;
     }
 
+    /// Register a factory constructing a Derived object from Args for the string key
+    template <typename Derived>
+    static bool registerType(const llvm::StringRef &key)
+    {
+      return registerByKey(key, [](Args... args) -> std::unique_ptr<T> {
+        return std::make_unique<Derived>(std::forward<Args>(args)...);
+      });
+    }
+
     /// Test whether the given key is registered
-    static bool isRegistered(const llvm::StringRef &key) { return map().count(key) == 1u; }
+    static bool isRegistered(const llvm::StringRef &key)
+    {
+      std::lock_guard<std::mutex> guard(lock());
+      return map().count(key) == 1u;
+    }
 
     /// Unregisters the given identifier
-    static void unregisterByKey(const llvm::StringRef &key) { map().erase(key); }
+    static void unregisterByKey(const llvm::StringRef &key)
+    {
+      std::lock_guard<std::mutex> guard(lock());
+      map().erase(key);
+    }
 
     /// registered keys
-    static std::list<StringRef> getKeyList() { 
-      std::list<StringRef> key_list;
-      for(StringRef& s : map().keys() )
-        key_list.push_back(s);
-      return key_list; 
-    } 
+    static std::list<llvm::StringRef> getKeyList() {
+      std::lock_guard<std::mutex> guard(lock());
+      std::list<llvm::StringRef> key_list;
+      for(const auto &entry : map())
+        key_list.push_back(entry.getKey());
+      key_list.sort();
+      return key_list;
+    }
 
   private:
-    static llvm::StringMap<T> &map()
+    static llvm::StringMap<Factory> &map()
     {
-      static llvm::StringMap<T> registry_map;
+      static llvm::StringMap<Factory> registry_map;
       return registry_map;
     }
+
+    static std::mutex &lock()
+    {
+      static std::mutex registry_lock;
+      return registry_lock;
+    }
   };
 
 } // namespace
-
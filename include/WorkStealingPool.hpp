@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace celerity {
+
+/// A fixed pool of worker threads with one task queue per worker. 
+/// Tasks are distributed round-robin over the queues. A worker takes tasks from the front of its own queue and, 
+/// once it runs out of work, steals from the back of the other queues: a long task only delays the worker running it.
+/// Tasks receive the ID of the worker running them, so that they can use per-worker state without locking.
+class WorkStealingPool {
+ public:
+    using Task = std::function<void(unsigned worker_id)>;
+
+    explicit WorkStealingPool(unsigned num_workers) : queues(std::max(1u, num_workers)) {}
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    /// number of worker threads (the calling thread acts as worker 0)
+    unsigned size() const { return queues.size(); }
+
+    /// enqueue a task; tasks are executed by run()
+    void submit(Task task){
+        queues[next_queue].tasks.push_back(std::move(task));
+        next_queue = (next_queue + 1) % queues.size();
+    }
+
+    /// execute all the submitted tasks, returns when all of them are completed
+    void run(){
+        std::vector<std::thread> threads;
+        for(unsigned worker = 1; worker < size(); worker++)
+            threads.emplace_back([this, worker]{ work(worker); });
+        work(0);
+        for(std::thread &thread : threads)
+            thread.join();
+    }
+
+ private:
+    struct TaskQueue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+    std::vector<TaskQueue> queues;
+    unsigned next_queue = 0;
+
+    bool pop(unsigned worker, Task &task){
+        TaskQueue &queue = queues[worker];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if(queue.tasks.empty()) 
+            return false;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(unsigned worker, Task &task){
+        for(unsigned i = 1; i < size(); i++){
+            TaskQueue &victim = queues[(worker + i) % size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if(victim.tasks.empty()) 
+                continue;
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    /// tasks are all submitted before run(), thus a worker can stop as soon as every queue is empty
+    void work(unsigned worker){
+        Task task;
+        while(pop(worker, task) || steal(worker, task))
+            task(worker);
+    }
+};
+
+} // end namespace celerity
@@ -0,0 +1,59 @@
+#pragma once
+
+/* C interface of the in-process feature extraction library (libcelerity_features).
+ * An extractor is used by one thread at a time; threads extracting concurrently create an extractor each.
+ * Nothing is written to the standard output, error messages are returned by celerity_features_last_error(). */
+
+#include <stddef.h>
+#include <llvm-c/Types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct celerity_feature_extractor celerity_feature_extractor;
+
+/* Caller-provided output buffers, row i holds the features of the i-th function defined in the module.
+ * feat and raw hold max_rows * celerity_features_num_features() values each, either can be NULL.
+ * names (optional) receives the NUL-terminated function names of the written rows, one after the other. */
+typedef struct celerity_features_output {
+    float *feat;
+    unsigned *raw;
+    size_t max_rows;
+    char *names;
+    size_t names_size;
+} celerity_features_output;
+
+/* Load a feature set definition file (.fset, see FeatureSetDefinition.hpp), its feature set can then be used by
+ * celerity_features_create under the name declared in the file. Returns 0 on success, -1 on error. */
+int celerity_features_load_feature_set(const char *filename);
+
+/* analysis: "default", "kofler13", ... (NULL: "default"); feature_set: "fan19", "grewe11", ... (NULL: "fan19").
+ * Returns NULL if the analysis or the feature set is unknown. */
+celerity_feature_extractor *celerity_features_create(const char *analysis, const char *feature_set);
+void celerity_features_destroy(celerity_feature_extractor *extractor);
+
+unsigned celerity_features_num_features(const celerity_feature_extractor *extractor);
+/* name of a feature of the schema, NULL if out of range */
+const char *celerity_features_feature_name(const celerity_feature_extractor *extractor, unsigned feature);
+/* bitcode input: materialize only the kernels and their callees */
+void celerity_features_set_kernels_only(celerity_feature_extractor *extractor, int kernels_only);
+
+/* Extract the features of a bitcode module held in memory, the buffer is not copied.
+ * Returns the number of functions defined in the module (rows beyond max_rows are not written), -1 on error. */
+long celerity_features_extract_bitcode(celerity_feature_extractor *extractor, const void *bitcode, size_t size,
+                                       celerity_features_output *output);
+/* Extract the features of an existing module, which is analyzed in place */
+long celerity_features_extract_module(celerity_feature_extractor *extractor, LLVMModuleRef module,
+                                      celerity_features_output *output);
+/* Extract the features of a function, feat and raw (either can be NULL) hold celerity_features_num_features() values.
+ * Returns 0 on success, -1 on error. */
+int celerity_features_extract_function(celerity_feature_extractor *extractor, LLVMValueRef function,
+                                       float *feat, unsigned *raw);
+
+/* message of the last error of the calling thread, empty if none */
+const char *celerity_features_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,57 +7,50 @@
 
 
 
-#include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/DerivedTypes.h"
-#include "llvm/IR/Instructions.h"
-
-#include "llvm/Demangle/Demangle.h"
-
-#include "llvm/IR/LegacyPassManager.h"
-#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/ADT/StringRef.h"
 
 
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <regex>
 
 using namespace llvm;
 using namespace std;
 
+#ifdef CELERITY_POLFEAT
+#include "PolFeatAnalysis.hpp"
+#endif
+
 namespace celerity {
 
 /*
- * An LLVM function pass to extract features.
- * The extraction of features from a single instruction is delegated to a feature set class.
- * In this basic implementation, BB's instruction contributions are summed up.
+ * An LLVM module pass generating the celerity runtime interface header of a module.
+ * Kernels are found with structural checks: the SPIR kernel calling convention (device code) or the partially
+ * demangled name of the celerity dispatch function (host code). The polynomial features of each kernel come from
+ * the FunctionAnalysisManager, thus they are shared with the feature passes of the same pipeline.
  */
-    class CelerityInterfacePass : public ModulePass {
+    class CelerityInterfacePass : public PassInfoMixin<CelerityInterfacePass> {
 
     public:
-        static char ID;
         // By default we go for std:cout as the output stream
         std::ostream* outputstreamPtr = &std::cout;
 
-        CelerityInterfacePass() : ModulePass(ID) {
-        }
+        PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam);
 
-        ~CelerityInterfacePass() { }
+        /// Name of the kernel implemented by a function, empty if the function is not a kernel. deviceKernel: the
+        /// function is a kernel of device code (see find_kernels)
+        static std::string kernelName(const Function &f, bool deviceKernel);
 
-        virtual void getAnalysisUsage(AnalysisUsage &au) const {
-            au.setPreservesAll();
-        }
-
-        virtual bool runOnModule(Module &m);
-        virtual bool runOnFunction(Function &f);
-
-        virtual void printInterfaceHeader();
-        virtual void printKernelClass(const std::string& kernelName, Function &f);
-
-        virtual bool isItaniumEncoding(const std::string &MangledName);
-        virtual std::string demangle(const std::string &MangledName);
+        void printInterfaceHeader();
+        /// Prints the efficiency_predictor of a kernel. Only device kernels get resolve_features: the host dispatch
+        /// function wraps the launch, its features are not those of the kernel
+        void printKernelClass(const std::string& kernelName, Function &f, bool deviceKernel, FunctionAnalysisManager &fam);
+        /// Prints the static method resolve_features of a kernel class: straight-line code computing the polynomial
+        /// features of the kernel from the runtime features and the scalar arguments
+        void printFeatureResolution(Function &f, FunctionAnalysisManager &fam);
 
         // Getter and setter for current output stream
         std::ostream& outputstream() {
@@ -68,7 +61,7 @@ namespace celerity {
             outputstreamPtr = &outs;
         }
 
-
+        static bool isRequired() { return true; }
     };
 }
 
@@ -0,0 +1,111 @@
+#include <cstdlib>
+#include <string>
+#include <set>
+using namespace std;
+
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/Demangle/Demangle.h>
+using namespace llvm;
+
+#include "CalleeClassification.hpp"
+using namespace celerity;
+
+llvm::AnalysisKey CalleeClassificationAnalysis::Key;
+
+// Function names (non intrinsic calls), matched as substrings of the demangled base name
+const set<string> FNAME_SPECIAL= {"sqrt", "exp", "log", "abs", "fabs", "max", "pow","floor","sin","cos","tan"};
+const set<string> OPENCL       = {"get_global_id", "get_local_id", "get_num_groups", "get_group_id", "get_max_sub_group_size", "max", "pow", "floor"};
+const set<string> BARRIER      = {"barrier","sub_group_reduce"};
+
+static inline bool instr_contains(const string &instr_name, const set<string> &instr_set){
+    for(const string &s : instr_set){
+        if (instr_name.find(s) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+string CalleeClassification::demangle(StringRef name){
+    return llvm::demangle(name.str());
+}
+
+string CalleeClassification::demangleBaseName(StringRef name){
+    string mangled = name.str();
+    ItaniumPartialDemangler demangler;
+    // partialDemangle returns true on failure, e.g. for C names such as "sqrt"
+    if(demangler.partialDemangle(mangled.c_str()) || !demangler.isFunction())
+        return mangled;
+    size_t size = 0;
+    char *base_name = demangler.getFunctionBaseName(nullptr, &size);
+    if(!base_name)
+        return mangled;
+    string result(base_name);
+    std::free(base_name);
+    return result;
+}
+
+/// OpenCL builtins, the dimension is given by the first argument
+static BuiltinKind getOpenCLBuiltin(StringRef name){
+    return StringSwitch<BuiltinKind>(name)
+        .Case("get_global_id",          BuiltinKind::global_id)
+        .Case("get_local_id",           BuiltinKind::local_id)
+        .Case("get_group_id",           BuiltinKind::group_id)
+        .Case("get_global_size",        BuiltinKind::global_size)
+        .Case("get_local_size",         BuiltinKind::local_size)
+        .Case("get_num_groups",         BuiltinKind::num_groups)
+        .Case("get_num_sub_groups",     BuiltinKind::num_sub_groups)
+        .Case("get_sub_group_size",     BuiltinKind::sub_group_size)
+        .Case("get_max_sub_group_size", BuiltinKind::max_sub_group_size)
+        .Cases("barrier", "work_group_barrier", BuiltinKind::barrier)
+        .Default(BuiltinKind::none);
+}
+
+/// SPIR-V builtins emitted by SYCL compilers, either with the dimension as suffix (__spirv_GlobalSize_x)
+/// or as first argument (__spirv_BuiltInGlobalSize)
+static BuiltinKind getSPIRVBuiltin(StringRef name, int &dimension){
+    if(!name.consume_front("__spirv_"))
+        return BuiltinKind::none;
+    name.consume_front("BuiltIn");
+    if(name.size() > 2 && name[name.size() - 2] == '_' && name.back() >= 'x' && name.back() <= 'z'){
+        dimension = name.back() - 'x';
+        name = name.drop_back(2);
+    }
+    return StringSwitch<BuiltinKind>(name)
+        .Case("GlobalInvocationId", BuiltinKind::global_id)
+        .Case("LocalInvocationId",  BuiltinKind::local_id)
+        .Case("WorkgroupId",        BuiltinKind::group_id)
+        .Case("GlobalSize",         BuiltinKind::global_size)
+        .Case("WorkgroupSize",      BuiltinKind::local_size)
+        .Case("NumWorkgroups",      BuiltinKind::num_groups)
+        .Case("NumSubgroups",       BuiltinKind::num_sub_groups)
+        .Case("SubgroupSize",       BuiltinKind::sub_group_size)
+        .Case("SubgroupMaxSize",    BuiltinKind::max_sub_group_size)
+        .Case("ControlBarrier",     BuiltinKind::barrier)
+        .Default(BuiltinKind::none);
+}
+
+CalleeInfo CalleeClassification::compute(const Function &callee){
+    CalleeInfo info;
+    info.name = demangleBaseName(callee.getName());
+    info.builtin = getOpenCLBuiltin(info.name);
+    if(info.builtin == BuiltinKind::none){
+        int dimension = -1;
+        info.builtin = getSPIRVBuiltin(info.name, dimension);
+        if(info.builtin != BuiltinKind::none)
+            info.dimension = dimension;
+    }
+    info.math = instr_contains(info.name, FNAME_SPECIAL);
+    info.barrier = info.builtin == BuiltinKind::barrier || instr_contains(info.name, BARRIER);
+    info.opencl = (info.builtin != BuiltinKind::none && !info.barrier) || instr_contains(info.name, OPENCL);
+    return info;
+}
+
+CalleeClassification CalleeClassificationAnalysis::run(Module &module, ModuleAnalysisManager &){
+    CalleeClassification result;
+    for(const Function &fun : module){
+        // only declarations are called as builtins, defined functions are classified if called
+        if(fun.isDeclaration() && !fun.isIntrinsic())
+            result.classify(fun);
+    }
+    return result;
+}
@@ -2,3 +2,8 @@
 using namespace celerity;
 
 llvm::AnalysisKey DefaultFeatureAnalysis::Key;
+
+//-----------------------------------------------------------------------------
+// Register the analysis in the FeatureAnalysis registry
+//-----------------------------------------------------------------------------
+static bool _registered_feature_analysis_ = FARegistry::registerType<DefaultFeatureAnalysis>("default");
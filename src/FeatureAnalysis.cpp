@@ -3,6 +3,8 @@
 #include <vector>
 using namespace std;
 
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 #include <llvm/Passes/PassBuilder.h>
@@ -15,24 +17,39 @@ using namespace llvm;
 #include "Kofler13Analysis.hpp"
 #include "FeaturePrinter.hpp"
 #include "KernelInvariant.hpp"
+#include "Logging.hpp"
+#include "FeatureCache.hpp"
+#include "FeatureEmbedding.hpp"
+#include "CalleeClassification.hpp"
 using namespace celerity;
 
 
 
+bool ResultFeatureAnalysis::invalidate(llvm::Function &fun, const llvm::PreservedAnalyses &PA, llvm::FunctionAnalysisManager::Invalidator &inv)
+{
+  // the counts depend on every instruction and on the callee classification of the module: preserving the function
+  // analyses as a set does not cover them, only a pass that preserves all the analyses or this one does
+  auto checker = PA.getChecker(analysis_key);
+  if (!checker.preserved())
+    return true;
+  if (loop_dependent)
+    return inv.invalidate<LoopAnalysis>(fun, PA) || inv.invalidate<ScalarEvolutionAnalysis>(fun, PA);
+  return false;
+}
+
 FeatureAnalysis::~FeatureAnalysis() {}
 
 void FeatureAnalysis::extract(BasicBlock &bb)
 {
-  for (Instruction &i : bb)
-  {
-    features->eval(i);
-  }
+  features->eval(bb);
 }
 
-void FeatureAnalysis::extract(llvm::Function &fun, llvm::FunctionAnalysisManager &fam)
+void FeatureAnalysis::extract(llvm::Function &fun, llvm::FunctionAnalysisManager &)
 {
-  KernelInvariant ki(fun);
-  ki.print(llvm::outs());
+  if (log_enabled(LogComponent::invariant, LogLevel::debug)) {
+    KernelInvariant ki(fun, features->getCalleeClassification());
+    ki.print(log_stream(LogLevel::debug));
+  }
 
   for (llvm::BasicBlock &bb : fun)
     extract(bb);
@@ -47,27 +64,48 @@ void FeatureAnalysis::finalize(llvm::Function &fun)
 ResultFeatureAnalysis FeatureAnalysis::run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam)
 {
   // nicely printing analysis params
-  llvm::raw_ostream &debug = outs();
-  debug.changeColor(llvm::raw_null_ostream::Colors::YELLOW, true);
-  debug << "function: ";
-  debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
-  debug << fun.getName().str();
-  debug.changeColor(llvm::raw_null_ostream::Colors::YELLOW, true);
-  debug << " feature-set: ";
-  debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
-  debug << features->getName();
-  debug.changeColor(llvm::raw_null_ostream::Colors::YELLOW, true);
-  debug << " analysis-name: ";
-  debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
-  debug << getName() << "\n";
+  if (log_enabled(LogComponent::analysis, LogLevel::info)) {
+    llvm::raw_ostream &debug = log_stream(LogLevel::info);
+    debug.changeColor(llvm::raw_null_ostream::Colors::YELLOW, true);
+    debug << "function: ";
+    debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
+    debug << fun.getName().str();
+    debug.changeColor(llvm::raw_null_ostream::Colors::YELLOW, true);
+    debug << " feature-set: ";
+    debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
+    debug << features->getName();
+    debug.changeColor(llvm::raw_null_ostream::Colors::YELLOW, true);
+    debug << " analysis-name: ";
+    debug.changeColor(llvm::raw_null_ostream::Colors::WHITE, false);
+    debug << getName() << "\n";
+  }
   
   // reset all feature values
   features->reset();
   // skip the function if it is only a declaration
-  if (fun.isDeclaration()) return ResultFeatureAnalysis { features->getFeatureCounts(), features->getFeatureValues() };
+  if (fun.isDeclaration()) return ResultFeatureAnalysis { &features->getSchema(), features->getFeatureCounts(), features->getFeatureValues(), analysis_key, loop_dependent, features->getName(), getName() };
+  // features embedded into the module when it was compiled, if the function did not change since
+  if (FeatureEmbedding::hasEmbeddedFeatures(*fun.getParent()) && FeatureEmbedding::lookup(fun, getName(), *features))
+    return ResultFeatureAnalysis { &features->getSchema(), features->getFeatureCounts(), features->getFeatureValues(), analysis_key, loop_dependent, features->getName(), getName() };
+  // unchanged functions are answered from the cache, if enabled
+  FeatureCache *cache = FeatureCache::getGlobalCache();
+  string cache_key;
+  if (cache) {
+    cache_key = FeatureCache::getKey(fun, features->getCacheName(), getName());
+    if (cache->lookup(cache_key, *features))
+      return ResultFeatureAnalysis { &features->getSchema(), features->getFeatureCounts(), features->getFeatureValues(), analysis_key, loop_dependent, features->getName(), getName() };
+  }
+  // callees are classified once, shared by all the analyses if the module classification was computed before 
+  // (e.g., by the tool): a function analysis can only use cached module results. Otherwise this analysis keeps its own.
+  auto &mam_proxy = fam.getResult<ModuleAnalysisManagerFunctionProxy>(fun);
+  CalleeClassification *callees = mam_proxy.getCachedResult<CalleeClassificationAnalysis>(*fun.getParent());
+  features->setCalleeClassification(callees ? callees : &local_callees);
   // feature extraction
   extract(fun, fam);
   // feature post-processing (e.g., normalization)
   finalize(fun);
-  return ResultFeatureAnalysis { features->getFeatureCounts(), features->getFeatureValues() };
+  features->setCalleeClassification(nullptr);
+  if (cache)
+    cache->store(cache_key, *features);
+  return ResultFeatureAnalysis { &features->getSchema(), features->getFeatureCounts(), features->getFeatureValues(), analysis_key, loop_dependent, features->getName(), getName() };
 }
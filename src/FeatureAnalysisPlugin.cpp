@@ -20,8 +20,33 @@ using namespace llvm;
 #include "Kofler13Analysis.hpp"
 #include "FeaturePrinter.hpp"
 #include "PolFeatPrinter.hpp"
+#include "FeatureMatrixPass.hpp"
+#include "FeatureEmbeddingPass.hpp"
+#include "FeatureSetDefinition.hpp"
 using namespace celerity;
 
+// output file of the feature matrix passes, chunks are appended to it
+static cl::opt<string> FeatureMatrixFile("feature-matrix-file", cl::desc("Feature matrix file written by the feature-matrix passes"),
+                                         cl::value_desc("filename"), cl::init("features.cfm"));
+// feature sets declared in definition files, extracted by print<feature-fused> with the built-in sets
+static cl::list<string> FeatureSetDefs("feature-set-def", cl::desc("Load a feature set definition file (.fset)"), cl::value_desc("filename"));
+
+/// Feature sets of print<feature-fused>: the built-in sets and the ones of -feature-set-def, loaded once
+static const std::vector<string> &fusedFeatureSets(){
+  static const std::vector<string> feature_sets = []{
+    std::vector<string> names = {"fan19", "grewe11", "full"};
+    for(const string &filename : FeatureSetDefs){
+      Expected<string> name = registerFeatureSetFile(filename);
+      if(!name)
+        report_fatal_error(name.takeError());
+      if(!is_contained(names, *name))
+        names.push_back(*name);
+    }
+    return names;
+  }();
+  return feature_sets;
+}
+
 //-----------------------------------------------------------------------------
 // Pass registration using the new LLVM PassManager
 //-----------------------------------------------------------------------------
@@ -41,20 +66,75 @@ llvm::PassPluginLibraryInfo getFeatureExtractionPassPluginInfo()
               if (Name == "print<feature>")
               {
                 FPM.addPass(FeaturePrinterPass<DefaultFeatureAnalysis>(llvm::outs())); 
-                FPM.addPass(LCSSAPass());                
+                Kofler13Analysis().addCanonicalizationPasses(FPM);
                 FPM.addPass(FeaturePrinterPass<Kofler13Analysis>(llvm::outs())); 
                 FPM.addPass(PolFeatPrinterPass(llvm::outs()));
                 return true;
               }
+              // all the feature sets with the default and kofler13 analyses, in a single traversal
+              if (Name == "print<feature-fused>")
+              {
+                FusedFeatureAnalysis(fusedFeatureSets()).addCanonicalizationPasses(FPM);
+                FPM.addPass(FusedFeaturePrinterPass(llvm::outs()));
+                return true;
+              }
+              return false;
+            });
+        // REGISTRATION FOR "opt -passes=feature-matrix" and "opt -passes=feature-matrix<kofler13>"
+        // Register the binary feature matrix output as a module pass.
+        PB.registerPipelineParsingCallback(
+            [&](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>)
+            {
+              if (Name == "feature-matrix")
+              {
+                MPM.addPass(FeatureMatrixPass<DefaultFeatureAnalysis>(FeatureMatrixFile));
+                return true;
+              }
+              if (Name == "feature-matrix<kofler13>")
+              {
+                FunctionPassManager FPM;
+                Kofler13Analysis().addCanonicalizationPasses(FPM);
+                MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+                MPM.addPass(FeatureMatrixPass<Kofler13Analysis>(FeatureMatrixFile));
+                return true;
+              }
+              return false;
+            });
+        // REGISTRATION FOR "opt -passes=feature-embed", "feature-embed<kofler13>" and "feature-embed<polfeat>"
+        // Embed the features into the module, for the extractions of the compiled module (see FeatureEmbedding).
+        PB.registerPipelineParsingCallback(
+            [&](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>)
+            {
+              if (Name == "feature-embed")
+              {
+                MPM.addPass(FeatureEmbeddingPass<DefaultFeatureAnalysis>());
+                return true;
+              }
+              if (Name == "feature-embed<kofler13>")
+              {
+                FunctionPassManager FPM;
+                Kofler13Analysis().addCanonicalizationPasses(FPM);
+                MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+                MPM.addPass(FeatureEmbeddingPass<Kofler13Analysis>());
+                return true;
+              }
+              if (Name == "feature-embed<polfeat>")
+              {
+                FunctionPassManager FPM;
+                PolFeatAnalysis().addCanonicalizationPasses(FPM);
+                MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+                MPM.addPass(PolFeatEmbeddingPass());
+                return true;
+              }
               return false;
             });
         // #2 REGISTRATION FOR "-O{1|2|3|s}"
         // Register FeaturePrinterPass as a step of an existing pipeline.
         PB.registerVectorizerStartEPCallback(
-            [](llvm::FunctionPassManager &PM, llvm::PassBuilder::OptimizationLevel Level)
+            [](llvm::FunctionPassManager &PM, llvm::PassBuilder::OptimizationLevel)
             {
               PM.addPass(FeaturePrinterPass<DefaultFeatureAnalysis>(llvm::outs()));
-              PM.addPass(LCSSAPass());                
+              Kofler13Analysis().addCanonicalizationPasses(PM);
               PM.addPass(FeaturePrinterPass<Kofler13Analysis>(llvm::outs()));
               PM.addPass(PolFeatPrinterPass(llvm::outs()));
             });
@@ -66,6 +146,12 @@ llvm::PassPluginLibraryInfo getFeatureExtractionPassPluginInfo()
               FAM.registerPass([&] { return DefaultFeatureAnalysis("grewe11"); });              
               FAM.registerPass([&] { return Kofler13Analysis(); });
               FAM.registerPass([&] { return PolFeatAnalysis(); });
+              FAM.registerPass([&] { return FusedFeatureAnalysis(fusedFeatureSets()); });
+            });
+        PB.registerAnalysisRegistrationCallback(
+            [](ModuleAnalysisManager &MAM)
+            {
+              MAM.registerPass([&] { return CalleeClassificationAnalysis(); });
             });
       }};
 }
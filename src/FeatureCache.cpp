@@ -0,0 +1,337 @@
+#include <vector>
+#include <cstring>
+using namespace std;
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+using namespace llvm;
+
+#include "FeatureCache.hpp"
+#include "Logging.hpp"
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// Command line options, shared by the plugin and the standalone tool
+//-----------------------------------------------------------------------------
+static cl::opt<string> FeatureCacheDir("feature-cache-dir",
+    cl::desc("Directory of the feature extraction cache (disabled if empty)"), cl::value_desc("directory"), cl::init(""));
+static cl::opt<string> FeatureCachePolicy("feature-cache-policy",
+    cl::desc("Pruning policy of the feature cache, e.g., cache_size_bytes=64m:prune_after=168h"), cl::value_desc("policy"),
+    cl::init("cache_size_bytes=64m"));
+static cl::opt<bool> PrintFeatureCacheStats("feature-cache-stats",
+    cl::desc("Print the hit/miss statistics of the feature cache at exit"), cl::init(false));
+
+
+//-----------------------------------------------------------------------------
+// Structural function hash
+//-----------------------------------------------------------------------------
+namespace {
+
+/// Feeds the structure of a function into a SHA1 hasher.
+/// Arguments, blocks and instructions are hashed by their position, so that renaming local values does not change the hash;
+/// types are hashed by their printed form the first time they are seen, then by their position.
+struct StructuralHasher {
+    enum Tag : uint8_t { local_value, global_value, constant_int, constant, other_value, type_ref, new_type };
+
+    SHA1 hasher;
+    DenseMap<const Value*, unsigned> local_ids;
+    DenseMap<const Type*, unsigned> type_ids;
+
+    void add(uint64_t value){
+        uint8_t bytes[sizeof(value)];
+        memcpy(bytes, &value, sizeof(value));
+        hasher.update(ArrayRef<uint8_t>(bytes, sizeof(value)));
+    }
+    void add(StringRef str){
+        add(str.size());
+        hasher.update(str);
+    }
+    void addType(const Type *type){
+        auto it = type_ids.find(type);
+        if(it != type_ids.end()){
+            add(type_ref);
+            add(it->second);
+            return;
+        }
+        type_ids[type] = type_ids.size();
+        string type_str;
+        raw_string_ostream out(type_str);
+        type->print(out);
+        add(new_type);
+        add(out.str());
+    }
+    void addValue(const Value *value){
+        auto it = local_ids.find(value);
+        if(it != local_ids.end()){
+            add(local_value);
+            add(it->second);
+        }
+        else if(const GlobalValue *global = dyn_cast<GlobalValue>(value)){
+            add(global_value);
+            add(global->getName());
+            addType(global->getType());
+        }
+        else if(const ConstantInt *ci = dyn_cast<ConstantInt>(value)){
+            add(constant_int);
+            addType(ci->getType());
+            const APInt &int_val = ci->getValue();
+            for(unsigned w = 0; w < int_val.getNumWords(); w++)
+                add(int_val.getRawData()[w]);
+        }
+        else {
+            // other constants (including constant expressions), metadata and inline asm are hashed by their printed form
+            string value_str;
+            raw_string_ostream out(value_str);
+            value->print(out);
+            add(isa<Constant>(value) ? constant : other_value);
+            add(out.str());
+        }
+    }
+
+    void addInstruction(const Instruction &inst){
+        add(inst.getOpcode());
+        addType(inst.getType());
+        // nsw/nuw/exact and fast-math flags
+        add(inst.getRawSubclassOptionalData());
+        add(inst.getNumOperands());
+        for(const Value *operand : inst.operands())
+            addValue(operand);
+        // instruction properties that are not operands
+        if(const CmpInst *cmp = dyn_cast<CmpInst>(&inst))
+            add(cmp->getPredicate());
+        else if(const PHINode *phi = dyn_cast<PHINode>(&inst)){
+            for(const BasicBlock *bb : phi->blocks())
+                addValue(bb);
+        }
+        else if(const GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(&inst))
+            addType(gep->getSourceElementType());
+        else if(const AllocaInst *alloca = dyn_cast<AllocaInst>(&inst))
+            addType(alloca->getAllocatedType());
+        else if(const ExtractValueInst *ev = dyn_cast<ExtractValueInst>(&inst)){
+            for(unsigned idx : ev->indices())
+                add(idx);
+        }
+        else if(const InsertValueInst *iv = dyn_cast<InsertValueInst>(&inst)){
+            for(unsigned idx : iv->indices())
+                add(idx);
+        }
+        else if(const ShuffleVectorInst *shuffle = dyn_cast<ShuffleVectorInst>(&inst)){
+            for(int idx : shuffle->getShuffleMask())
+                add(idx);
+        }
+        else if(const AtomicRMWInst *rmw = dyn_cast<AtomicRMWInst>(&inst))
+            add(rmw->getOperation());
+        else if(const CallBase *call = dyn_cast<CallBase>(&inst))
+            add(call->getCallingConv());
+    }
+
+    void addFunction(const Function &fun){
+        const Module *module = fun.getParent();
+        if(module){
+            add(module->getDataLayoutStr());
+            add(module->getTargetTriple());
+        }
+        add(fun.getName());
+        add(fun.getCallingConv());
+        addType(fun.getFunctionType());
+        // number arguments, blocks and instructions before hashing, as operands may refer to later values
+        for(const Argument &arg : fun.args())
+            local_ids[&arg] = local_ids.size();
+        for(const BasicBlock &bb : fun){
+            local_ids[&bb] = local_ids.size();
+            for(const Instruction &inst : bb)
+                local_ids[&inst] = local_ids.size();
+        }
+        for(const BasicBlock &bb : fun){
+            add(bb.size());
+            for(const Instruction &inst : bb)
+                addInstruction(inst);
+        }
+    }
+};
+
+/// Header of a cache entry, followed by the raw counters and the normalized values.
+/// Entries use the native byte order, the cache is local to a machine.
+struct EntryHeader {
+    char magic[4];
+    uint32_t num_features;
+    int32_t instruction_num;
+    int32_t instruction_tot_contrib;
+};
+const char entry_magic[4] = {'C', 'F', 'C', '1'};
+
+} // end anonymous namespace
+
+
+//-----------------------------------------------------------------------------
+// Feature cache
+//-----------------------------------------------------------------------------
+FeatureCache::FeatureCache(StringRef dir, CachePruningPolicy pruning_policy) : cache_dir(dir.str()), policy(pruning_policy) {
+    if(std::error_code ec = sys::fs::create_directories(cache_dir))
+        CELERITY_LOG(cache, warning) << "WARNING: feature cache: cannot create " << cache_dir << ": " << ec.message() << "\n";
+}
+
+FeatureCache::~FeatureCache() {
+    prune();
+}
+
+FeatureCache *FeatureCache::getGlobalCache(){
+    static std::unique_ptr<FeatureCache> global_cache = []() -> std::unique_ptr<FeatureCache> {
+        if(FeatureCacheDir.empty())
+            return nullptr;
+        Expected<CachePruningPolicy> pruning_policy = parseCachePruningPolicy(FeatureCachePolicy);
+        if(!pruning_policy){
+            CELERITY_LOG(cache, warning) << "WARNING: feature cache: " << toString(pruning_policy.takeError()) << ", using the default policy\n";
+            pruning_policy = CachePruningPolicy();
+        }
+        return std::make_unique<FeatureCache>(FeatureCacheDir, *pruning_policy);
+    }();
+    // statistics are printed when the process exits
+    static struct StatsPrinter {
+        ~StatsPrinter(){
+            if(PrintFeatureCacheStats && global_cache)
+                global_cache->printStats(errs());
+        }
+    } stats_printer;
+    return global_cache.get();
+}
+
+std::string FeatureCache::hashFunction(const Function &fun){
+    StructuralHasher hasher;
+    hasher.addFunction(fun);
+    return toHex(hasher.hasher.final(), true);
+}
+
+std::string FeatureCache::getKey(const Function &fun, StringRef feature_set, StringRef analysis){
+    return getKey(hashFunction(fun), feature_set, analysis);
+}
+
+std::string FeatureCache::getKey(StringRef function_hash, StringRef feature_set, StringRef analysis){
+    SHA1 hasher;
+    for(StringRef part : {StringRef(feature_cache_version), StringRef(LLVM_VERSION_STRING), feature_set, analysis}){
+        hasher.update(part);
+        hasher.update(StringRef("\0", 1));
+    }
+    hasher.update(function_hash);
+    return toHex(hasher.final(), true);
+}
+
+std::string FeatureCache::getEntryPath(StringRef key) const {
+    SmallString<128> path(cache_dir);
+    // the prefix is required by the LLVM cache pruning
+    sys::path::append(path, "llvmcache-" + key);
+    return path.str().str();
+}
+
+bool FeatureCache::lookup(StringRef key, FeatureSet &features){
+    ErrorOr<std::unique_ptr<MemoryBuffer>> entry = MemoryBuffer::getFile(getEntryPath(key), -1, false);
+    if(!entry){
+        stats.misses++;
+        return false;
+    }
+    StringRef data = (*entry)->getBuffer();
+    unsigned num_features = features.raw.size();
+    size_t expected_size = sizeof(EntryHeader) + num_features * (sizeof(unsigned) + sizeof(float));
+    EntryHeader header;
+    if(data.size() != expected_size
+        || (memcpy(&header, data.data(), sizeof(header)), memcmp(header.magic, entry_magic, sizeof(entry_magic)) != 0)
+        || header.num_features != num_features){
+        stats.errors++;
+        stats.misses++;
+        return false;
+    }
+    const char *values = data.data() + sizeof(EntryHeader);
+    memcpy(features.raw.data(), values, num_features * sizeof(unsigned));
+    memcpy(features.feat.data(), values + num_features * sizeof(unsigned), num_features * sizeof(float));
+    features.instruction_num = header.instruction_num;
+    features.instruction_tot_contrib = header.instruction_tot_contrib;
+    stats.hits++;
+    return true;
+}
+
+void FeatureCache::store(StringRef key, const FeatureSet &features){
+    EntryHeader header;
+    memcpy(header.magic, entry_magic, sizeof(entry_magic));
+    header.num_features = features.raw.size();
+    header.instruction_num = features.instruction_num;
+    header.instruction_tot_contrib = features.instruction_tot_contrib;
+    storeEntry(key, [&](raw_ostream &out){
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(features.raw.data()), features.raw.size() * sizeof(unsigned));
+        out.write(reinterpret_cast<const char*>(features.feat.data()), features.feat.size() * sizeof(float));
+    });
+}
+
+bool FeatureCache::lookup(StringRef key, std::unique_ptr<MemoryBuffer> &block){
+    ErrorOr<std::unique_ptr<MemoryBuffer>> entry = MemoryBuffer::getFile(getEntryPath(key), -1, false);
+    if(!entry){
+        stats.misses++;
+        return false;
+    }
+    block = std::move(*entry);
+    stats.hits++;
+    return true;
+}
+
+void FeatureCache::reportCorrupted(){
+    stats.hits--;
+    stats.misses++;
+    stats.errors++;
+}
+
+void FeatureCache::store(StringRef key, ArrayRef<char> block){
+    storeEntry(key, [&](raw_ostream &out){ out.write(block.data(), block.size()); });
+}
+
+void FeatureCache::storeEntry(StringRef key, function_ref<void(raw_ostream &out)> write){
+    // write a temporary file, then atomically rename it: concurrent readers never see a partial entry
+    SmallString<128> tmp_model(cache_dir);
+    sys::path::append(tmp_model, "llvmcache-tmp-%%%%%%%%%%%%");
+    int fd;
+    SmallString<128> tmp_path;
+    if(sys::fs::createUniqueFile(tmp_model, fd, tmp_path)){
+        stats.errors++;
+        return;
+    }
+    {
+        raw_fd_ostream out(fd, true);
+        write(out);
+        out.close();
+        if(out.has_error()){
+            out.clear_error();
+            sys::fs::remove(tmp_path);
+            stats.errors++;
+            return;
+        }
+    }
+    if(sys::fs::rename(tmp_path, getEntryPath(key))){
+        sys::fs::remove(tmp_path);
+        stats.errors++;
+        return;
+    }
+    if(++stats.stores % prune_interval == 0)
+        prune();
+}
+
+void FeatureCache::prune(){
+    pruneCache(cache_dir, policy);
+}
+
+void FeatureCache::printStats(raw_ostream &out_stream) const {
+    uint64_t hits = stats.hits, misses = stats.misses;
+    uint64_t lookups = hits + misses;
+    out_stream << "feature cache " << cache_dir << ": " << hits << " hits, " << misses << " misses";
+    if(lookups)
+        out_stream << " (" << format("%.1f", 100.0 * hits / lookups) << "% hit rate)";
+    out_stream << ", " << stats.stores.load() << " stores, " << stats.errors.load() << " errors\n";
+}
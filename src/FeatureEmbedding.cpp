@@ -0,0 +1,174 @@
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+using namespace std;
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+using namespace llvm;
+
+#include "FeatureEmbedding.hpp"
+#include "FeatureCache.hpp"
+#include "Logging.hpp"
+using namespace celerity;
+
+namespace {
+/// operands of an entry tuple
+enum EntryOperand : unsigned { op_function, op_hash, op_feature_set, op_analysis, op_names, op_raw, op_feat, op_polynomials, op_num };
+
+StringRef get_string(const MDTuple *entry, unsigned operand){
+    if(const MDString *str = dyn_cast_or_null<MDString>(entry->getOperand(operand).get()))
+        return str->getString();
+    return "";
+}
+
+const MDTuple *get_tuple(const MDTuple *entry, unsigned operand){
+    return dyn_cast_or_null<MDTuple>(entry->getOperand(operand).get());
+}
+
+/// the metadata of the entry was not written by FeatureEmbedding::createEntry, e.g., edited by hand
+bool malformed(const Function &fun){
+    CELERITY_LOG(cache, warning) << "WARNING: malformed embedded features of " << fun.getName() << "\n";
+    return false;
+}
+
+/// function, feature set and analysis of an entry; the function is null if the node is not an entry or if the
+/// function was deleted
+struct EntryKey {
+    const Function *fun = nullptr;
+    StringRef feature_set, analysis;
+
+    explicit EntryKey(const MDNode *node){
+        const MDTuple *entry = dyn_cast<MDTuple>(node);
+        if(!entry || entry->getNumOperands() != op_num)
+            return;
+        fun = mdconst::dyn_extract_or_null<Function>(entry->getOperand(op_function));
+        feature_set = get_string(entry, op_feature_set);
+        analysis = get_string(entry, op_analysis);
+    }
+    bool operator<(const EntryKey &other) const {
+        return std::tie(fun, feature_set, analysis) < std::tie(other.fun, other.feature_set, other.analysis);
+    }
+};
+
+/// the entry is a well-formed tuple of the function, feature set and analysis
+bool matches(const MDNode *node, const Function &fun, StringRef feature_set, StringRef analysis){
+    EntryKey key(node);
+    return key.fun == &fun && key.feature_set == feature_set && key.analysis == analysis;
+}
+}
+
+MDTuple *FeatureEmbedding::find(const Function &fun, StringRef feature_set, StringRef analysis){
+    NamedMDNode *embedded = fun.getParent()->getNamedMetadata(feature_embedding_md);
+    if(!embedded)
+        return nullptr;
+    for(MDNode *node : embedded->operands())
+        if(matches(node, fun, feature_set, analysis))
+            return cast<MDTuple>(node);
+    return nullptr;
+}
+
+MDTuple *FeatureEmbedding::createEntry(Function &fun, StringRef feature_set, StringRef analysis, const FeatureSchema &schema,
+                                       ArrayRef<unsigned> raw, ArrayRef<float> feat, StringRef polynomials){
+    LLVMContext &context = fun.getContext();
+    Type *int_type = Type::getInt32Ty(context);
+    Type *float_type = Type::getFloatTy(context);
+    SmallVector<Metadata*, 32> names, raw_values, feat_values;
+    for(const std::string &name : schema.getNames())
+        names.push_back(MDString::get(context, name));
+    for(unsigned value : raw)
+        raw_values.push_back(ConstantAsMetadata::get(ConstantInt::get(int_type, value)));
+    for(float value : feat)
+        feat_values.push_back(ConstantAsMetadata::get(ConstantFP::get(float_type, value)));
+    Metadata *operands[op_num] = {
+        ValueAsMetadata::get(&fun),
+        MDString::get(context, FeatureCache::hashFunction(fun)),
+        MDString::get(context, feature_set),
+        MDString::get(context, analysis),
+        MDTuple::get(context, names),
+        MDTuple::get(context, raw_values),
+        MDTuple::get(context, feat_values),
+        MDString::get(context, polynomials) };
+    return MDTuple::get(context, operands);
+}
+
+void FeatureEmbedding::embed(Module &module, ArrayRef<MDTuple*> entries){
+    std::set<EntryKey> replaced;
+    for(const MDTuple *entry : entries)
+        replaced.insert(EntryKey(entry));
+    // the entries of the other functions and feature sets are kept, the previous entries are replaced; the entries
+    // whose function was deleted (the operand becomes null) are dropped
+    NamedMDNode *embedded = module.getOrInsertNamedMetadata(feature_embedding_md);
+    SmallVector<MDNode*, 16> kept;
+    for(MDNode *node : embedded->operands()){
+        EntryKey key(node);
+        if(key.fun && !replaced.count(key))
+            kept.push_back(node);
+    }
+    embedded->clearOperands();
+    for(MDNode *node : kept)
+        embedded->addOperand(node);
+    for(MDTuple *entry : entries)
+        embedded->addOperand(entry);
+}
+
+bool FeatureEmbedding::hasEmbeddedFeatures(const Module &module){
+    return module.getNamedMetadata(feature_embedding_md) != nullptr;
+}
+
+bool FeatureEmbedding::lookup(const Function &fun, StringRef feature_set, StringRef analysis, Entry &entry, StringRef function_hash){
+    const MDTuple *tuple = find(fun, feature_set, analysis);
+    if(!tuple)
+        return false;
+    std::string hash = function_hash.empty() ? FeatureCache::hashFunction(fun) : function_hash.str();
+    if(get_string(tuple, op_hash) != hash){
+        CELERITY_LOG(cache, info) << "embedded features of " << fun.getName() << " are stale\n";
+        return false;
+    }
+    const MDTuple *names = get_tuple(tuple, op_names), *raw = get_tuple(tuple, op_raw);
+    const MDTuple *feat = get_tuple(tuple, op_feat);
+    const MDString *polys = dyn_cast_or_null<MDString>(tuple->getOperand(op_polynomials).get());
+    if(!names || !raw || !feat || !polys)
+        return malformed(fun);
+    entry.names.clear();
+    entry.raw.clear();
+    entry.feat.clear();
+    for(const MDOperand &name : names->operands()){
+        const MDString *str = dyn_cast_or_null<MDString>(name.get());
+        if(!str)
+            return malformed(fun);
+        entry.names.push_back(str->getString().str());
+    }
+    for(const MDOperand &value : raw->operands()){
+        const ConstantInt *count = mdconst::dyn_extract_or_null<ConstantInt>(value);
+        if(!count)
+            return malformed(fun);
+        entry.raw.push_back(count->getZExtValue());
+    }
+    for(const MDOperand &value : feat->operands()){
+        const ConstantFP *norm = mdconst::dyn_extract_or_null<ConstantFP>(value);
+        if(!norm || !norm->getType()->isFloatTy())
+            return malformed(fun);
+        entry.feat.push_back(norm->getValueAPF().convertToFloat());
+    }
+    entry.polynomials = polys->getString().str();
+    return true;
+}
+
+bool FeatureEmbedding::lookup(const Function &fun, StringRef analysis, FeatureSet &features, StringRef function_hash){
+    Entry entry;
+    if(!lookup(fun, features.getCacheName(), analysis, entry, function_hash))
+        return false;
+    if(entry.names != features.getSchema().getNames() || entry.raw.size() != entry.names.size() || entry.feat.size() != entry.names.size()){
+        CELERITY_LOG(cache, warning) << "WARNING: embedded features of " << fun.getName() << " do not match the schema of "
+                                     << features.getName() << "\n";
+        return false;
+    }
+    std::copy(entry.raw.begin(), entry.raw.end(), features.raw.begin());
+    std::copy(entry.feat.begin(), entry.feat.end(), features.feat.begin());
+    return true;
+}
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Metadata.h>
+using namespace llvm;
+
+#include "FeatureExtraction.hpp"
+#include "CalleeClassification.hpp"
+#include "DebugStream.hpp"
+#ifdef CELERITY_POLFEAT
+#include "PolFeatAnalysis.hpp"
+#endif
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// Kernel-only materialization
+//-----------------------------------------------------------------------------
+SetVector<Function*> celerity::find_kernels(Module &module){
+    SetVector<Function*> kernels;
+    for(Function &fun : module)
+        if(fun.getCallingConv() == CallingConv::SPIR_KERNEL)
+            kernels.insert(&fun);
+    if(NamedMDNode *kernel_md = module.getNamedMetadata("opencl.kernels")){
+        for(MDNode *node : kernel_md->operands()){
+            if(node->getNumOperands() > 0)
+                if(Function *fun = mdconst::dyn_extract_or_null<Function>(node->getOperand(0)))
+                    kernels.insert(fun);
+        }
+    }
+    return kernels;
+}
+
+Expected<unsigned> celerity::materialize_kernels(Module &module){
+    if(Error err = module.materializeMetadata())
+        return err;
+    SetVector<Function*> reachable = find_kernels(module);
+    if(reachable.empty()){
+        if(Error err = module.materializeAll())
+            return err;
+        return std::count_if(module.begin(), module.end(), [](const Function &fun){ return !fun.isDeclaration(); });
+    }
+    // the set grows while it is visited: callees are materialized after their callers
+    for(size_t i = 0; i < reachable.size(); i++){
+        Function *fun = reachable[i];
+        if(Error err = fun->materialize())
+            return err;
+        for(Instruction &inst : instructions(*fun))
+            for(Value *operand : inst.operands())
+                if(Function *callee = dyn_cast<Function>(operand->stripPointerCasts()))
+                    if(!callee->isDeclaration())
+                        reachable.insert(callee);
+    }
+    for(Function &fun : module)
+        if(!fun.isDeclaration() && !reachable.count(&fun))
+            fun.deleteBody();
+    // nothing is left to materialize, this only completes the module (e.g., debug info upgrade)
+    if(Error err = module.materializeAll())
+        return err;
+    return reachable.size();
+}
+
+
+//-----------------------------------------------------------------------------
+// In-process extraction
+//-----------------------------------------------------------------------------
+Expected<std::unique_ptr<FeatureExtractor>> FeatureExtractor::create(StringRef analysis, StringRef feature_set){
+    if(!FSRegistry::isRegistered(feature_set))
+        return createStringError(inconvertibleErrorCode(), "unknown feature set %s", feature_set.str().c_str());
+    std::unique_ptr<FeatureExtractor> extractor(new FeatureExtractor());
+    extractor->analysis_name = analysis.str();
+    extractor->feature_set_name = feature_set.str();
+#ifdef CELERITY_POLFEAT
+    if(analysis == "polfeat"){
+        extractor->polfeat = std::make_unique<PolFeatAnalysis>(feature_set.str());
+        extractor->schema = &extractor->polfeat->getFeatureSet()->getSchema();
+        extractor->polfeat->addCanonicalizationPasses(extractor->canonicalization);
+    }
+    else
+#endif
+    {
+        extractor->analysis = FARegistry::dispatch(analysis, feature_set.str());
+        if(!extractor->analysis)
+            return createStringError(inconvertibleErrorCode(), "unknown feature analysis %s", analysis.str().c_str());
+        extractor->schema = &extractor->analysis->getFeatureSet()->getSchema();
+        extractor->analysis->addCanonicalizationPasses(extractor->canonicalization);
+    }
+    // the analyses are registered directly, no pass plugin is loaded
+    FeatureExtractor &ex = *extractor;
+    ex.FAM.registerPass([&ex] { return ex.PB.buildDefaultAAPipeline(); });
+    ex.MAM.registerPass([] { return CalleeClassificationAnalysis(); });
+    ex.PB.registerModuleAnalyses(ex.MAM);
+    ex.PB.registerCGSCCAnalyses(ex.CGAM);
+    ex.PB.registerFunctionAnalyses(ex.FAM);
+    ex.PB.registerLoopAnalyses(ex.LAM);
+    ex.PB.crossRegisterProxies(ex.LAM, ex.FAM, ex.CGAM, ex.MAM);
+    return extractor;
+}
+
+FeatureExtractor::~FeatureExtractor(){
+    // results refer to the analyzed functions, which may be released before the extractor
+    FAM.clear();
+    MAM.clear();
+}
+
+Error FeatureExtractor::run(Function &fun, MutableArrayRef<unsigned> raw, MutableArrayRef<float> feat){
+    DebugStreamRedirect redirect(*diagnostics);
+    canonicalization.run(fun, FAM);
+#ifdef CELERITY_POLFEAT
+    if(polfeat){
+        if(!raw.empty())
+            return createStringError(inconvertibleErrorCode(), "polfeat raw counters are polynomials, see extractPolynomials");
+        ResultPolFeatSet result = polfeat->run(fun, FAM);
+        if(!feat.empty())
+            std::copy(result.feat.begin(), result.feat.end(), feat.begin());
+        return Error::success();
+    }
+#endif
+    ResultFeatureAnalysis result = analysis->run(fun, FAM);
+    if(!raw.empty())
+        std::copy(result.raw.begin(), result.raw.end(), raw.begin());
+    if(!feat.empty())
+        std::copy(result.feat.begin(), result.feat.end(), feat.begin());
+    return Error::success();
+}
+
+Error FeatureExtractor::extract(Function &fun, MutableArrayRef<unsigned> raw, MutableArrayRef<float> feat){
+    const unsigned num_features = getNumFeatures();
+    if((!raw.empty() && raw.size() < num_features) || (!feat.empty() && feat.size() < num_features))
+        return createStringError(inconvertibleErrorCode(), "feature buffers hold less than %u values", num_features);
+    if(fun.isDeclaration())
+        return createStringError(inconvertibleErrorCode(), "function %s has no body", fun.getName().str().c_str());
+    Error err = run(fun, raw.take_front(raw.empty() ? 0 : num_features), feat.take_front(feat.empty() ? 0 : num_features));
+    FAM.clear(fun, fun.getName());
+    return err;
+}
+
+Expected<size_t> FeatureExtractor::extract(Module &module, MutableArrayRef<unsigned> raw, MutableArrayRef<float> feat,
+                                           std::vector<std::string> *names){
+    const unsigned num_features = getNumFeatures();
+    // rows that fit into both buffers (empty buffers are not written)
+    size_t max_rows = SIZE_MAX;
+    if(!raw.empty())
+        max_rows = std::min<size_t>(max_rows, raw.size() / num_features);
+    if(!feat.empty())
+        max_rows = std::min<size_t>(max_rows, feat.size() / num_features);
+
+    // callees are classified once for all the functions of the module
+    MAM.getResult<CalleeClassificationAnalysis>(module);
+    size_t row = 0;
+    for(Function &fun : module){
+        if(fun.isDeclaration())
+            continue;
+        if(names)
+            names->push_back(fun.getName().str());
+        if(row < max_rows){
+            MutableArrayRef<unsigned> raw_row = raw.empty() ? raw : raw.slice(row * num_features, num_features);
+            MutableArrayRef<float> feat_row = feat.empty() ? feat : feat.slice(row * num_features, num_features);
+            if(Error err = run(fun, raw_row, feat_row)){
+                FAM.clear();
+                MAM.clear();
+                return err;
+            }
+        }
+        row++;
+    }
+    FAM.clear();
+    MAM.clear();
+    return row;
+}
+
+Expected<size_t> FeatureExtractor::extract(MemoryBufferRef bitcode, MutableArrayRef<unsigned> raw, MutableArrayRef<float> feat,
+                                           std::vector<std::string> *names){
+    // the lazy module reads the function bodies from the caller's buffer, which is not copied. The module has a
+    // context of its own, released with it: a long-lived extractor does not accumulate the types and constants
+    // of all the modules it extracted
+    LLVMContext context;
+    Expected<std::unique_ptr<Module>> module = getLazyBitcodeModule(bitcode, context);
+    if(!module)
+        return module.takeError();
+    if(only_kernels){
+        if(Expected<unsigned> materialized = materialize_kernels(**module); !materialized)
+            return materialized.takeError();
+    }
+    else if(Error err = (*module)->materializeAll())
+        return err;
+    return extract(**module, raw, feat, names);
+}
+
+#ifdef CELERITY_POLFEAT
+Error FeatureExtractor::extractPolynomials(Function &fun, MutableArrayRef<IMPoly> polys){
+    if(!polfeat)
+        return createStringError(inconvertibleErrorCode(), "polynomial counters require the polfeat analysis, not %s", analysis_name.c_str());
+    if(polys.size() < getNumFeatures())
+        return createStringError(inconvertibleErrorCode(), "polynomial buffer holds less than %u values", getNumFeatures());
+    if(fun.isDeclaration())
+        return createStringError(inconvertibleErrorCode(), "function %s has no body", fun.getName().str().c_str());
+    {
+        DebugStreamRedirect redirect(*diagnostics);
+        canonicalization.run(fun, FAM);
+        ResultPolFeatSet result = polfeat->run(fun, FAM);
+        std::copy(result.raw.begin(), result.raw.end(), polys.begin());
+    }
+    FAM.clear(fun, fun.getName());
+    return Error::success();
+}
+#endif
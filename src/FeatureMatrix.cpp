@@ -0,0 +1,188 @@
+#include <cstring>
+using namespace std;
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+using namespace llvm;
+
+#include "FeatureMatrix.hpp"
+using namespace celerity;
+
+static const char feature_matrix_magic[8] = {'C', 'E', 'L', 'F', 'M', 'A', 'T', '\0'};
+static const uint32_t feature_matrix_version = 1;
+static const uint32_t feature_matrix_byte_order = 0x01020304;
+
+//-----------------------------------------------------------------------------
+// Writer
+//-----------------------------------------------------------------------------
+FeatureMatrixWriter::FeatureMatrixWriter(StringRef feature_set, StringRef analysis, const FeatureSchema &feature_schema)
+  : feature_set_name(feature_set.str()), analysis_name(analysis.str()), schema(&feature_schema) {}
+
+void FeatureMatrixWriter::addRow(StringRef module, StringRef kernel, ArrayRef<unsigned> raw_values, ArrayRef<float> feat_values){
+    assert(raw_values.size() == schema->size() && feat_values.size() == schema->size());
+    if(modules.empty() || modules.back() != module)
+        modules.push_back(module.str());
+    module_ids.push_back(modules.size() - 1);
+    kernels.push_back(kernel.str());
+    raw.insert(raw.end(), raw_values.begin(), raw_values.end());
+    feat.insert(feat.end(), feat_values.begin(), feat_values.end());
+}
+
+void FeatureMatrixWriter::serialize(std::vector<char> &buffer) const {
+    const unsigned num_features = schema->size();
+    const uint64_t num_rows = kernels.size();
+
+    string strings;
+    for(const string &str : {feature_set_name, analysis_name}){
+        strings += str;
+        strings += '\0';
+    }
+    for(const string &str : schema->getNames()){
+        strings += str;
+        strings += '\0';
+    }
+    for(const std::vector<string> *table : {&modules, &kernels}){
+        for(const string &str : *table){
+            strings += str;
+            strings += '\0';
+        }
+    }
+
+    FeatureMatrixHeader header;
+    memcpy(header.magic, feature_matrix_magic, sizeof(header.magic));
+    header.version = feature_matrix_version;
+    header.byte_order = feature_matrix_byte_order;
+    header.num_features = num_features;
+    header.num_modules = modules.size();
+    header.num_rows = num_rows;
+    header.string_offset = sizeof(FeatureMatrixHeader);
+    header.string_size = strings.size();
+    header.module_offset = alignTo(header.string_offset + header.string_size, 8);
+    header.raw_offset = alignTo(header.module_offset + num_rows * sizeof(uint32_t), 8);
+    header.feat_offset = alignTo(header.raw_offset + num_features * num_rows * sizeof(uint32_t), 8);
+    header.chunk_size = alignTo(header.feat_offset + num_features * num_rows * sizeof(float), 8);
+
+    size_t chunk_begin = buffer.size();
+    buffer.resize(chunk_begin + header.chunk_size, 0);
+    char *chunk = buffer.data() + chunk_begin;
+    memcpy(chunk, &header, sizeof(header));
+    memcpy(chunk + header.string_offset, strings.data(), strings.size());
+    memcpy(chunk + header.module_offset, module_ids.data(), num_rows * sizeof(uint32_t));
+    // transpose the rows into one contiguous column per feature
+    uint32_t *raw_columns = reinterpret_cast<uint32_t*>(chunk + header.raw_offset);
+    float *feat_columns = reinterpret_cast<float*>(chunk + header.feat_offset);
+    for(uint64_t row = 0; row < num_rows; row++){
+        for(unsigned feature = 0; feature < num_features; feature++){
+            raw_columns[feature * num_rows + row] = raw[row * num_features + feature];
+            feat_columns[feature * num_rows + row] = feat[row * num_features + feature];
+        }
+    }
+}
+
+Error FeatureMatrixWriter::write(StringRef filename, bool append) const {
+    std::vector<char> buffer;
+    serialize(buffer);
+    std::error_code ec;
+    raw_fd_ostream out(filename, ec, append ? sys::fs::OF_Append : sys::fs::OF_None);
+    if(ec)
+        return createStringError(ec, "cannot open %s", filename.str().c_str());
+    // a single unbuffered write of the whole chunk
+    out.SetUnbuffered();
+    out.write(buffer.data(), buffer.size());
+    out.close();
+    if(out.has_error()){
+        ec = out.error();
+        out.clear_error();
+        return createStringError(ec, "cannot write %s", filename.str().c_str());
+    }
+    return Error::success();
+}
+
+
+//-----------------------------------------------------------------------------
+// Reader
+//-----------------------------------------------------------------------------
+FeatureMatrixChunk::FeatureMatrixChunk(const FeatureMatrixHeader *chunk_header, std::vector<StringRef> chunk_strings)
+  : header(chunk_header), strings(std::move(chunk_strings)) {}
+
+Expected<FeatureMatrixReader> FeatureMatrixReader::open(StringRef filename){
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(filename, -1, false);
+    if(!buffer)
+        return createStringError(buffer.getError(), "cannot open %s", filename.str().c_str());
+    return read(std::move(*buffer));
+}
+
+Expected<FeatureMatrixReader> FeatureMatrixReader::read(std::unique_ptr<MemoryBuffer> buffer){
+    FeatureMatrixReader reader;
+    StringRef data = buffer->getBuffer();
+    if(reinterpret_cast<uintptr_t>(data.data()) % 8 != 0)
+        return createStringError(inconvertibleErrorCode(), "feature matrix buffer is not 8-byte aligned");
+    uint64_t offset = 0;
+    while(offset < data.size()){
+        auto corrupted = [&](const char *what){
+            return createStringError(inconvertibleErrorCode(), "feature matrix %s: %s in chunk at offset %llu",
+                                     buffer->getBufferIdentifier().str().c_str(), what, (unsigned long long)offset);
+        };
+        if(data.size() - offset < sizeof(FeatureMatrixHeader))
+            return corrupted("truncated header");
+        const FeatureMatrixHeader *header = reinterpret_cast<const FeatureMatrixHeader*>(data.data() + offset);
+        if(memcmp(header->magic, feature_matrix_magic, sizeof(header->magic)) != 0)
+            return corrupted("bad magic");
+        if(header->byte_order != feature_matrix_byte_order)
+            return corrupted("unsupported byte order");
+        if(header->version != feature_matrix_version)
+            return corrupted("unsupported version");
+        const uint64_t num_rows = header->num_rows, num_features = header->num_features;
+        if(header->chunk_size > data.size() - offset || header->chunk_size < sizeof(FeatureMatrixHeader) || header->chunk_size % 8 != 0
+            || header->string_offset < sizeof(FeatureMatrixHeader))
+            return corrupted("inconsistent layout");
+        // each section holds count elements of size bytes at offset and ends before the next one: the sizes come from
+        // the file and are not trusted, thus the ends are computed with overflow checks
+        auto fits = [](uint64_t offset, uint64_t count, uint64_t size, uint64_t limit){
+            uint64_t bytes, end;
+            return !__builtin_mul_overflow(count, size, &bytes) && !__builtin_add_overflow(offset, bytes, &end) && end <= limit;
+        };
+        uint64_t num_values;
+        if(__builtin_mul_overflow(num_features, num_rows, &num_values)
+            || !fits(header->string_offset, header->string_size, 1, header->module_offset)
+            || !fits(header->module_offset, num_rows, sizeof(uint32_t), header->raw_offset)
+            || !fits(header->raw_offset, num_values, sizeof(uint32_t), header->feat_offset)
+            || !fits(header->feat_offset, num_values, sizeof(float), header->chunk_size)
+            || header->module_offset % 8 || header->raw_offset % 8 || header->feat_offset % 8)
+            return corrupted("inconsistent layout");
+
+        // string table: names of feature set, analysis, features, modules and kernels
+        std::vector<StringRef> strings;
+        uint64_t num_strings;
+        if(__builtin_add_overflow(2 + num_features + header->num_modules, num_rows, &num_strings))
+            return corrupted("inconsistent layout");
+        StringRef string_table(data.data() + offset + header->string_offset, header->string_size);
+        while(!string_table.empty() && strings.size() < num_strings){
+            size_t end = string_table.find('\0');
+            if(end == StringRef::npos)
+                return corrupted("unterminated string");
+            strings.push_back(string_table.substr(0, end));
+            string_table = string_table.drop_front(end + 1);
+        }
+        if(strings.size() != num_strings)
+            return corrupted("truncated string table");
+
+        FeatureMatrixChunk chunk(header, std::move(strings));
+        const uint32_t *module_ids = chunk.getModuleIds();
+        for(uint64_t row = 0; row < num_rows; row++)
+            if(module_ids[row] >= header->num_modules)
+                return corrupted("bad module id");
+        reader.chunks.push_back(std::move(chunk));
+        offset += header->chunk_size;
+    }
+    reader.buffer = std::move(buffer);
+    return reader;
+}
+
+uint64_t FeatureMatrixReader::getNumRows() const {
+    uint64_t num_rows = 0;
+    for(const FeatureMatrixChunk &chunk : chunks)
+        num_rows += chunk.getNumRows();
+    return num_rows;
+}
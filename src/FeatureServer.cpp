@@ -0,0 +1,325 @@
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using namespace std;
+
+#include <llvm/Support/MathExtras.h>
+using namespace llvm;
+
+#include "FeatureServer.hpp"
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// Socket utilities
+//-----------------------------------------------------------------------------
+/// read exactly size bytes, returns false on end of stream or error
+static bool read_all(int fd, void *data, size_t size){
+    char *ptr = static_cast<char*>(data);
+    while(size > 0){
+        ssize_t n = ::recv(fd, ptr, size, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+/// write exactly size bytes, a closed peer is reported as an error instead of raising SIGPIPE
+static bool write_all(int fd, const void *data, size_t size){
+    const char *ptr = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static Error make_socket_address(StringRef socket_path, sockaddr_un &address){
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(address.sun_path))
+        return createStringError(inconvertibleErrorCode(), "socket path too long: %s", socket_path.str().c_str());
+    memcpy(address.sun_path, socket_path.data(), socket_path.size());
+    return Error::success();
+}
+
+static Error socket_error(const char *what, StringRef socket_path){
+    return createStringError(std::error_code(errno, std::generic_category()), "cannot %s %s", what, socket_path.str().c_str());
+}
+
+
+//-----------------------------------------------------------------------------
+// Reply encoding
+//-----------------------------------------------------------------------------
+void FeatureReply::serialize(std::vector<char> &buffer) const {
+    string strings;
+    if(status == FeatureReplyStatus::ok){
+        for(const string &kernel : kernels){
+            strings += kernel;
+            strings += '\0';
+        }
+    }
+    else
+        strings = error;
+
+    FeatureReplyHeader header;
+    memcpy(header.magic, feature_reply_magic, sizeof(header.magic));
+    header.request_id = request_id;
+    header.status = (uint32_t)status;
+    header.num_features = num_features;
+    header.num_rows = status == FeatureReplyStatus::ok ? kernels.size() : 0;
+    header.string_size = strings.size();
+
+    size_t begin = buffer.size();
+    size_t values_offset = alignTo(sizeof(header) + strings.size(), 4);
+    size_t num_values = status == FeatureReplyStatus::ok ? feat.size() : 0;
+    assert(num_values == (size_t)header.num_rows * num_features);
+    buffer.resize(begin + values_offset + num_values * sizeof(float), 0);
+    memcpy(buffer.data() + begin, &header, sizeof(header));
+    memcpy(buffer.data() + begin + sizeof(header), strings.data(), strings.size());
+    memcpy(buffer.data() + begin + values_offset, feat.data(), num_values * sizeof(float));
+}
+
+
+//-----------------------------------------------------------------------------
+// Server
+//-----------------------------------------------------------------------------
+struct FeatureServer::Connection {
+    int fd;
+    std::mutex write_lock; // replies of different workers are written one at a time
+    explicit Connection(int socket_fd) : fd(socket_fd) {}
+    ~Connection(){ ::close(fd); }
+
+    bool write(const std::vector<char> &buffer){
+        std::lock_guard<std::mutex> guard(write_lock);
+        return write_all(fd, buffer.data(), buffer.size());
+    }
+};
+
+FeatureServer::FeatureServer(unsigned num_workers, unsigned max_pending, Handler request_handler)
+  : num_workers(std::max(1u, num_workers)), max_pending(std::max(1u, max_pending)), handler(std::move(request_handler)) {}
+
+FeatureServer::~FeatureServer(){
+    stop();
+    {
+        // readers blocked on a connection return once it is shut down
+        std::lock_guard<std::mutex> guard(queue_lock);
+        for(Reader &reader : readers)
+            if(std::shared_ptr<Connection> connection = reader.connection.lock())
+                ::shutdown(connection->fd, SHUT_RDWR);
+    }
+    // the readers queue their last requests before returning, thus the workers still run
+    for(Reader &reader : readers)
+        reader.thread.join();
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        closing = true;
+    }
+    queue_not_full.notify_all();
+    queue_not_empty.notify_all();
+    for(std::thread &worker : workers)
+        worker.join();
+    if(listen_fd >= 0){
+        ::close(listen_fd);
+        ::unlink(path.c_str());
+    }
+}
+
+Error FeatureServer::listen(StringRef socket_path){
+    sockaddr_un address;
+    if(Error err = make_socket_address(socket_path, address))
+        return err;
+    path = socket_path.str();
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0)
+        return socket_error("create socket", socket_path);
+    // a socket file left by a previous server would make bind fail; sys::fs::remove only removes regular files
+    ::unlink(path.c_str());
+    if(::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        return socket_error("bind", socket_path);
+    if(::listen(listen_fd, SOMAXCONN) != 0)
+        return socket_error("listen on", socket_path);
+    for(unsigned w = 0; w < num_workers; w++)
+        workers.emplace_back([this, w]{ runWorker(w); });
+    return Error::success();
+}
+
+Error FeatureServer::serve(){
+    while(!stopping){
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if(fd < 0){
+            if(stopping)
+                break;
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return socket_error("accept connections on", path);
+        }
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+        // the readers of closed connections are joined here, the others by the destructor
+        std::list<Reader> finished;
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            for(auto reader = readers.begin(); reader != readers.end(); ){
+                auto next = std::next(reader);
+                if(reader->finished)
+                    finished.splice(finished.end(), readers, reader);
+                reader = next;
+            }
+            readers.emplace_back();
+            Reader &reader = readers.back();
+            reader.connection = connection;
+            reader.thread = std::thread([this, connection, &reader]{
+                readRequests(connection);
+                std::lock_guard<std::mutex> guard(queue_lock);
+                reader.finished = true;
+            });
+        }
+        for(Reader &reader : finished)
+            reader.thread.join();
+    }
+    return Error::success();
+}
+
+void FeatureServer::stop(){
+    if(stopping.exchange(true))
+        return;
+    // wakes up the accept call of serve(); only async-signal-safe calls, stop() may run in a signal handler
+    if(listen_fd >= 0)
+        ::shutdown(listen_fd, SHUT_RDWR);
+}
+
+void FeatureServer::readRequests(std::shared_ptr<Connection> connection){
+    FeatureRequestHeader header;
+    while(read_all(connection->fd, &header, sizeof(header))){
+        if(memcmp(header.magic, feature_request_magic, sizeof(header.magic)) != 0 || header.module_size > feature_request_max_size){
+            // the stream cannot be resynchronized: report the error and drop the connection
+            FeatureReply reply;
+            reply.request_id = header.request_id;
+            reply.status = FeatureReplyStatus::error;
+            reply.error = "malformed request";
+            std::vector<char> buffer;
+            reply.serialize(buffer);
+            connection->write(buffer);
+            break;
+        }
+        std::unique_ptr<WritableMemoryBuffer> module =
+            WritableMemoryBuffer::getNewUninitMemBuffer(header.module_size, "request-" + std::to_string(header.request_id));
+        if(!module || !read_all(connection->fd, module->getBufferStart(), header.module_size))
+            break;
+        std::unique_lock<std::mutex> guard(queue_lock);
+        queue_not_full.wait(guard, [&]{ return queue.size() < max_pending || closing; });
+        if(closing)
+            break;
+        queue.push_back(Job{connection, header.request_id, std::move(module)});
+        guard.unlock();
+        queue_not_empty.notify_one();
+    }
+}
+
+void FeatureServer::runWorker(unsigned worker_id){
+    while(true){
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(queue_lock);
+            queue_not_empty.wait(guard, [&]{ return !queue.empty() || closing; });
+            if(queue.empty())
+                return;
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        queue_not_full.notify_one();
+
+        FeatureReply reply;
+        handler(worker_id, std::move(job.module), reply);
+        reply.request_id = job.request_id;
+        std::vector<char> buffer;
+        reply.serialize(buffer);
+        // a client that disconnected before its replies is not an error of the server
+        job.connection->write(buffer);
+        completed_requests++;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Client
+//-----------------------------------------------------------------------------
+FeatureClient::~FeatureClient(){
+    if(fd >= 0)
+        ::close(fd);
+}
+
+void FeatureClient::shutdown(){
+    if(fd >= 0)
+        ::shutdown(fd, SHUT_RDWR);
+}
+
+Error FeatureClient::connect(StringRef socket_path){
+    sockaddr_un address;
+    if(Error err = make_socket_address(socket_path, address))
+        return err;
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return socket_error("create socket", socket_path);
+    if(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        return socket_error("connect to", socket_path);
+    return Error::success();
+}
+
+Error FeatureClient::send(uint32_t request_id, StringRef module){
+    FeatureRequestHeader header;
+    memcpy(header.magic, feature_request_magic, sizeof(header.magic));
+    header.request_id = request_id;
+    header.module_size = module.size();
+    if(!write_all(fd, &header, sizeof(header)) || !write_all(fd, module.data(), module.size()))
+        return createStringError(std::error_code(errno, std::generic_category()), "cannot send request %u", request_id);
+    return Error::success();
+}
+
+Expected<FeatureReply> FeatureClient::receive(){
+    auto failed = [](const char *what){ return createStringError(inconvertibleErrorCode(), "cannot receive reply: %s", what); };
+    FeatureReplyHeader header;
+    if(!read_all(fd, &header, sizeof(header)))
+        return failed("connection closed");
+    if(memcmp(header.magic, feature_reply_magic, sizeof(header.magic)) != 0)
+        return failed("bad magic");
+    uint64_t num_values = (uint64_t)header.num_rows * header.num_features;
+    if(num_values > feature_request_max_size / sizeof(float))
+        return failed("too many values");
+    // the values start at a 4-byte boundary of the reply, the header size is a multiple of 4
+    std::vector<char> strings(alignTo(header.string_size, 4));
+    if(!read_all(fd, strings.data(), strings.size()))
+        return failed("truncated string table");
+    FeatureReply reply;
+    reply.request_id = header.request_id;
+    reply.status = (FeatureReplyStatus)header.status;
+    reply.num_features = header.num_features;
+    StringRef string_table(strings.data(), header.string_size);
+    if(reply.status != FeatureReplyStatus::ok)
+        reply.error = string_table.str();
+    else{
+        for(uint32_t row = 0; row < header.num_rows; row++){
+            size_t end = string_table.find('\0');
+            if(end == StringRef::npos)
+                return failed("truncated kernel names");
+            reply.kernels.push_back(string_table.substr(0, end).str());
+            string_table = string_table.drop_front(end + 1);
+        }
+    }
+    reply.feat.resize(num_values);
+    if(!read_all(fd, reply.feat.data(), num_values * sizeof(float)))
+        return failed("truncated feature values");
+    return reply;
+}
@@ -0,0 +1,356 @@
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+using namespace llvm;
+
+#include "FeatureSetDefinition.hpp"
+#include "Logging.hpp"
+using namespace celerity;
+
+using Rule = FeatureSetDefinition::Rule;
+
+
+//-----------------------------------------------------------------------------
+// Compiled definition
+//-----------------------------------------------------------------------------
+bool Rule::matchesType(const Instruction &inst) const {
+    // stores produce no value, their type is the one of the stored value
+    const Type *type_of = isa<StoreInst>(inst) ? cast<StoreInst>(inst).getValueOperand()->getType() : inst.getType();
+    if(lanes != any){
+        unsigned num_lanes = isa<VectorType>(type_of) ? cast<VectorType>(type_of)->getElementCount().getKnownMinValue() : 1;
+        if(num_lanes != lanes)
+            return false;
+    }
+    const Type *scalar = type_of->getScalarType();
+    switch(type){
+        case TypeKind::integer:  if(!scalar->isIntegerTy()) return false; break;
+        case TypeKind::floating: if(!scalar->isFloatingPointTy()) return false; break;
+        case TypeKind::pointer:  if(!scalar->isPointerTy()) return false; break;
+        case TypeKind::any:      break;
+    }
+    return width == any || scalar->getScalarSizeInBits() == width;
+}
+
+void FeatureSetDefinition::matchCallee(const CalleeInfo &callee, SmallVectorImpl<unsigned> &matching) const {
+    for(unsigned i = 0; i < callee_rules.size(); i++){
+        const CalleeRule &rule = callee_rules[i];
+        bool match = false;
+        if(rule.callee_class){
+            switch(*rule.callee_class){
+                case CalleeClass::math:    match = callee.math; break;
+                case CalleeClass::barrier: match = callee.barrier; break;
+                case CalleeClass::opencl:  match = callee.opencl; break;
+            }
+        }
+        else if(rule.pattern)
+            match = rule.pattern->match(callee.name);
+        else
+            match = rule.name == callee.name;
+        if(match)
+            matching.push_back(i);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Definition parser
+//-----------------------------------------------------------------------------
+namespace celerity {
+
+/// Parser of the definition files, see FeatureSetDefinition for the format.
+/// Rules are collected per opcode and intrinsic, then laid out contiguously in the rule list.
+class FeatureSetParser {
+ public:
+    FeatureSetParser(StringRef source_name) : source(source_name), definition(new FeatureSetDefinition()) {}
+
+    Expected<std::shared_ptr<const FeatureSetDefinition>> parse(StringRef text){
+        SmallVector<StringRef, 64> lines;
+        text.split(lines, '\n');
+        for(StringRef text_line : lines){
+            line++;
+            SmallVector<StringRef, 16> tokens;
+            SplitString(text_line.split('#').first, tokens);
+            if(tokens.empty())
+                continue;
+            if(Error err = parseLine(tokens))
+                return err;
+        }
+        if(definition->name.empty())
+            return error("missing featureset name");
+        if(definition->schema.size() == 0)
+            return error("feature set " + definition->name + " declares no features");
+        compile();
+        definition->hash = toHex(SHA1::hash(arrayRefFromStringRef(text)), true).substr(0, 16);
+        return std::shared_ptr<const FeatureSetDefinition>(std::move(definition));
+    }
+
+ private:
+    Error error(const Twine &message) const {
+        return make_error<StringError>(source + ":" + Twine(line) + ": " + message, inconvertibleErrorCode());
+    }
+
+    Error parseLine(ArrayRef<StringRef> tokens){
+        StringRef directive = tokens.front();
+        tokens = tokens.drop_front();
+        if(directive == "featureset"){
+            if(tokens.size() != 1)
+                return error("featureset takes a name");
+            if(!definition->name.empty())
+                return error("featureset declared twice");
+            definition->name = tokens.front().str();
+            return Error::success();
+        }
+        if(directive == "features"){
+            std::vector<std::string> names = definition->schema.getNames();
+            for(StringRef feature : tokens){
+                if(is_contained(names, feature))
+                    return error("feature " + feature + " declared twice");
+                names.push_back(feature.str());
+            }
+            definition->schema = FeatureSchema(std::move(names));
+            return Error::success();
+        }
+        if(directive == "unknown"){
+            if(tokens.size() != 1 || (tokens.front() != "warn" && tokens.front() != "ignore"))
+                return error("unknown takes warn or ignore");
+            definition->warn_unknown = tokens.front() == "warn";
+            return Error::success();
+        }
+        if(directive == "count"){
+            if(tokens.empty())
+                return error("count takes a feature and a rule");
+            int feature = definition->schema.getId(tokens.front());
+            if(feature < 0)
+                return error("undeclared feature " + tokens.front());
+            return parseRule(tokens.drop_front(), feature);
+        }
+        if(directive == "ignore")
+            return parseRule(tokens, Rule::ignore);
+        return error("unknown directive " + directive);
+    }
+
+    /// <matcher> <values>... [<condition> <value>]...
+    Error parseRule(ArrayRef<StringRef> tokens, unsigned feature){
+        if(tokens.empty())
+            return error("missing rule matcher (opcode, intrinsic, builtin, callee)");
+        StringRef matcher = tokens.front();
+        tokens = tokens.drop_front();
+        ArrayRef<StringRef> values = tokens.take_until([](StringRef token){ return isCondition(token); });
+        if(values.empty())
+            return error(matcher + " takes at least one value");
+
+        Rule rule;
+        rule.feature = feature;
+        for(ArrayRef<StringRef> conditions = tokens.drop_front(values.size()); !conditions.empty(); conditions = conditions.drop_front(2)){
+            if(conditions.size() < 2)
+                return error("condition " + conditions.front() + " takes a value");
+            if(Error err = parseCondition(conditions[0], conditions[1], rule))
+                return err;
+        }
+
+        if(matcher == "opcode"){
+            for(StringRef value : values){
+                auto opcode = opcodeNames().find(value);
+                if(opcode == opcodeNames().end())
+                    return error("unknown opcode " + value);
+                if(rule.addrspace != Rule::any && opcode->second != Instruction::Load && opcode->second != Instruction::Store)
+                    return error("addrspace only applies to load and store");
+                opcode_rules[opcode->second].push_back(rule);
+            }
+            return Error::success();
+        }
+        if(rule.addrspace != Rule::any)
+            return error("addrspace only applies to load and store");
+        if(matcher == "intrinsic"){
+            for(StringRef value : values){
+                std::string intrinsic_name = value.startswith("llvm.") ? value.str() : ("llvm." + value).str();
+                Intrinsic::ID id = Function::lookupIntrinsicID(intrinsic_name);
+                if(id == Intrinsic::not_intrinsic)
+                    return error("unknown intrinsic " + value);
+                intrinsic_rules[id].push_back(rule);
+            }
+            return Error::success();
+        }
+        if(matcher == "builtin"){
+            for(StringRef value : values){
+                FeatureSetDefinition::CalleeRule callee_rule{rule, "", None, None};
+                // exact names are compared directly, other names are glob patterns
+                if(value.find_first_of("*?[\\") == StringRef::npos){
+                    callee_rule.name = value.str();
+                }else{
+                    Expected<GlobPattern> pattern = GlobPattern::create(value);
+                    if(!pattern)
+                        return error("invalid pattern " + value + ": " + toString(pattern.takeError()));
+                    callee_rule.pattern = std::move(*pattern);
+                }
+                definition->callee_rules.push_back(std::move(callee_rule));
+            }
+            return Error::success();
+        }
+        if(matcher == "callee"){
+            for(StringRef value : values){
+                FeatureSetDefinition::CalleeRule callee_rule{rule, "", None, None};
+                if(value == "math")
+                    callee_rule.callee_class = FeatureSetDefinition::CalleeClass::math;
+                else if(value == "barrier")
+                    callee_rule.callee_class = FeatureSetDefinition::CalleeClass::barrier;
+                else if(value == "opencl")
+                    callee_rule.callee_class = FeatureSetDefinition::CalleeClass::opencl;
+                else
+                    return error("unknown callee class " + value + " (math, barrier, opencl)");
+                definition->callee_rules.push_back(std::move(callee_rule));
+            }
+            return Error::success();
+        }
+        return error("unknown rule matcher " + matcher + " (opcode, intrinsic, builtin, callee)");
+    }
+
+    static bool isCondition(StringRef token){
+        return token == "type" || token == "width" || token == "lanes" || token == "addrspace";
+    }
+
+    Error parseCondition(StringRef condition, StringRef value, Rule &rule){
+        rule.conditional = true;
+        rule.typed = rule.typed || condition != "addrspace";
+        if(condition == "type"){
+            if(value == "int")
+                rule.type = Rule::TypeKind::integer;
+            else if(value == "float")
+                rule.type = Rule::TypeKind::floating;
+            else if(value == "pointer")
+                rule.type = Rule::TypeKind::pointer;
+            else
+                return error("unknown type " + value + " (int, float, pointer)");
+            return Error::success();
+        }
+        unsigned number;
+        if(condition == "addrspace"){
+            // same numbering as get_cl_address_space_type
+            static const StringRef address_spaces[] = {"generic", "global", "region", "local", "constant", "private"};
+            const StringRef *named = llvm::find(address_spaces, value);
+            if(named != std::end(address_spaces))
+                number = named - std::begin(address_spaces);
+            else if(value.getAsInteger(10, number))
+                return error("invalid address space " + value);
+            rule.addrspace = number;
+            return Error::success();
+        }
+        if(value.getAsInteger(10, number) || number == Rule::any)
+            return error("invalid " + condition + " " + value);
+        if(condition == "width")
+            rule.width = number;
+        else
+            rule.lanes = number;
+        return Error::success();
+    }
+
+    /// lay out the rules of each opcode and intrinsic contiguously, in file order
+    void compile(){
+        for(unsigned opcode = 0; opcode < opcode_rules.size(); opcode++)
+            definition->opcodes[opcode] = append(opcode_rules[opcode]);
+        definition->intrinsics.assign(Intrinsic::num_intrinsics, FeatureSetDefinition::Range());
+        for(auto &entry : intrinsic_rules)
+            definition->intrinsics[entry.first] = append(entry.second);
+    }
+
+    FeatureSetDefinition::Range append(const std::vector<Rule> &rules){
+        FeatureSetDefinition::Range range;
+        range.first = definition->rules.size();
+        range.known = !rules.empty();
+        for(const Rule &rule : rules){
+            if(rule.feature != Rule::ignore){
+                definition->rules.push_back(rule);
+                range.size++;
+            }
+        }
+        if(range.size == 1 && !definition->rules.back().conditional)
+            range.single = definition->rules.back().feature;
+        return range;
+    }
+
+    static const StringMap<unsigned> &opcodeNames(){
+        static const StringMap<unsigned> names = []{
+            StringMap<unsigned> opcode_names;
+            for(unsigned opcode = 1; opcode < Instruction::OtherOpsEnd; opcode++)
+                opcode_names[Instruction::getOpcodeName(opcode)] = opcode;
+            return opcode_names;
+        }();
+        return names;
+    }
+
+    StringRef source;
+    unsigned line = 0;
+    std::unique_ptr<FeatureSetDefinition> definition;
+    std::array<std::vector<Rule>, Instruction::OtherOpsEnd> opcode_rules;
+    std::map<Intrinsic::ID, std::vector<Rule>> intrinsic_rules;
+};
+
+} // end namespace celerity
+
+Expected<std::shared_ptr<const FeatureSetDefinition>> FeatureSetDefinition::parse(StringRef text, StringRef source){
+    return FeatureSetParser(source).parse(text);
+}
+
+Expected<std::shared_ptr<const FeatureSetDefinition>> FeatureSetDefinition::load(StringRef filename){
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(filename);
+    if(!buffer)
+        return createStringError(buffer.getError(), "cannot read %s: %s", filename.str().c_str(), buffer.getError().message().c_str());
+    return parse((*buffer)->getBuffer(), filename);
+}
+
+Expected<std::string> celerity::registerFeatureSetFile(StringRef filename){
+    Expected<std::shared_ptr<const FeatureSetDefinition>> definition = FeatureSetDefinition::load(filename);
+    if(!definition)
+        return definition.takeError();
+    std::shared_ptr<const FeatureSetDefinition> shared_definition = std::move(*definition);
+    FSRegistry::registerByKey(shared_definition->getName(), [shared_definition]() -> std::unique_ptr<FeatureSet> {
+        return std::make_unique<DeclarativeFeatureSet>(shared_definition);
+    });
+    return shared_definition->getName();
+}
+
+
+//-----------------------------------------------------------------------------
+// Evaluation
+//-----------------------------------------------------------------------------
+void DeclarativeFeatureSet::evalCall(CallInst &call, int contribution, bool matched){
+    Intrinsic::ID intrinsic_id = call.getIntrinsicID();
+    if(intrinsic_id != Intrinsic::not_intrinsic){
+        FeatureSetDefinition::Range range = definition->lookupIntrinsic(intrinsic_id);
+        countRules(range, call, contribution);
+        if(!range.known && !matched && definition->warnUnknown())
+            warnUnknown("intrinsic", Intrinsic::getName(intrinsic_id));
+        return;
+    }
+    const Function *callee = call.getCalledFunction();
+    if(!callee){
+        if(!matched && definition->warnUnknown())
+            warnUnknown("indirect call", "");
+        return;
+    }
+    // the rules matching a callee are matched once per callee
+    auto rules = callee_rules.find(callee);
+    if(rules == callee_rules.end()){
+        SmallVector<unsigned, 2> matching;
+        definition->matchCallee(classifyCallee(*callee), matching);
+        rules = callee_rules.insert(std::make_pair(callee, std::move(matching))).first;
+    }
+    for(unsigned rule_id : rules->second){
+        const Rule &rule = definition->getCalleeRule(rule_id);
+        if(rule.feature != Rule::ignore && (!rule.conditional || rule.matches(call)))
+            add(rule.feature, contribution);
+    }
+    if(rules->second.empty() && !matched && definition->warnUnknown())
+        warnUnknown("function", classifyCallee(*callee).name);
+}
+
+void DeclarativeFeatureSet::warnUnknown(StringRef kind, StringRef what){
+    CELERITY_LOG(featureset, warning) << "WARNING: " << name << ": " << kind << (what.empty() ? "" : " ") << what << " not recognized\n";
+}
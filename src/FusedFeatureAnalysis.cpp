@@ -0,0 +1,159 @@
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/Module.h>
+using namespace llvm;
+
+#include "FusedFeatureAnalysis.hpp"
+#include "CalleeClassification.hpp"
+#include "FeatureCache.hpp"
+#include "FeatureEmbedding.hpp"
+#include "Logging.hpp"
+using namespace celerity;
+
+llvm::AnalysisKey FusedFeatureAnalysis::Key;
+
+const ResultFeatureAnalysis *ResultFusedFeatureAnalysis::find(StringRef analysis, StringRef feature_set) const
+{
+  for (const ResultFeatureAnalysis &result : results)
+    if (result.analysis_name == analysis && result.feature_set_name == feature_set)
+      return &result;
+  return nullptr;
+}
+
+bool ResultFusedFeatureAnalysis::invalidate(llvm::Function &fun, const llvm::PreservedAnalyses &PA, llvm::FunctionAnalysisManager::Invalidator &inv)
+{
+  // as ResultFeatureAnalysis: only the preservation of all the analyses, or of this one, is safe
+  auto checker = PA.getChecker<FusedFeatureAnalysis>();
+  if (!checker.preserved())
+    return true;
+  if (loop_dependent)
+    return inv.invalidate<LoopAnalysis>(fun, PA) || inv.invalidate<ScalarEvolutionAnalysis>(fun, PA);
+  return false;
+}
+
+bool FusedFeatureAnalysis::isSupported(StringRef analysis)
+{
+  return analysis == "default" || analysis == "kofler13";
+}
+
+FusedFeatureAnalysis::FusedFeatureAnalysis(const std::vector<string> &feature_sets, const std::vector<string> &analyses)
+  : analysis_names(analyses)
+{
+  for (const string &analysis : analyses) {
+    assert(isSupported(analysis) && "analysis not supported by the fused extraction");
+    weightings.push_back(analysis == "kofler13" ? Weighting::kofler13 : Weighting::flat);
+    if (weightings.back() == Weighting::kofler13 && !kofler)
+      kofler = std::make_unique<Kofler13Analysis>();
+  }
+  for (const string &feature_set : feature_sets) {
+    block_counts.push_back(FSRegistry::dispatch(feature_set));
+    assert(block_counts.back() != nullptr);
+  }
+  for (size_t a = 0; a < analyses.size(); a++)
+    for (const string &feature_set : feature_sets)
+      features.push_back(FSRegistry::dispatch(feature_set));
+}
+
+void FusedFeatureAnalysis::addCanonicalizationPasses(llvm::FunctionPassManager &fpm) const
+{
+  if (kofler)
+    kofler->addCanonicalizationPasses(fpm);
+}
+
+ResultFusedFeatureAnalysis FusedFeatureAnalysis::getResult() const
+{
+  ResultFusedFeatureAnalysis result { {}, kofler != nullptr };
+  const size_t num_sets = block_counts.size();
+  for (size_t a = 0; a < analysis_names.size(); a++) {
+    for (size_t s = 0; s < num_sets; s++) {
+      FeatureSet &fs = *features[a * num_sets + s];
+      result.results.push_back(ResultFeatureAnalysis { &fs.getSchema(), fs.getFeatureCounts(), fs.getFeatureValues(), ID(),
+                                                       weightings[a] != Weighting::flat, fs.getName(), analysis_names[a] });
+    }
+  }
+  return result;
+}
+
+void FusedFeatureAnalysis::extract(llvm::Function &fun, llvm::FunctionAnalysisManager &fam)
+{
+  // block weights are computed once, before the traversal
+  if (kofler)
+    kofler->blockWeights(fun, fam, multiplier);
+
+  const size_t num_sets = block_counts.size();
+  for (llvm::BasicBlock &bb : fun) {
+    for (std::unique_ptr<FeatureSet> &counts : block_counts) {
+      counts->reset();
+      counts->eval(bb);
+    }
+    for (size_t a = 0; a < weightings.size(); a++) {
+      int weight = weightings[a] == Weighting::kofler13 ? multiplier[&bb] : 1;
+      for (size_t s = 0; s < num_sets; s++)
+        features[a * num_sets + s]->accumulate(*block_counts[s], weight);
+    }
+  }
+}
+
+ResultFusedFeatureAnalysis FusedFeatureAnalysis::run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam)
+{
+  CELERITY_LOG(analysis, info) << "function: " << fun.getName() << " fused analysis: " << features.size() << " feature sets\n";
+  for (std::unique_ptr<FeatureSet> &fs : features)
+    fs->reset();
+  if (fun.isDeclaration())
+    return getResult();
+
+  // unchanged functions are answered from the embedded features or from the cache if all the pairs are found there,
+  // the function is hashed once
+  FeatureCache *cache = FeatureCache::getGlobalCache();
+  std::vector<string> cache_keys;
+  const size_t num_sets = block_counts.size();
+  string function_hash;
+  if (FeatureEmbedding::hasEmbeddedFeatures(*fun.getParent())) {
+    function_hash = FeatureCache::hashFunction(fun);
+    bool embedded = true;
+    for (size_t i = 0; i < features.size() && embedded; i++)
+      embedded = FeatureEmbedding::lookup(fun, analysis_names[i / num_sets], *features[i], function_hash);
+    if (embedded)
+      return getResult();
+    for (std::unique_ptr<FeatureSet> &fs : features)
+      fs->reset();
+  }
+  if (cache) {
+    if (function_hash.empty())
+      function_hash = FeatureCache::hashFunction(fun);
+    bool cached = true;
+    for (size_t i = 0; i < features.size(); i++) {
+      cache_keys.push_back(FeatureCache::getKey(function_hash, features[i]->getCacheName(), analysis_names[i / num_sets]));
+      cached = cached && cache->lookup(cache_keys.back(), *features[i]);
+    }
+    if (cached)
+      return getResult();
+    for (std::unique_ptr<FeatureSet> &fs : features)
+      fs->reset();
+  }
+
+  // see FeatureAnalysis::run, callees are classified once per module if the classification is cached
+  auto &mam_proxy = fam.getResult<ModuleAnalysisManagerFunctionProxy>(fun);
+  CalleeClassification *callees = mam_proxy.getCachedResult<CalleeClassificationAnalysis>(*fun.getParent());
+  for (std::unique_ptr<FeatureSet> &counts : block_counts)
+    counts->setCalleeClassification(callees ? callees : &local_callees);
+  for (std::unique_ptr<FeatureSet> &fs : features)
+    fs->setCalleeClassification(callees ? callees : &local_callees);
+
+  extract(fun, fam);
+  for (std::unique_ptr<FeatureSet> &fs : features)
+    fs->normalize(fun);
+
+  for (std::unique_ptr<FeatureSet> &counts : block_counts)
+    counts->setCalleeClassification(nullptr);
+  for (size_t i = 0; i < features.size(); i++) {
+    features[i]->setCalleeClassification(nullptr);
+    if (cache)
+      cache->store(cache_keys[i], *features[i]);
+  }
+  return getResult();
+}
@@ -1,117 +1,127 @@
 #include <string>
-#include <iostream>
-#include <sstream>
+#include <vector>
+#include <limits>
+#include <cassert>
 using namespace std;
 
+#include <llvm/ADT/ArrayRef.h>
+using namespace llvm;
+
 #include "IMPoly.hpp"
-#include "KernelInvariant.hpp"
 using namespace celerity;
 
-
-void IMPoly::initContext(){   
-    //static bool first = true;
-    //static fmpz_mpoly_ctx_t static_ctx;
-    //ctx = static_ctx;
-    //if(first){
-    fmpz_mpoly_ctx_init(ctx, KernelInvariant::numInvariantType(), ordering_t::ORD_DEGLEX);
-    //    first = false;
-    //}    
-}
-
-
-IMPoly::IMPoly(){   
-    //cout << "IMPoly()" << endl;
-    initContext();
-    fmpz_mpoly_init(mpoly, ctx);
-    fmpz_mpoly_zero(mpoly, ctx);
-}
-
-IMPoly::IMPoly(unsigned coeff, unsigned invariant, unsigned exponent){
-    //cout << "IMPoly(invariant,value)" << endl;
-    initContext();
-    fmpz_mpoly_init(mpoly, ctx);    
-    stringstream pretty;
-    pretty << coeff << "*x" << invariant << "^" << exponent;
-    fmpz_mpoly_set_str_pretty(mpoly, pretty.str().c_str(), NULL, ctx);
-    //cout << pretty.str() << endl;
-}
-
-IMPoly::IMPoly(const IMPoly &copy){
-    //cout << "IMPoly(IMPoly) copy ctor" << endl;
-    initContext();
-    fmpz_mpoly_init(mpoly, ctx);  
-    fmpz_mpoly_set(mpoly, copy.mpoly, copy.ctx);
-}
-
-IMPoly::~IMPoly(){
-    //cout << "dtor" << endl;
-    //fmpz_mpoly_clear(mpoly, ctx);
-    //fmpz_mpoly_ctx_clear(ctx);
-}   
-
+//-----------------------------------------------------------------------------
+// Operations common to the polynomial backends (IMPolyFlint.cpp, IMPolyPacked.cpp)
+//-----------------------------------------------------------------------------
 IMPoly& IMPoly::operator += (const IMPoly &rhs){
-    fmpz_mpoly_add(mpoly, mpoly, rhs.mpoly, ctx);
+    add(rhs, false);
     return *this;    
 }
 
 IMPoly& IMPoly::operator -= (const IMPoly &rhs){
-    fmpz_mpoly_sub(mpoly, mpoly, rhs.mpoly, ctx);
+    add(rhs, true);
     return *this;    
 }
 
-IMPoly& IMPoly::operator *= (const IMPoly &rhs){
-    fmpz_mpoly_mul(mpoly, mpoly, rhs.mpoly, ctx);
-    return *this; 
+bool IMPoly::multiply_denominators(uint64_t lhs, uint64_t rhs, uint64_t &product){
+    return !__builtin_mul_overflow(lhs, rhs, &product) && product <= uint64_t(INT64_MAX);
 }
 
-IMPoly& IMPoly::operator = (const IMPoly &rhs){
-    //cout << "operator="<< endl;
-    if (this != &rhs) {
-        fmpz_mpoly_set(this->mpoly, rhs.mpoly, rhs.ctx);
+IMPoly& IMPoly::operator /= (long divisor){
+    assert(divisor != 0);
+    if(divisor < 0)
+        negate();
+    uint64_t magnitude = divisor < 0 ? -uint64_t(divisor) : uint64_t(divisor);
+    if(overflow || !multiply_denominators(den, magnitude, den)){
+        setOverflow();
+        return *this;
     }
+    reduce();
     return *this; 
 }
 
-
-void IMPoly::abs(){
-    //cout << "abs" << endl;
-    for(unsigned i=0; i<fmpz_mpoly_length(mpoly, ctx); i++){ // for each term
-        fmpz_t coef, abs_coef;
-        fmpz_mpoly_get_term_coeff_fmpz(coef, mpoly, i, ctx);
-        fmpz_abs(abs_coef, coef);
-        //cout << "  " << i << ") coef " << coef[0] << "=>" << abs_coef[0] << endl;
-        fmpz_mpoly_set_term_coeff_fmpz(mpoly, i, abs_coef, ctx);
+/// sum of x^k for x = 0, ..., n - 1
+static IMPoly power_sum(unsigned k, const IMPoly &n){
+    IMPoly n2 = n;
+    n2 *= n;
+    IMPoly sum = n2 - n;   // k = 1: (n^2 - n) / 2
+    switch(k){
+    case 0:
+        return n;
+    case 1:
+        sum /= 2;
+        return sum;
+    case 2: {              // (2n^3 - 3n^2 + n) / 6
+        sum = n2;
+        sum *= n;
+        sum *= 2L;
+        IMPoly three_n2 = n2;
+        three_n2 *= 3L;
+        sum -= three_n2;
+        sum += n;
+        sum /= 6;
+        return sum;
+    }
+    default:               // k = 3: (n^2 - n)^2 / 4
+        assert(k == 3);
+        sum *= sum;
+        sum /= 4;
+        return sum;
     }
 }
 
-void IMPoly::divide_by_two(){
-    //cout << "divide_by_two" << endl;
-    for(unsigned i=0; i<fmpz_mpoly_length(mpoly, ctx); i++){
-        ulong coef = fmpz_mpoly_get_term_coeff_ui(mpoly,i, ctx);
-        ulong res = coef / 2;        
-        //cout << "  " << i << ") coef " << coef << "=>" << res << endl;
-        fmpz_mpoly_set_term_coeff_ui(mpoly, i, res, ctx);
+IMPoly IMPoly::sum(unsigned invariant, const IMPoly &count) const{
+    IMPoly result;
+    if(overflow || count.overflow){
+        result.setOverflow();
+        return result;
     }
+    // sum_k coeff_k * x^k = sum_k coeff_k * power_sum(k)
+    std::vector<IMPoly> coeffs;
+    split(invariant, coeffs);
+    assert(coeffs.size() <= IMPOLY_MAX_DEGREE + 1);
+    for(unsigned k = 0; k < coeffs.size(); k++){
+        IMPoly &coeff = coeffs[k];
+        if(coeff.degree() < 0)
+            continue;
+        coeff *= power_sum(k, count);
+        result += coeff;
+    }
+    result /= long(den);
+    return result;
 }
 
 IMPoly IMPoly::max(const IMPoly &poly1, const IMPoly &poly2){
     // implementaiton not effiicnet, but avoid by term checks
-    // a+b+|a-b| / 2
-    IMPoly a_plus_b = poly1 + poly2;
-    //cout << "    a+b : " << a_plus_b << endl;
-    IMPoly a_minus_b = poly1 - poly2;
-    //cout << "    a-b : " << a_minus_b << endl;
+    // a+b+|a-b| / 2, computed in place on two polynomials, the halving is exact (denominator)
+    IMPoly result = poly1;
+    result += poly2;
+    IMPoly a_minus_b = poly1;
+    a_minus_b -= poly2;
     a_minus_b.abs();
-    //cout << "   |a-b|:"<< a_minus_b << endl;    
-    IMPoly result = a_plus_b + a_minus_b;
-    //cout << "    sum :"<< result << endl;
-    result.divide_by_two();
-    //cout << "    res :"<< result << endl;
+    result += a_minus_b;
+    result /= 2;
     return result;
 }
 
+double IMPoly::evaluate(const double values[]) const{
+    if(overflow)
+        return std::numeric_limits<double>::quiet_NaN();
+    double result = 0;
+    visitTerms([&](double coeff, ArrayRef<unsigned> exponents){
+        for(unsigned var = 0; var < exponents.size(); var++)
+            for(unsigned e = exponents[var]; e > 0; e--)
+                coeff *= values[var];
+        result += coeff;
+    });
+    return result / den;
+}
+
 std::string IMPoly::str() const{
-    std::string pretty = std::string(fmpz_mpoly_get_str_pretty(mpoly, InvariantTypeName, ctx));
+    if(overflow)
+        return "overflow";
+    std::string pretty = numerator_str();
+    if(den != 1)
+        pretty = "(" + pretty + ")/" + std::to_string(den);
     return pretty;
 }
-
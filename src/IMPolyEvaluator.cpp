@@ -0,0 +1,165 @@
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+using namespace std;
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+using namespace llvm;
+
+#include "IMPolyEvaluator.hpp"
+#include "PolFeatEncoding.hpp"
+using namespace celerity;
+
+namespace {
+/// Monomials of the plan by their exponents, a monomial is added after the monomial it is computed from
+struct MonomialTable {
+    std::map<std::vector<unsigned>, uint32_t> index;
+    std::vector<uint32_t> factors;
+    std::vector<uint32_t> invariants;
+
+    MonomialTable(){
+        index.emplace(std::vector<unsigned>(), 0);
+    }
+
+    uint32_t get(std::vector<unsigned> exponents){
+        // trailing zero exponents do not change the monomial
+        while(!exponents.empty() && exponents.back() == 0)
+            exponents.pop_back();
+        auto found = index.find(exponents);
+        if(found != index.end())
+            return found->second;
+        // the monomial is the monomial with one less power of its last invariant times that invariant
+        unsigned invariant = exponents.size() - 1;
+        std::vector<unsigned> factor_exponents = exponents;
+        factor_exponents[invariant]--;
+        uint32_t factor = get(factor_exponents);
+        factors.push_back(factor);
+        invariants.push_back(invariant);
+        return index.emplace(std::move(exponents), factors.size()).first->second;
+    }
+};
+}
+
+IMPolyEvaluator::IMPolyEvaluator(ArrayRef<IMPoly> polys){
+    build(polys.size(), [&](unsigned feature, TermVisitor visit){
+        double den = double(polys[feature].denominator());
+        polys[feature].visitTerms([&](double coeff, ArrayRef<unsigned> exponents){
+            visit(coeff / den, exponents);
+        });
+    });
+}
+
+IMPolyEvaluator::IMPolyEvaluator(const PolFeatView &features){
+    std::vector<unsigned> exponents(features.getNumVars());
+    build(features.getNumFeatures(), [&](unsigned feature, TermVisitor visit){
+        double den = double(features.getDenominator(feature));
+        ArrayRef<int64_t> coeffs = features.getCoefficients(feature);
+        ArrayRef<uint8_t> term_exponents = features.getExponents(feature);
+        for(unsigned t = 0; t < coeffs.size(); t++){
+            std::copy_n(term_exponents.begin() + t * exponents.size(), exponents.size(), exponents.begin());
+            visit(double(coeffs[t]) / den, exponents);
+        }
+    });
+}
+
+void IMPolyEvaluator::build(unsigned num_features, function_ref<void(unsigned, TermVisitor)> feature_terms){
+    MonomialTable table;
+    term_begin.push_back(0);
+    for(unsigned f = 0; f < num_features; f++){
+        feature_terms(f, [&](double coeff, ArrayRef<unsigned> exponents){
+            term_monomial.push_back(table.get(exponents.vec()));
+            term_coeff.push_back(coeff);
+        });
+        term_begin.push_back(term_monomial.size());
+    }
+    for(unsigned i = 0; i < table.factors.size(); i++)
+        steps.push_back({table.factors[i], table.invariants[i]});
+    scratch.resize(getNumMonomials());
+    batch_scratch.resize(getBatchScratchSize());
+}
+
+void IMPolyEvaluator::evaluate(const double values[], double features[], double monomials[]) const{
+    monomials[0] = 1;
+    for(unsigned i = 0; i < steps.size(); i++)
+        monomials[i + 1] = monomials[steps[i].factor] * values[steps[i].invariant];
+    for(unsigned f = 0; f + 1 < term_begin.size(); f++){
+        double feature = 0;
+        for(uint32_t t = term_begin[f]; t < term_begin[f + 1]; t++)
+            feature += term_coeff[t] * monomials[term_monomial[t]];
+        features[f] = feature;
+    }
+}
+
+void IMPolyEvaluator::evaluate(const double values[], double features[]){
+    evaluate(values, features, scratch.data());
+}
+
+void IMPolyEvaluator::evaluateBatch(const double *const values[], unsigned count, double *const features[],
+                                    double monomials[]) const{
+    // monomial m of the candidate c of the block is monomials[m * BatchBlock + c], the loops over the candidates
+    // have unit stride and no dependence between iterations
+    for(unsigned c = 0; c < BatchBlock; c++)
+        monomials[c] = 1;
+    for(unsigned begin = 0; begin < count; begin += BatchBlock){
+        unsigned n = std::min(BatchBlock, count - begin);
+        for(unsigned i = 0; i < steps.size(); i++){
+            double *__restrict monomial = monomials + (i + 1) * BatchBlock;
+            const double *__restrict factor = monomials + steps[i].factor * BatchBlock;
+            const double *__restrict value = values[steps[i].invariant] + begin;
+            for(unsigned c = 0; c < n; c++)
+                monomial[c] = factor[c] * value[c];
+        }
+        for(unsigned f = 0; f + 1 < term_begin.size(); f++){
+            double *__restrict feature = features[f] + begin;
+            for(unsigned c = 0; c < n; c++)
+                feature[c] = 0;
+            for(uint32_t t = term_begin[f]; t < term_begin[f + 1]; t++){
+                double coeff = term_coeff[t];
+                const double *__restrict monomial = monomials + term_monomial[t] * BatchBlock;
+                for(unsigned c = 0; c < n; c++)
+                    feature[c] += coeff * monomial[c];
+            }
+        }
+    }
+}
+
+void IMPolyEvaluator::evaluateBatch(const double *const values[], unsigned count, double *const features[]){
+    evaluateBatch(values, count, features, batch_scratch.data());
+}
+
+/// shortest literal that reads back as the same double
+static std::string double_literal(double value){
+    std::ostringstream literal;
+    literal.precision(17);
+    literal << value;
+    std::string text = literal.str();
+    if(text.find_first_of(".eEn") == std::string::npos)
+        text += ".0";
+    return text;
+}
+
+void IMPolyEvaluator::printCode(std::ostream &out, function_ref<std::string(unsigned)> value_name,
+                                StringRef features_name, StringRef indent) const{
+    for(unsigned i = 0; i < steps.size(); i++){
+        out << indent.str() << "const double m" << i + 1 << " = ";
+        if(steps[i].factor != 0)
+            out << "m" << steps[i].factor << " * ";
+        out << value_name(steps[i].invariant) << ";\n";
+    }
+    for(unsigned f = 0; f + 1 < term_begin.size(); f++){
+        out << indent.str() << features_name.str() << "[" << f << "] = ";
+        if(term_begin[f] == term_begin[f + 1])
+            out << "0.0";
+        for(uint32_t t = term_begin[f]; t < term_begin[f + 1]; t++){
+            if(t != term_begin[f])
+                out << " + ";
+            out << double_literal(term_coeff[t]);
+            if(term_monomial[t] != 0)
+                out << " * m" << term_monomial[t];
+        }
+        out << ";\n";
+    }
+}
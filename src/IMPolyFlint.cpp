@@ -0,0 +1,263 @@
+#include <string>
+#include <vector>
+#include <numeric>
+#include <cassert>
+using namespace std;
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+using namespace llvm;
+
+#include "IMPoly.hpp"
+#include "KernelInvariant.hpp"
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// FLINT backend: the numerator is a fmpz_mpoly with arbitrary precision coefficients
+//-----------------------------------------------------------------------------
+/// The polynomials share a single context: the variables are the invariants of KernelInvariant.
+/// The context is created on first use and never released, polynomials with static storage may outlive any other object.
+const fmpz_mpoly_ctx_struct *IMPoly::context(){
+    static const fmpz_mpoly_ctx_struct *shared = []{
+        fmpz_mpoly_ctx_struct *ctx = new fmpz_mpoly_ctx_struct;
+        fmpz_mpoly_ctx_init(ctx, KernelInvariant::numInvariantType(), ordering_t::ORD_DEGLEX);
+        return ctx;
+    }();
+    return shared;
+}
+
+
+IMPoly::IMPoly() : den(1){   
+    fmpz_mpoly_init(mpoly, context());
+}
+
+IMPoly::IMPoly(unsigned coeff, unsigned invariant, unsigned exponent) : den(1){
+    fmpz_mpoly_init(mpoly, context());
+    if(coeff == 0)
+        return;
+    // x_invariant is the variable invariant - 1, as for the names x1, x2, ... of the FLINT pretty strings
+    std::vector<ulong> exponents(KernelInvariant::numInvariantType(), 0);
+    exponents[invariant - 1] = exponent;
+    fmpz_mpoly_push_term_si_ui(mpoly, coeff, exponents.data(), context());
+}
+
+IMPoly::IMPoly(long constant) : den(1){
+    fmpz_mpoly_init(mpoly, context());
+    fmpz_mpoly_set_si(mpoly, constant, context());
+}
+
+IMPoly::IMPoly(const IMPoly &copy) : den(copy.den), overflow(copy.overflow){
+    fmpz_mpoly_init(mpoly, context());  
+    fmpz_mpoly_set(mpoly, copy.mpoly, context());
+}
+
+IMPoly::IMPoly(IMPoly &&other) noexcept : den(other.den), overflow(other.overflow){
+    // an initialized polynomial owns no memory until terms are added, the moved-from polynomial becomes zero
+    fmpz_mpoly_init(mpoly, context());
+    fmpz_mpoly_swap(mpoly, other.mpoly, context());
+    other.den = 1;
+    other.overflow = false;
+}
+
+IMPoly::~IMPoly(){
+    fmpz_mpoly_clear(mpoly, context());
+}   
+
+void IMPoly::setOverflow(){
+    fmpz_mpoly_zero(mpoly, context());
+    den = 1;
+    overflow = true;
+}
+
+/// divide the numerator and the denominator by their greatest common divisor
+void IMPoly::reduce(){
+    if(den == 1)
+        return;
+    fmpz_t content, denominator, common;
+    fmpz_init(content);
+    fmpz_init(denominator);
+    fmpz_init(common);
+    fmpz_mpoly_content(content, mpoly, context());
+    fmpz_set_si(denominator, den);
+    fmpz_gcd(common, content, denominator);
+    slong factor = fmpz_get_si(common);
+    if(factor > 1){
+        fmpz_mpoly_scalar_divexact_si(mpoly, mpoly, factor, context());
+        den /= factor;
+    }
+    fmpz_clear(content);
+    fmpz_clear(denominator);
+    fmpz_clear(common);
+}
+
+void IMPoly::add(const IMPoly &rhs, bool subtract){
+    // the coefficients have arbitrary precision, only the denominator may overflow
+    if(overflow || rhs.overflow){
+        setOverflow();
+        return;
+    }
+    if(den == rhs.den){
+        if(subtract) fmpz_mpoly_sub(mpoly, mpoly, rhs.mpoly, context());
+        else         fmpz_mpoly_add(mpoly, mpoly, rhs.mpoly, context());
+        reduce();
+        return;
+    }
+    // a/d1 + b/d2 = (a*(d2/g) + b*(d1/g)) / (d1*d2/g) with g = gcd(d1,d2)
+    uint64_t common = std::gcd(den, rhs.den);
+    uint64_t sum_den;
+    if(!multiply_denominators(den / common, rhs.den, sum_den)){
+        setOverflow();
+        return;
+    }
+    fmpz_mpoly_t scaled;
+    fmpz_mpoly_init(scaled, context());
+    fmpz_mpoly_scalar_mul_si(scaled, rhs.mpoly, den / common, context());
+    fmpz_mpoly_scalar_mul_si(mpoly, mpoly, rhs.den / common, context());
+    if(subtract) fmpz_mpoly_sub(mpoly, mpoly, scaled, context());
+    else         fmpz_mpoly_add(mpoly, mpoly, scaled, context());
+    fmpz_mpoly_clear(scaled, context());
+    den = sum_den;
+    reduce();
+}
+
+IMPoly& IMPoly::operator *= (const IMPoly &rhs){
+    uint64_t product_den;
+    if(overflow || rhs.overflow || !multiply_denominators(den, rhs.den, product_den)){
+        setOverflow();
+        return *this;
+    }
+    fmpz_mpoly_mul(mpoly, mpoly, rhs.mpoly, context());
+    den = product_den;
+    reduce();
+    return *this; 
+}
+
+IMPoly& IMPoly::operator *= (long scalar){
+    fmpz_mpoly_scalar_mul_si(mpoly, mpoly, scalar, context());
+    reduce();
+    return *this; 
+}
+
+void IMPoly::negate(){
+    fmpz_mpoly_neg(mpoly, mpoly, context());
+}
+
+IMPoly& IMPoly::operator = (const IMPoly &rhs){
+    if (this != &rhs) {
+        fmpz_mpoly_set(this->mpoly, rhs.mpoly, context());
+        den = rhs.den;
+        overflow = rhs.overflow;
+    }
+    return *this; 
+}
+
+IMPoly& IMPoly::operator = (IMPoly &&rhs) noexcept{
+    // the terms of this polynomial are released by rhs
+    fmpz_mpoly_swap(mpoly, rhs.mpoly, context());
+    std::swap(den, rhs.den);
+    std::swap(overflow, rhs.overflow);
+    return *this; 
+}
+
+
+void IMPoly::abs(){
+    //cout << "abs" << endl;
+    fmpz_t coef;
+    fmpz_init(coef);
+    for(slong i=0; i<fmpz_mpoly_length(mpoly, context()); i++){ // for each term
+        fmpz_mpoly_get_term_coeff_fmpz(coef, mpoly, i, context());
+        fmpz_abs(coef, coef);
+        fmpz_mpoly_set_term_coeff_fmpz(mpoly, i, coef, context());
+    }
+    fmpz_clear(coef);
+}
+
+bool IMPoly::isConstant() const{
+    return fmpz_mpoly_is_fmpz(mpoly, context());
+}
+
+long IMPoly::degree() const{
+    return fmpz_mpoly_total_degree_si(mpoly, context());
+}
+
+long IMPoly::degree(unsigned invariant) const{
+    return fmpz_mpoly_degree_si(mpoly, invariant - 1, context());
+}
+
+void IMPoly::split(unsigned invariant, std::vector<IMPoly> &coeffs) const{
+    unsigned var = invariant - 1;
+    std::vector<ulong> exponents(KernelInvariant::numInvariantType());
+    for(slong i = 0; i < fmpz_mpoly_length(mpoly, context()); i++){
+        fmpz_mpoly_get_term_exp_ui(exponents.data(), mpoly, i, context());
+        ulong k = exponents[var];
+        exponents[var] = 0;
+        if(coeffs.size() <= k)
+            coeffs.resize(k + 1);
+        fmpz_mpoly_push_term_si_ui(coeffs[k].mpoly, fmpz_mpoly_get_term_coeff_si(mpoly, i, context()), exponents.data(), context());
+    }
+    for(IMPoly &coeff : coeffs){
+        fmpz_mpoly_sort_terms(coeff.mpoly, context());
+        fmpz_mpoly_combine_like_terms(coeff.mpoly, context());
+    }
+}
+
+std::string IMPoly::numerator_str() const{
+    // FLINT does not modify the names, its parameter is not const
+    char *flint_pretty = fmpz_mpoly_get_str_pretty(mpoly, const_cast<const char **>(InvariantTypeName), context());
+    std::string pretty(flint_pretty);
+    flint_free(flint_pretty);
+    return pretty;
+}
+
+void IMPoly::visitTerms(function_ref<void(double, ArrayRef<unsigned>)> visit) const{
+    std::vector<ulong> exponents(KernelInvariant::numInvariantType());
+    std::vector<unsigned> term_exponents(exponents.size());
+    fmpz_t coef;
+    fmpz_init(coef);
+    for(slong i = 0; i < fmpz_mpoly_length(mpoly, context()); i++){
+        fmpz_mpoly_get_term_coeff_fmpz(coef, mpoly, i, context());
+        fmpz_mpoly_get_term_exp_ui(exponents.data(), mpoly, i, context());
+        std::copy(exponents.begin(), exponents.end(), term_exponents.begin());
+        visit(fmpz_get_d(coef), term_exponents);
+    }
+    fmpz_clear(coef);
+}
+
+bool IMPoly::visitIntegerTerms(function_ref<void(int64_t, ArrayRef<unsigned>)> visit) const{
+    std::vector<ulong> exponents(KernelInvariant::numInvariantType());
+    std::vector<unsigned> term_exponents(exponents.size());
+    fmpz_t coef;
+    fmpz_init(coef);
+    bool fits = true;
+    for(slong i = 0; i < fmpz_mpoly_length(mpoly, context()); i++){
+        fmpz_mpoly_get_term_coeff_fmpz(coef, mpoly, i, context());
+        fits = fmpz_fits_si(coef);
+        if(!fits)
+            break;
+        fmpz_mpoly_get_term_exp_ui(exponents.data(), mpoly, i, context());
+        std::copy(exponents.begin(), exponents.end(), term_exponents.begin());
+        visit(fmpz_get_si(coef), term_exponents);
+    }
+    fmpz_clear(coef);
+    return fits;
+}
+
+bool IMPoly::setTerms(ArrayRef<int64_t> coeffs, ArrayRef<uint8_t> exponents, unsigned num_vars, uint64_t denominator){
+    fmpz_mpoly_zero(mpoly, context());
+    den = 1;
+    overflow = false;
+    if(denominator == 0 || denominator > uint64_t(INT64_MAX) || num_vars > KernelInvariant::numInvariantType() || exponents.size() != coeffs.size() * num_vars)
+        return false;
+    std::vector<ulong> term_exponents(KernelInvariant::numInvariantType(), 0);
+    for(unsigned t = 0; t < coeffs.size(); t++){
+        for(unsigned var = 0; var < num_vars; var++)
+            term_exponents[var] = exponents[t * num_vars + var];
+        fmpz_mpoly_push_term_si_ui(mpoly, coeffs[t], term_exponents.data(), context());
+    }
+    // terms in the order of the context, repeated monomials combined and zero coefficients dropped
+    fmpz_mpoly_sort_terms(mpoly, context());
+    fmpz_mpoly_combine_like_terms(mpoly, context());
+    den = denominator;
+    reduce();
+    return true;
+}
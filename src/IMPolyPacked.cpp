@@ -0,0 +1,360 @@
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cassert>
+using namespace std;
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+using namespace llvm;
+
+#include "IMPoly.hpp"
+#include "KernelInvariant.hpp"
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// Packed backend: sparse terms with the exponents packed in a 128-bit key and int64 coefficients.
+// The polynomials of the feature extraction have a few terms of low degree over a few invariants: the terms fit in
+// the inline storage of the small vector and the arithmetic works on integer keys, without calls into a library.
+//-----------------------------------------------------------------------------
+static const unsigned exponent_bits = 4;
+static const unsigned exponent_mask = (1u << exponent_bits) - 1;
+static const unsigned num_vars = InvariantType::none + 1;
+static const unsigned degree_shift = num_vars * exponent_bits;
+/// total degree of a term: bounding it by the largest exponent keeps the exponents from carrying into each other
+/// when the keys of two terms are added (operator*=); the terms read by setTerms share the bound
+static const unsigned max_total_degree = exponent_mask;
+static_assert(degree_shift + 8 <= 128, "the exponents of the invariants do not fit in a packed monomial");
+
+/// bit position of the exponent of x_{var+1}, x1 comes first in the lexicographic order
+static unsigned exponent_shift(unsigned var){
+    return (num_vars - 1 - var) * exponent_bits;
+}
+
+static unsigned exponent(unsigned __int128 monomial, unsigned var){
+    return unsigned(monomial >> exponent_shift(var)) & exponent_mask;
+}
+
+static unsigned total_degree(unsigned __int128 monomial){
+    return unsigned(monomial >> degree_shift);
+}
+
+/// coefficient arithmetic, false on overflow: the polynomial is then flagged (setOverflow)
+static bool checked_add(int64_t a, int64_t b, int64_t &result){
+    return !__builtin_add_overflow(a, b, &result);
+}
+
+static bool checked_mul(int64_t a, int64_t b, int64_t &result){
+    return !__builtin_mul_overflow(a, b, &result);
+}
+
+/// |coeff|, exact for INT64_MIN
+static uint64_t magnitude(int64_t coeff){
+    return coeff < 0 ? -uint64_t(coeff) : uint64_t(coeff);
+}
+
+
+IMPoly::IMPoly() : den(1){
+}
+
+IMPoly::IMPoly(unsigned coeff, unsigned invariant, unsigned exponent) : den(1){
+    if(coeff == 0)
+        return;
+    if(exponent > exponent_mask){
+        setOverflow();
+        return;
+    }
+    // x_invariant is the variable invariant - 1, as for the FLINT backend
+    Monomial monomial = (Monomial(exponent) << degree_shift) | (Monomial(exponent) << exponent_shift(invariant - 1));
+    terms.push_back({monomial, int64_t(coeff)});
+}
+
+IMPoly::IMPoly(long constant) : den(1){
+    if(constant != 0)
+        terms.push_back({0, constant});
+}
+
+IMPoly::IMPoly(const IMPoly &copy) : terms(copy.terms), den(copy.den), overflow(copy.overflow){
+}
+
+IMPoly::IMPoly(IMPoly &&other) noexcept : terms(std::move(other.terms)), den(other.den), overflow(other.overflow){
+    other.terms.clear();
+    other.den = 1;
+    other.overflow = false;
+}
+
+IMPoly::~IMPoly(){
+}
+
+void IMPoly::setOverflow(){
+    terms.clear();
+    den = 1;
+    overflow = true;
+}
+
+/// divide the numerator and the denominator by their greatest common divisor
+void IMPoly::reduce(){
+    if(den == 1)
+        return;
+    uint64_t common = den;
+    for(const Term &term : terms)
+        common = std::gcd(common, magnitude(term.coeff));
+    if(common > 1){
+        // the magnitudes are divided, the quotient of INT64_MIN fits once common > 1
+        for(Term &term : terms){
+            int64_t quotient = int64_t(magnitude(term.coeff) / common);
+            term.coeff = term.coeff < 0 ? -quotient : quotient;
+        }
+        den /= common;
+    }
+}
+
+void IMPoly::add(const IMPoly &rhs, bool subtract){
+    // a/d1 + b/d2 = (a*(d2/g) + b*(d1/g)) / (d1*d2/g) with g = gcd(d1,d2)
+    uint64_t common = std::gcd(den, rhs.den);
+    int64_t lhs_factor = int64_t(rhs.den / common);
+    int64_t rhs_factor = int64_t(den / common);
+    if(subtract)
+        rhs_factor = -rhs_factor;
+    uint64_t sum_den;
+    if(overflow || rhs.overflow || !multiply_denominators(den / common, rhs.den, sum_den)){
+        setOverflow();
+        return;
+    }
+    // merge of the decreasing monomials, the result is built aside since rhs may be this polynomial
+    decltype(terms) merged;
+    unsigned i = 0, j = 0;
+    while(i < terms.size() || j < rhs.terms.size()){
+        Term term;
+        bool fits;
+        if(j == rhs.terms.size() || (i < terms.size() && terms[i].monomial > rhs.terms[j].monomial)){
+            term.monomial = terms[i].monomial;
+            fits = checked_mul(terms[i].coeff, lhs_factor, term.coeff);
+            i++;
+        }else if(i == terms.size() || rhs.terms[j].monomial > terms[i].monomial){
+            term.monomial = rhs.terms[j].monomial;
+            fits = checked_mul(rhs.terms[j].coeff, rhs_factor, term.coeff);
+            j++;
+        }else{
+            int64_t lhs_coeff, rhs_coeff;
+            term.monomial = terms[i].monomial;
+            fits = checked_mul(terms[i].coeff, lhs_factor, lhs_coeff) && checked_mul(rhs.terms[j].coeff, rhs_factor, rhs_coeff)
+                && checked_add(lhs_coeff, rhs_coeff, term.coeff);
+            i++;
+            j++;
+        }
+        if(!fits){
+            setOverflow();
+            return;
+        }
+        if(term.coeff != 0)
+            merged.push_back(term);
+    }
+    terms.swap(merged);
+    den = sum_den;
+    reduce();
+}
+
+void IMPoly::negate(){
+    for(Term &term : terms)
+        if(!checked_mul(term.coeff, -1, term.coeff)){
+            setOverflow();
+            return;
+        }
+}
+
+IMPoly& IMPoly::operator *= (const IMPoly &rhs){
+    uint64_t product_den;
+    if(overflow || rhs.overflow || !multiply_denominators(den, rhs.den, product_den)){
+        setOverflow();
+        return *this;
+    }
+    decltype(terms) product;
+    for(const Term &lhs_term : terms)
+        for(const Term &rhs_term : rhs.terms){
+            // adding the keys adds the exponents and the total degrees
+            Term term = {lhs_term.monomial + rhs_term.monomial, 0};
+            if(total_degree(lhs_term.monomial) + total_degree(rhs_term.monomial) > max_total_degree
+               || !checked_mul(lhs_term.coeff, rhs_term.coeff, term.coeff)){
+                setOverflow();
+                return *this;
+            }
+            product.push_back(term);
+        }
+    // sort and combine the like terms
+    std::sort(product.begin(), product.end(), [](const Term &a, const Term &b){ return a.monomial > b.monomial; });
+    terms.clear();
+    for(const Term &term : product){
+        if(!terms.empty() && terms.back().monomial == term.monomial){
+            if(!checked_add(terms.back().coeff, term.coeff, terms.back().coeff)){
+                setOverflow();
+                return *this;
+            }
+        }
+        else
+            terms.push_back(term);
+        if(terms.back().coeff == 0)
+            terms.pop_back();
+    }
+    den = product_den;
+    reduce();
+    return *this;
+}
+
+IMPoly& IMPoly::operator *= (long scalar){
+    if(scalar == 0)
+        terms.clear();
+    for(Term &term : terms)
+        if(!checked_mul(term.coeff, scalar, term.coeff)){
+            setOverflow();
+            return *this;
+        }
+    reduce();
+    return *this;
+}
+
+IMPoly& IMPoly::operator = (const IMPoly &rhs){
+    if (this != &rhs) {
+        terms = rhs.terms;
+        den = rhs.den;
+        overflow = rhs.overflow;
+    }
+    return *this;
+}
+
+IMPoly& IMPoly::operator = (IMPoly &&rhs) noexcept{
+    // the terms of this polynomial are released by rhs
+    terms.swap(rhs.terms);
+    std::swap(den, rhs.den);
+    std::swap(overflow, rhs.overflow);
+    return *this;
+}
+
+
+void IMPoly::abs(){
+    for(Term &term : terms)
+        if(term.coeff < 0 && !checked_mul(term.coeff, -1, term.coeff)){
+            setOverflow();
+            return;
+        }
+}
+
+bool IMPoly::isConstant() const{
+    return terms.empty() || (terms.size() == 1 && terms[0].monomial == 0);
+}
+
+long IMPoly::degree() const{
+    // the first monomial has the highest total degree
+    return terms.empty() ? -1 : total_degree(terms[0].monomial);
+}
+
+long IMPoly::degree(unsigned invariant) const{
+    long result = -1;
+    for(const Term &term : terms)
+        result = std::max(result, long(exponent(term.monomial, invariant - 1)));
+    return result;
+}
+
+void IMPoly::split(unsigned invariant, std::vector<IMPoly> &coeffs) const{
+    unsigned var = invariant - 1;
+    for(const Term &term : terms){
+        unsigned k = exponent(term.monomial, var);
+        if(coeffs.size() <= k)
+            coeffs.resize(k + 1);
+        Monomial rest = term.monomial - (Monomial(k) << degree_shift) - (Monomial(k) << exponent_shift(var));
+        coeffs[k].terms.push_back({rest, term.coeff});
+    }
+    // removing x_invariant keeps the monomials distinct but may change their order
+    for(IMPoly &coeff : coeffs)
+        std::stable_sort(coeff.terms.begin(), coeff.terms.end(), [](const Term &a, const Term &b){ return a.monomial > b.monomial; });
+}
+
+std::string IMPoly::numerator_str() const{
+    if(terms.empty())
+        return "0";
+    std::string pretty;
+    for(const Term &term : terms){
+        if(pretty.empty())
+            pretty = term.coeff < 0 ? "-" : "";
+        else
+            pretty += term.coeff < 0 ? " - " : " + ";
+        uint64_t coeff_magnitude = magnitude(term.coeff);
+        std::string vars;
+        for(unsigned var = 0; var < num_vars; var++){
+            unsigned e = exponent(term.monomial, var);
+            if(e == 0)
+                continue;
+            if(!vars.empty())
+                vars += "*";
+            vars += InvariantTypeName[var];
+            if(e > 1)
+                vars += "^" + std::to_string(e);
+        }
+        if(coeff_magnitude != 1 || vars.empty())
+            pretty += std::to_string(coeff_magnitude) + (vars.empty() ? "" : "*");
+        pretty += vars;
+    }
+    return pretty;
+}
+
+void IMPoly::visitTerms(function_ref<void(double, ArrayRef<unsigned>)> visit) const{
+    unsigned exponents[num_vars];
+    for(const Term &term : terms){
+        for(unsigned var = 0; var < num_vars; var++)
+            exponents[var] = exponent(term.monomial, var);
+        visit(double(term.coeff), exponents);
+    }
+}
+
+bool IMPoly::visitIntegerTerms(function_ref<void(int64_t, ArrayRef<unsigned>)> visit) const{
+    unsigned exponents[num_vars];
+    for(const Term &term : terms){
+        for(unsigned var = 0; var < num_vars; var++)
+            exponents[var] = exponent(term.monomial, var);
+        visit(term.coeff, exponents);
+    }
+    return true;
+}
+
+bool IMPoly::setTerms(ArrayRef<int64_t> coeffs, ArrayRef<uint8_t> exponents, unsigned vars, uint64_t denominator){
+    terms.clear();
+    den = 1;
+    overflow = false;
+    if(denominator == 0 || denominator > uint64_t(INT64_MAX) || vars > num_vars || exponents.size() != coeffs.size() * vars)
+        return false;
+    for(unsigned t = 0; t < coeffs.size(); t++){
+        Monomial monomial = 0;
+        unsigned degree = 0;
+        for(unsigned var = 0; var < vars; var++){
+            // the bound of the total degree also bounds each exponent
+            unsigned e = exponents[t * vars + var];
+            degree += e;
+            if(degree > max_total_degree){
+                terms.clear();
+                return false;
+            }
+            monomial |= Monomial(e) << exponent_shift(var);
+        }
+        terms.push_back({monomial | (Monomial(degree) << degree_shift), coeffs[t]});
+    }
+    // decreasing monomials, repeated monomials are combined and zero coefficients dropped
+    std::sort(terms.begin(), terms.end(), [](const Term &a, const Term &b){ return a.monomial > b.monomial; });
+    unsigned size = 0;
+    for(const Term &term : terms){
+        if(size > 0 && terms[size - 1].monomial == term.monomial){
+            if(!checked_add(terms[size - 1].coeff, term.coeff, terms[size - 1].coeff)){
+                terms.clear();
+                return false;
+            }
+        }
+        else
+            terms[size++] = term;
+        if(terms[size - 1].coeff == 0)
+            size--;
+    }
+    terms.resize(size);
+    den = denominator;
+    reduce();
+    return true;
+}
@@ -1,5 +1,3 @@
-#include <cxxabi.h> //for demangling
-
 #include <llvm/ADT/Optional.h>
 #include <llvm/IR/Argument.h>
 #include <llvm/IR/Function.h>
@@ -8,13 +6,29 @@
 using namespace llvm;
 
 #include "KernelInvariant.hpp"
-#include "FeatureSet.hpp" // for demangling utility
+#include "CalleeClassification.hpp"
+#include "Logging.hpp"
 using namespace celerity;
 
-KernelInvariant::KernelInvariant(llvm::Function &fun) : function(&fun)
+/// Dimension of a work-item builtin call: encoded in the name (SPIR-V builtins of SYCL)
+/// or given by a constant first argument (OpenCL builtins), -1 if not recognized
+static int get_builtin_dimension(const llvm::CallInst &call, const CalleeInfo &info)
+{
+    if (info.dimension >= 0)
+        return info.dimension;
+    if (call.arg_size() != 1)
+        return -1;
+    // we expect something like "get_global_size(0)"
+    if (llvm::ConstantInt *int_op = dyn_cast<llvm::ConstantInt>(call.getArgOperand(0)))
+        return int_op->getBitWidth() <= 32 ? int_op->getSExtValue() : -1;
+    CELERITY_LOG(invariant, warning) << "  warning: operand for " << info.name << " not recognized\n";
+    return -1;
+}
+
+KernelInvariant::KernelInvariant(llvm::Function &fun, CalleeClassification *callees) : function(&fun)
 {
     // 1. check the arguments
-    for (unsigned i = 0; i < fun.arg_size(); i++)
+    for (unsigned i = 0; i < fun.arg_size() && i <= InvariantType::a9; i++)
     {
         llvm::Argument *arg = fun.getArg(i);
         // if we have a pointer, it cannot be used for loop bound analysis, thus we skip it
@@ -29,98 +43,43 @@ KernelInvariant::KernelInvariant(llvm::Function &fun) : function(&fun)
     {
         for (Instruction &inst : bb)
         {
-            Instruction *inst_ptr = &inst;
-            if (auto *ci = llvm::dyn_cast<llvm::CallInst>(&inst))
-            { // we assume direct call here
-                // handling a function call
-                std::string fnd = get_demangled_name(*ci);
-                // outs() << " operands num "<< ci->getNumOperands() << "\n";
-                if (ci->getNumOperands() == 2)
-                { // ret + first in op
-                    Value *operand = ci->getOperand(0);
-                    if (fnd.rfind("get_global_size", 0) == 0)
-                    { // we expect something like "get_global_size(0)
-                        if (llvm::ConstantInt *int_op = dyn_cast<llvm::ConstantInt>(operand))
-                        {
-                            if (int_op->getBitWidth() <= 32)
-                            {
-                                int dim = int_op->getSExtValue();
-                                switch (dim)
-                                {
-                                case 0:
-                                    invariants[InvariantType::gs0] = inst_ptr;
-                                    break;
-                                case 1:
-                                    invariants[InvariantType::gs1] = inst_ptr;
-                                    break;
-                                case 2:
-                                    invariants[InvariantType::gs2] = inst_ptr;
-                                    break;
-                                }
-                            }
-                        }
-                        else
-                            errs() << "  warning: operand for get_global_size not recognized\n";
-                    } // get_global_size
-                    if (fnd.rfind("get_local_size", 0) == 0)
-                    { // we expect something like "get_local_size(0)
-                        if (llvm::ConstantInt *int_op = dyn_cast<llvm::ConstantInt>(operand))
-                        {
-                            if (int_op->getBitWidth() <= 32)
-                            {
-                                int dim = int_op->getSExtValue();
-                                switch (dim)
-                                {
-                                case 0:
-                                    invariants[InvariantType::ls0] = inst_ptr;
-                                    break;
-                                case 1:
-                                    invariants[InvariantType::ls1] = inst_ptr;
-                                    break;
-                                case 2:
-                                    invariants[InvariantType::ls2] = inst_ptr;
-                                    break;
-                                }
-                            }
-                        }
-                        else
-                            errs() << "  warning: operand for get_local_size not recognized\n";
-                    } // get_local_size
-                    if (fnd.rfind("get_num_groups", 0) == 0)
-                    { // we expect something like "get_global_size(0)
-                        if (llvm::ConstantInt *int_op = dyn_cast<llvm::ConstantInt>(operand))
-                        {
-                            if (int_op->getBitWidth() <= 32)
-                            {
-                                int dim = int_op->getSExtValue();
-                                switch (dim)
-                                {
-                                case 0:
-                                    invariants[InvariantType::ng0] = inst_ptr;
-                                    break;
-                                case 1:
-                                    invariants[InvariantType::ng1] = inst_ptr;
-                                    break;
-                                case 2:
-                                    invariants[InvariantType::ng2] = inst_ptr;
-                                    break;
-                                }
-                            }
-                        }
-                        else
-                            errs() << "  warning: operand for get_num_groups not recognized\n";
-                    } // get_num_groups
-                }
-
-                if (ci->getNumOperands() == 1)
-                {
-                    if (fnd.rfind("get_num_sub_groups", 0) == 0)
-                        invariants[InvariantType::nsg] = inst_ptr;
-                    if (fnd.rfind("get_sub_group_size", 0) == 0)
-                        invariants[InvariantType::sgs] = inst_ptr;
-                    if (fnd.rfind("get_max_sub_group_size", 0) == 0)
-                        invariants[InvariantType::msgs] = inst_ptr;
-                }
+            auto *ci = llvm::dyn_cast<llvm::CallInst>(&inst);
+            if (!ci || !ci->getCalledFunction())
+                continue; // we assume direct call here
+            // the callee is classified once per module if the classification is given
+            CalleeInfo computed;
+            const CalleeInfo &info = callees ? callees->classify(*ci->getCalledFunction())
+                                             : (computed = CalleeClassification::compute(*ci->getCalledFunction()));
+            // first invariant of the builtins with a dimension, e.g. gs0 for get_global_size
+            InvariantType first = InvariantType::none;
+            switch (info.builtin)
+            {
+            case BuiltinKind::global_size:
+                first = InvariantType::gs0;
+                break;
+            case BuiltinKind::local_size:
+                first = InvariantType::ls0;
+                break;
+            case BuiltinKind::num_groups:
+                first = InvariantType::ng0;
+                break;
+            case BuiltinKind::num_sub_groups:
+                invariants[InvariantType::nsg] = &inst;
+                break;
+            case BuiltinKind::sub_group_size:
+                invariants[InvariantType::sgs] = &inst;
+                break;
+            case BuiltinKind::max_sub_group_size:
+                invariants[InvariantType::msgs] = &inst;
+                break;
+            default:
+                break;
+            }
+            if (first != InvariantType::none)
+            {
+                int dim = get_builtin_dimension(*ci, info);
+                if (dim >= 0 && dim <= 2)
+                    invariants[InvariantType(first + dim)] = &inst;
             }
         }
     }
@@ -1,4 +1,5 @@
 #include <unordered_map>
+#include <map>
 
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/ScalarEvolution.h>
@@ -14,41 +15,48 @@ using namespace llvm;
 #include "Kofler13Analysis.hpp"
 #include "FeaturePrinter.hpp"
 #include "FeatureNormalization.hpp"
+#include "Logging.hpp"
 using namespace celerity;
 
 llvm::AnalysisKey Kofler13Analysis::Key;
 
+//-----------------------------------------------------------------------------
+// Register the Kofler13 analysis in the FeatureAnalysis registry
+//-----------------------------------------------------------------------------
+static bool _registered_kofler13_analysis_ = FARegistry::registerType<Kofler13Analysis>("kofler13");
+
 /// Feature extraction based on Kofler et al. 13 loop heuristics
 void Kofler13Analysis::extract(llvm::Function &fun, llvm::FunctionAnalysisManager &FAM)
+{
+    std::unordered_map<const llvm::BasicBlock *, unsigned> multiplier;
+    blockWeights(fun, FAM, multiplier);
+    // 4. Final evaluation
+    for (llvm::BasicBlock &bb : fun) {
+        int mult = multiplier[&bb];
+        //outs() << "BB mult: " << mult << "\n";
+        features->eval(bb, mult);
+    }
+}
+
+void Kofler13Analysis::blockWeights(llvm::Function &fun, llvm::FunctionAnalysisManager &FAM,
+                                    std::unordered_map<const llvm::BasicBlock *, unsigned> &multiplier)
 {
     ScalarEvolution       &SE = FAM.getResult<ScalarEvolutionAnalysis>(fun);
     LoopInfo              &LI = FAM.getResult<LoopAnalysis>(fun);
     DominatorTree         &DT = FAM.getResult<DominatorTreeAnalysis>(fun);
-    AssumptionCache       &AC = FAM.getResult<AssumptionAnalysis>(fun);
-   
-    LoopAnalysisManager *LAM = nullptr;
-    if (auto *LAMProxy = FAM.getCachedResult<LoopAnalysisManagerFunctionProxy>(fun))
-        LAM = &LAMProxy->getManager();  
-    auto &MAMProxy = FAM.getResult<ModuleAnalysisManagerFunctionProxy>(fun);
-    bool changed = false;
-    for (auto &loop : LI) {
-        changed |= simplifyLoop(loop, &DT, &LI, &SE, &AC, nullptr, false);
-        changed |= formLCSSARecursively(*loop, DT, &LI, &SE);
-    }
-   outs() << " loop in LCSSA form (loop has changed:" << changed << ")\n";
 
     // loop checks
     for (Loop *loop : LI.getLoopsInPreorder()) {
-        if (!loop->isLoopSimplifyForm()) errs() << " WARNING Loop is not in normal form\n";
-        //if (!loop->isCanonical(SE)) errs() << " WARNING Loop is not canonical\n";
-        if (!loop->isLCSSAForm(DT)) errs() << " WARNING Loop is not in LCSSA form\n";
+        if (!loop->isLoopSimplifyForm()) CELERITY_LOG(loops, warning) << " WARNING Loop is not in normal form\n";
+        //if (!loop->isCanonical(SE)) CELERITY_LOG(loops, warning) << " WARNING Loop is not canonical\n";
+        if (!loop->isLCSSAForm(DT)) CELERITY_LOG(loops, warning) << " WARNING Loop is not in LCSSA form\n";
         //else                        errs() << " Loop is in LCSSA form\n";
         BasicBlock *Latch = loop->getLoopLatch();
-        if (loop->getExitingBlock() != Latch)  errs() << " WARNING Loop: Exiting and latch block are different\n";
+        if (loop->getExitingBlock() != Latch)  CELERITY_LOG(loops, warning) << " WARNING Loop: Exiting and latch block are different\n";
     }
 
     // 1. For each BB, we initialize it's "loop multiplier" to 1
-    std::unordered_map<const llvm::BasicBlock *, unsigned> multiplier;
+    multiplier.clear();
     for (const BasicBlock &bb : fun.getBasicBlockList()) {
         multiplier[&bb] = 1.0f;
     }
@@ -63,27 +71,19 @@ void Kofler13Analysis::extract(llvm::Function &fun, llvm::FunctionAnalysisManage
             multiplier[bb] *= loop_cost[loop];
         }
     } 
-    // 4. Final evaluation
-    for (llvm::BasicBlock &bb : fun) {
-        int mult = multiplier[&bb];
-        //outs() << "BB mult: " << mult << "\n";
-        for (Instruction &i : bb) {
-            features->eval(i, mult);
-        }
-    }
 }
 
-int Kofler13Analysis::loopContribution(const Loop &loop, LoopInfo &LI, ScalarEvolution &SE) {
+int Kofler13Analysis::loopContribution(const Loop &loop, LoopInfo &, ScalarEvolution &SE) {
     // print loop info
     PHINode *ind_var = loop.getInductionVariable(SE);
     if(ind_var == nullptr){
-        outs() << "  WARNING: induction variable not found, counting default loop contribution\n";
+        CELERITY_LOG(loops, warning) << "  WARNING: induction variable not found, counting default loop contribution\n";
         return default_loop_contribution;
     }
 
     Optional<Loop::LoopBounds> bounds = Loop::LoopBounds::getBounds(loop, *ind_var, SE);
     if (!bounds) {
-        outs() << "  WARNING: loop bound not found, counting default loop contribution\n";
+        CELERITY_LOG(loops, warning) << "  WARNING: loop bound not found, counting default loop contribution\n";
         return default_loop_contribution;
     }
 
@@ -93,11 +93,11 @@ int Kofler13Analysis::loopContribution(const Loop &loop, LoopInfo &LI, ScalarEvo
     if (ConstantInt *ci = dyn_cast<ConstantInt>(&final)) {
         if (ci->getBitWidth() <= 32) {
             int int_val = ci->getSExtValue();
-            outs() << "  CONST loop size is " << int_val << "\n";
+            CELERITY_LOG(loops, debug) << "  CONST loop size is " << int_val << "\n";
             return int_val;
         }
     }
     // case 2: uv is not a constant, then we use the default loop contribution
-    outs() << "  Not finding a constant int for finalIVValue, counting default loop contribution\n";
+    CELERITY_LOG(loops, debug) << "  Not finding a constant int for finalIVValue, counting default loop contribution\n";
     return default_loop_contribution;
 }
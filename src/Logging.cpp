@@ -0,0 +1,56 @@
+#include <string>
+using namespace std;
+
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/Support/CommandLine.h>
+using namespace llvm;
+
+#include "Logging.hpp"
+using namespace celerity;
+
+static const char *log_component_names[] = { "analysis", "featureset", "invariant", "memaccess", "loops", "cache" };
+
+void celerity::set_log_level(LogLevel level){
+    for(uint8_t &component_level : log_levels)
+        component_level = (uint8_t)level;
+}
+
+bool celerity::set_log_level(StringRef component, LogLevel level){
+    for(unsigned c = 0; c < (unsigned)LogComponent::num_components; c++){
+        if(component == log_component_names[c]){
+            log_levels[c] = (uint8_t)level;
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Command line options, shared by the plugin and the standalone tool.
+// Options are applied in command line order, later ones override earlier ones.
+//-----------------------------------------------------------------------------
+static cl::opt<LogLevel> LogLevelOpt("log-level", cl::desc("Log level of all the components (default: warning)"),
+    cl::values(
+        clEnumValN(LogLevel::none,    "none",    "No messages"),
+        clEnumValN(LogLevel::error,   "error",   "Errors only"),
+        clEnumValN(LogLevel::warning, "warning", "Errors and warnings"),
+        clEnumValN(LogLevel::info,    "info",    "Progress messages, e.g., the analyzed functions"),
+        clEnumValN(LogLevel::debug,   "debug",   "Analysis internals, e.g., invariants and loop bounds")),
+    cl::init(LogLevel::warning),
+    cl::callback([](const LogLevel &level){ set_log_level(level); }));
+
+static cl::list<string> LogComponentOpt("log", cl::CommaSeparated, cl::value_desc("component=level"),
+    cl::desc("Log level of a component (analysis, featureset, invariant, memaccess, loops, cache), e.g. -log=loops=debug"),
+    cl::callback([](const string &setting){
+        StringRef component, level_name;
+        std::tie(component, level_name) = StringRef(setting).split('=');
+        int level = StringSwitch<int>(level_name)
+            .Case("none",    (int)LogLevel::none)
+            .Case("error",   (int)LogLevel::error)
+            .Case("warning", (int)LogLevel::warning)
+            .Case("info",    (int)LogLevel::info)
+            .Case("debug",   (int)LogLevel::debug)
+            .Default(-1);
+        if(level < 0 || !set_log_level(component, (LogLevel)level))
+            errs() << "WARNING: ignoring log setting " << setting << "\n";
+    }));
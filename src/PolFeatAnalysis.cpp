@@ -1,44 +1,331 @@
+#include <map>
+#include <cstring>
+
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IR/Dominators.h>
 #include <llvm/Pass.h>
 #include <llvm/Passes/PassBuilder.h>
-#include <llvm/Passes/PassPlugin.h>
-#include <llvm/Transforms/IPO/PassManagerBuilder.h>
-#include <llvm/Transforms/Utils/LoopSimplify.h>
 using namespace llvm;
 
 #include "KernelInvariant.hpp"
 #include "PolFeatAnalysis.hpp"
+#include "PolFeatEncoding.hpp"
+#include "FeatureEmbedding.hpp"
+#include "FeatureCache.hpp"
+#include "Logging.hpp"
 using namespace celerity;
 
 llvm::AnalysisKey PolFeatAnalysis::Key;
 
+//-----------------------------------------------------------------------------
+// Polynomial feature set
+//-----------------------------------------------------------------------------
+void PolFeatSet::eval(llvm::Instruction &inst, const IMPoly &contribution)
+{
+    scalar->reset();
+    scalar->eval(inst);
+    accumulate(contribution);
+}
+
+void PolFeatSet::eval(llvm::BasicBlock &bb, const IMPoly &contribution)
+{
+    scalar->reset();
+    scalar->eval(bb);
+    accumulate(contribution);
+}
+
+void PolFeatSet::accumulate(const IMPoly &contribution)
+{
+    const std::vector<unsigned> &counts = scalar->getFeatureCounts();
+    IMPoly term; // reused, the assignment keeps its terms allocated
+    for (unsigned i = 0; i < counts.size(); i++) {
+        if (counts[i] == 0)
+            continue;
+        term = contribution;
+        term *= long(counts[i]);
+        raw[i] += term;
+    }
+    instruction_num += scalar->instruction_num;
+}
+
+
+//-----------------------------------------------------------------------------
+// Polynomial feature analysis
+//-----------------------------------------------------------------------------
+bool ResultPolFeatSet::invalidate(llvm::Function &fun, const llvm::PreservedAnalyses &PA, llvm::FunctionAnalysisManager::Invalidator &inv)
+{
+    // as ResultFeatureAnalysis: only the preservation of all the analyses, or of this one, is safe
+    auto checker = PA.getChecker<PolFeatAnalysis>();
+    if (!checker.preserved())
+        return true;
+    return inv.invalidate<LoopAnalysis>(fun, PA) || inv.invalidate<ScalarEvolutionAnalysis>(fun, PA);
+}
+
+
+/// Polynomial variable of the iteration counter of a loop, none for loops nested too deep
+static InvariantType loop_counter(const Loop &loop)
+{
+    unsigned depth = loop.getLoopDepth();
+    if (depth > InvariantType::it2 - InvariantType::it0 + 1)
+        return InvariantType::none;
+    return InvariantType(InvariantType::it0 + depth - 1);
+}
+
+static bool depends_on_counters(const IMPoly &poly)
+{
+    for (unsigned counter = InvariantType::it0; counter <= InvariantType::it2; counter++)
+        if (poly.degree(KernelInvariant::enumerate(InvariantType(counter))) > 0)
+            return true;
+    return false;
+}
+
+/// Polynomial of a SCEV expression in a loop over the kernel invariants and the iteration counters of the
+/// enclosing loops, None if the expression is not such a polynomial (e.g., it depends on a loaded value, on a
+/// non-affine induction variable, or it divides).
+static Optional<IMPoly> invariant_polynomial(const SCEV *expr, const Loop &loop, KernelInvariant &invariants, ScalarEvolution &SE)
+{
+    if (const SCEVConstant *constant = dyn_cast<SCEVConstant>(expr)) {
+        const APInt &value = constant->getAPInt();
+        if (value.getMinSignedBits() > 64)
+            return None;
+        return IMPoly(long(value.getSExtValue()));
+    }
+    if (const SCEVUnknown *unknown = dyn_cast<SCEVUnknown>(expr)) {
+        InvariantType invariant = invariants.isInvariant(unknown->getValue());
+        if (invariant == InvariantType::none)
+            return None;
+        return IMPoly(1, KernelInvariant::enumerate(invariant));
+    }
+    // affine induction variable of an enclosing loop: start + step * counter
+    if (const SCEVAddRecExpr *rec = dyn_cast<SCEVAddRecExpr>(expr)) {
+        const Loop *outer = rec->getLoop();
+        if (!rec->isAffine() || outer == &loop || !outer->contains(&loop) || loop_counter(*outer) == InvariantType::none)
+            return None;
+        Optional<IMPoly> start = invariant_polynomial(rec->getStart(), loop, invariants, SE);
+        Optional<IMPoly> step = invariant_polynomial(rec->getStepRecurrence(SE), loop, invariants, SE);
+        if (!start || !step)
+            return None;
+        *step *= IMPoly(1, KernelInvariant::enumerate(loop_counter(*outer)));
+        *start += *step;
+        return start;
+    }
+    // integer casts (e.g., the i32 kernel arguments extended to the i64 induction variable) keep the value,
+    // we assume the invariants in the range of both types
+    if (const SCEVCastExpr *cast_expr = dyn_cast<SCEVCastExpr>(expr))
+        return invariant_polynomial(cast_expr->getOperand(), loop, invariants, SE);
+    if (isa<SCEVAddExpr>(expr) || isa<SCEVMulExpr>(expr)) {
+        Optional<IMPoly> result;
+        for (const SCEV *operand : cast<SCEVNAryExpr>(expr)->operands()) {
+            Optional<IMPoly> poly = invariant_polynomial(operand, loop, invariants, SE);
+            if (!poly)
+                return None;
+            if (!result)
+                result = poly;
+            else if (isa<SCEVAddExpr>(expr))
+                *result += *poly;
+            else
+                *result *= *poly;
+        }
+        return result;
+    }
+    // min and max, e.g. smax(1, n) of loops that are not guarded or smax(i + 1, n) of loops starting from the
+    // counter of an enclosing loop. The invariants are sizes: we assume the constants smaller than the expressions
+    // of the counters, which are smaller than the invariant bounds of their loops.
+    if (const SCEVMinMaxExpr *minmax = dyn_cast<SCEVMinMaxExpr>(expr)) {
+        auto rank = [](const IMPoly &poly) { return poly.isConstant() ? 0 : depends_on_counters(poly) ? 1 : 2; };
+        bool is_max = isa<SCEVSMaxExpr>(expr) || isa<SCEVUMaxExpr>(expr);
+        SmallVector<IMPoly, 2> selected; // operands of the largest (max) or smallest (min) rank
+        int selected_rank = -1;
+        for (const SCEV *operand : minmax->operands()) {
+            Optional<IMPoly> poly = invariant_polynomial(operand, loop, invariants, SE);
+            if (!poly)
+                return None;
+            int poly_rank = rank(*poly);
+            if (selected_rank < 0 || (is_max ? poly_rank > selected_rank : poly_rank < selected_rank)) {
+                selected.clear();
+                selected_rank = poly_rank;
+            }
+            if (poly_rank == selected_rank)
+                selected.push_back(*poly);
+        }
+        if (selected.size() > 1 && !is_max)
+            return None;
+        IMPoly result = selected[0];
+        for (unsigned i = 1; i < selected.size(); i++)
+            result = IMPoly::max(result, selected[i]);
+        return result;
+    }
+    return None;
+}
 
 ResultPolFeatSet PolFeatAnalysis::run(llvm::Function &fun, llvm::FunctionAnalysisManager &fam)
 {
-    /// XXX
-    
-    return ResultPolFeatSet { features->getFeatureCounts(), features->getFeatureValues() };
+    CELERITY_LOG(analysis, info) << "function: " << fun.getName() << " feature-set: " << features->getName()
+                                 << " analysis-name: " << getName() << "\n";
+    features->reset();
+    // features embedded into the module when it was compiled, if the function did not change since
+    bool embedded = !fun.isDeclaration() && FeatureEmbedding::hasEmbeddedFeatures(*fun.getParent()) && lookupEmbedded(fun);
+    // unchanged functions are answered from the cache, if enabled, as for the scalar analyses
+    FeatureCache *cache = fun.isDeclaration() || embedded ? nullptr : FeatureCache::getGlobalCache();
+    string cache_key;
+    bool cached = false;
+    if (cache) {
+        cache_key = FeatureCache::getKey(fun, features->getScalarFeatureSet().getCacheName(), getName());
+        std::unique_ptr<MemoryBuffer> block;
+        if (cache->lookup(cache_key, block)) {
+            cached = readFeatures(fun, block->getBuffer(), "cached");
+            if (!cached)
+                cache->reportCorrupted();
+        }
+    }
+    if (!fun.isDeclaration() && !embedded && !cached) {
+        // callees are classified once per module if the classification is cached, as in FeatureAnalysis
+        auto &mam_proxy = fam.getResult<ModuleAnalysisManagerFunctionProxy>(fun);
+        CalleeClassification *callees = mam_proxy.getCachedResult<CalleeClassificationAnalysis>(*fun.getParent());
+        FeatureSet &scalar = features->getScalarFeatureSet();
+        scalar.setCalleeClassification(callees ? callees : &local_callees);
+        extract(fun, fam);
+        features->normalize(fun);
+        scalar.setCalleeClassification(nullptr);
+        if (cache) {
+            std::vector<char> block;
+            if (Error err = encodePolFeatures(features->getName(), features->getSchema(), features->getFeatureCounts(),
+                                              features->getFeatureValues(), block))
+                CELERITY_LOG(cache, warning) << "WARNING: features of " << fun.getName() << " not cached: " << toString(std::move(err)) << "\n";
+            else
+                cache->store(cache_key, block);
+        }
+    }
+    return ResultPolFeatSet { &features->getSchema(), features->getFeatureCounts(), features->getFeatureValues(), features->getName() };
+}
+
+bool PolFeatAnalysis::lookupEmbedded(llvm::Function &fun)
+{
+    FeatureEmbedding::Entry entry;
+    if (!FeatureEmbedding::lookup(fun, features->getScalarFeatureSet().getCacheName(), getName(), entry))
+        return false;
+    // the block is read in place, metadata strings are not aligned
+    std::vector<uint64_t> block((entry.polynomials.size() + 7) / 8);
+    memcpy(block.data(), entry.polynomials.data(), entry.polynomials.size());
+    return readFeatures(fun, StringRef(reinterpret_cast<const char*>(block.data()), entry.polynomials.size()), "embedded");
+}
+
+bool PolFeatAnalysis::readFeatures(llvm::Function &fun, StringRef block, const char *source)
+{
+    Expected<PolFeatView> view = PolFeatView::read(block);
+    if (!view) {
+        CELERITY_LOG(cache, warning) << "WARNING: " << source << " features of " << fun.getName() << ": " << toString(view.takeError()) << "\n";
+        return false;
+    }
+    const FeatureSchema &schema = features->getSchema();
+    bool matching = view->getNumFeatures() == schema.size();
+    for (unsigned f = 0; matching && f < schema.size(); f++)
+        matching = view->getFeatureName(f) == schema.getName(f);
+    if (!matching) {
+        CELERITY_LOG(cache, warning) << "WARNING: " << source << " features of " << fun.getName() << " do not match the schema of "
+                                     << features->getName() << "\n";
+        return false;
+    }
+    for (unsigned f = 0; f < schema.size(); f++) {
+        Expected<IMPoly> counter = view->getPolynomial(f);
+        if (!counter) {
+            CELERITY_LOG(cache, warning) << "WARNING: " << source << " features of " << fun.getName() << ": " << toString(counter.takeError()) << "\n";
+            features->reset();
+            return false;
+        }
+        features->set(f, std::move(*counter), view->getFeatValues()[f]);
+    }
+    return true;
 }
 
 void PolFeatAnalysis::extract(llvm::Function &fun, llvm::FunctionAnalysisManager &FAM)
 {
     ScalarEvolution       &SE = FAM.getResult<ScalarEvolutionAnalysis>(fun);
     LoopInfo              &LI = FAM.getResult<LoopAnalysis>(fun);
-    DominatorTree         &DT = FAM.getResult<DominatorTreeAnalysis>(fun);
-    AssumptionCache       &AC = FAM.getResult<AssumptionAnalysis>(fun);
+    KernelInvariant invariants(fun, features->getScalarFeatureSet().getCalleeClassification());
+
+    // 1. executions of each loop body, enclosing loops come first in preorder.
+    //    Rectangular nests multiply the trip count by the executions of the enclosing loop. If the trip count
+    //    depends on the iterations of enclosing loops (triangular nests), it is summed over those iterations first.
+    std::map<const Loop *, IMPoly> trip_counts;
+    std::map<const Loop *, IMPoly> executions;
+    for (Loop *loop : LI.getLoopsInPreorder()) {
+        IMPoly trip_count = loopContribution(*loop, invariants, SE);
+        trip_counts.emplace(loop, trip_count);
+        Loop *outer = loop->getParentLoop();
+        while (outer && depends_on_counters(trip_count) && trip_count.degree() <= IMPOLY_MAX_DEGREE) {
+            trip_count = trip_count.sum(KernelInvariant::enumerate(loop_counter(*outer)), trip_counts.at(outer));
+            outer = outer->getParentLoop();
+        }
+        if (trip_count.overflowed()) {
+            CELERITY_LOG(loops, warning) << "  WARNING: iteration count overflows the polynomial coefficients, "
+                                            "counting default loop contribution\n";
+            trip_count = IMPoly(long(default_loop_contribution));
+            outer = loop->getParentLoop();
+        }
+        else if (depends_on_counters(trip_count) || trip_count.degree() > IMPOLY_MAX_DEGREE) {
+            CELERITY_LOG(loops, warning) << "  WARNING: iteration count " << trip_count.str() << " exceeds degree "
+                                         << IMPOLY_MAX_DEGREE << ", counting default loop contribution\n";
+            trip_count = IMPoly(long(default_loop_contribution));
+            outer = loop->getParentLoop();
+        }
+        if (outer)
+            trip_count *= executions.at(outer);
+        if (trip_count.overflowed()) {
+            CELERITY_LOG(loops, warning) << "  WARNING: executions of the loop body overflow the polynomial coefficients, "
+                                            "counting default loop contribution\n";
+            trip_count = defaultExecutions(*loop);
+        }
+        executions.emplace(loop, std::move(trip_count));
+    }
+    // 2. each block counts as many times as the body of its innermost loop
+    const IMPoly once(1L);
+    for (BasicBlock &bb : fun) {
+        Loop *loop = LI.getLoopFor(&bb);
+        features->eval(bb, loop ? executions.at(loop) : once);
+    }
+    // the sums of the counters may still overflow: the kernel is counted as Kofler13Analysis does
+    if (features->overflowed()) {
+        CELERITY_LOG(loops, warning) << "  WARNING: feature counters overflow the polynomial coefficients, "
+                                        "counting default loop contribution\n";
+        features->reset();
+        for (BasicBlock &bb : fun) {
+            Loop *loop = LI.getLoopFor(&bb);
+            features->eval(bb, loop ? defaultExecutions(*loop) : once);
+        }
+    }
+}
 
-    std::cout << "PolFeat IMPOLY\n";
-    IMPoly test1(10, KernelInvariant::enumerate(celerity::InvariantType::gs0));
-    std::cout << test1;
-    IMPoly test2(7,KernelInvariant::enumerate(celerity::InvariantType::a0));
-    std::cout << test2;
-    test1 += test2;
-    std::cout << test1;
+IMPoly PolFeatAnalysis::defaultExecutions(const Loop &loop) {
+    // saturated for nests too deep for 64 bits
+    long executions = 1;
+    for (unsigned depth = 0; depth < loop.getLoopDepth() && executions <= INT64_MAX / default_loop_contribution; depth++)
+        executions *= default_loop_contribution;
+    return IMPoly(executions);
 }
 
-IMPoly PolFeatAnalysis::loopContribution(const Loop &loop, LoopInfo &LI, ScalarEvolution &SE) {
-    return IMPoly();
+IMPoly PolFeatAnalysis::loopContribution(const Loop &loop, KernelInvariant &invariants, ScalarEvolution &SE) {
+    const SCEV *backedge_taken = SE.getBackedgeTakenCount(&loop);
+    if (isa<SCEVCouldNotCompute>(backedge_taken)) {
+        CELERITY_LOG(loops, warning) << "  WARNING: trip count not found, counting default loop contribution\n";
+        return IMPoly(long(default_loop_contribution));
+    }
+    Optional<IMPoly> trip_count = invariant_polynomial(backedge_taken, loop, invariants, SE);
+    if (!trip_count) {
+        CELERITY_LOG(loops, warning) << "  WARNING: backedge-taken count " << *backedge_taken
+                                     << " is not a polynomial of the kernel invariants, counting default loop contribution\n";
+        return IMPoly(long(default_loop_contribution));
+    }
+    // the header executes once more than the backedge
+    *trip_count += IMPoly(1L);
+    if (trip_count->overflowed()) {
+        CELERITY_LOG(loops, warning) << "  WARNING: trip count overflows the polynomial coefficients, counting default loop contribution\n";
+        return IMPoly(long(default_loop_contribution));
+    }
+    CELERITY_LOG(loops, debug) << "  loop trip count is " << trip_count->str() << "\n";
+    return *trip_count;
 }
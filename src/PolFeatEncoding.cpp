@@ -0,0 +1,181 @@
+#include <cstring>
+using namespace std;
+
+#include <llvm/Support/MathExtras.h>
+using namespace llvm;
+
+#include "PolFeatEncoding.hpp"
+#include "PolFeatAnalysis.hpp"
+#include "KernelInvariant.hpp"
+using namespace celerity;
+
+static const char polfeat_magic[8] = {'C', 'E', 'L', 'P', 'O', 'L', 'Y', '\0'};
+static const uint32_t polfeat_version = 1;
+static const uint32_t polfeat_byte_order = 0x01020304;
+
+//-----------------------------------------------------------------------------
+// Encoding
+//-----------------------------------------------------------------------------
+Error celerity::encodePolFeatures(StringRef feature_set, const FeatureSchema &schema, ArrayRef<IMPoly> polys,
+                                  ArrayRef<float> feat, std::vector<char> &buffer){
+    assert(polys.size() == schema.size() && feat.size() == schema.size());
+    const unsigned num_features = schema.size();
+    const unsigned num_vars = KernelInvariant::numInvariantType();
+
+    // terms of all the features, in the order of the backend
+    std::vector<uint64_t> term_begin = {0};
+    std::vector<int64_t> coeffs;
+    std::vector<uint8_t> exponents;
+    std::vector<uint64_t> dens;
+    for(unsigned f = 0; f < num_features; f++){
+        if(polys[f].overflowed())
+            return createStringError(inconvertibleErrorCode(), "polynomial feature %s overflowed", schema.getName(f).str().c_str());
+        bool exponents_fit = true;
+        bool coeffs_fit = polys[f].visitIntegerTerms([&](int64_t coeff, ArrayRef<unsigned> term_exponents){
+            coeffs.push_back(coeff);
+            for(unsigned e : term_exponents){
+                exponents_fit = exponents_fit && e <= UINT8_MAX;
+                exponents.push_back(uint8_t(e));
+            }
+        });
+        if(!coeffs_fit || !exponents_fit)
+            return createStringError(inconvertibleErrorCode(), "polynomial feature %s: %s exceeds the binary encoding",
+                                     schema.getName(f).str().c_str(), coeffs_fit ? "exponent" : "coefficient");
+        term_begin.push_back(coeffs.size());
+        dens.push_back(polys[f].denominator());
+    }
+
+    string strings;
+    strings += feature_set;
+    strings += '\0';
+    for(const string &name : schema.getNames()){
+        strings += name;
+        strings += '\0';
+    }
+    for(unsigned var = 0; var < num_vars; var++){
+        strings += InvariantTypeName[var];
+        strings += '\0';
+    }
+
+    const uint64_t num_terms = coeffs.size();
+    PolFeatHeader header;
+    memcpy(header.magic, polfeat_magic, sizeof(header.magic));
+    header.version = polfeat_version;
+    header.byte_order = polfeat_byte_order;
+    header.num_features = num_features;
+    header.num_vars = num_vars;
+    header.num_terms = num_terms;
+    header.string_offset = sizeof(PolFeatHeader);
+    header.string_size = strings.size();
+    header.feat_offset = alignTo(header.string_offset + header.string_size, 8);
+    header.den_offset = alignTo(header.feat_offset + num_features * sizeof(float), 8);
+    header.term_offset = header.den_offset + num_features * sizeof(uint64_t);
+    header.coeff_offset = header.term_offset + (num_features + 1) * sizeof(uint64_t);
+    header.exponent_offset = header.coeff_offset + num_terms * sizeof(int64_t);
+    header.block_size = alignTo(header.exponent_offset + num_terms * num_vars, 8);
+
+    size_t block_begin = buffer.size();
+    buffer.resize(block_begin + header.block_size, 0);
+    char *block = buffer.data() + block_begin;
+    memcpy(block, &header, sizeof(header));
+    memcpy(block + header.string_offset, strings.data(), strings.size());
+    memcpy(block + header.feat_offset, feat.data(), num_features * sizeof(float));
+    memcpy(block + header.den_offset, dens.data(), num_features * sizeof(uint64_t));
+    memcpy(block + header.term_offset, term_begin.data(), term_begin.size() * sizeof(uint64_t));
+    memcpy(block + header.coeff_offset, coeffs.data(), num_terms * sizeof(int64_t));
+    memcpy(block + header.exponent_offset, exponents.data(), exponents.size());
+    return Error::success();
+}
+
+Error celerity::encodePolFeatures(const ResultPolFeatSet &result, std::vector<char> &buffer){
+    return encodePolFeatures(result.feature_set_name, *result.schema, result.raw, result.feat, buffer);
+}
+
+Error celerity::encodeIMPoly(const IMPoly &poly, std::vector<char> &buffer){
+    FeatureSchema schema({""});
+    float feat = 0.f;
+    return encodePolFeatures("", schema, poly, feat, buffer);
+}
+
+
+//-----------------------------------------------------------------------------
+// Decoding
+//-----------------------------------------------------------------------------
+Expected<PolFeatView> PolFeatView::read(StringRef data){
+    auto corrupted = [](const char *what){
+        return createStringError(inconvertibleErrorCode(), "polynomial features: %s", what);
+    };
+    if(reinterpret_cast<uintptr_t>(data.data()) % 8 != 0)
+        return corrupted("buffer is not 8-byte aligned");
+    if(data.size() < sizeof(PolFeatHeader))
+        return corrupted("truncated header");
+    const PolFeatHeader *header = reinterpret_cast<const PolFeatHeader*>(data.data());
+    if(memcmp(header->magic, polfeat_magic, sizeof(header->magic)) != 0)
+        return corrupted("bad magic");
+    if(header->byte_order != polfeat_byte_order)
+        return corrupted("unsupported byte order");
+    if(header->version != polfeat_version)
+        return corrupted("unsupported version");
+    const uint64_t num_features = header->num_features, num_terms = header->num_terms, num_vars = header->num_vars;
+    if(header->block_size > data.size() || header->block_size % 8 != 0 || header->string_offset < sizeof(PolFeatHeader))
+        return corrupted("inconsistent layout");
+    // each section holds count elements of size bytes at offset and ends before the next one: the sizes come from the
+    // block and are not trusted, thus the ends are computed with overflow checks
+    auto fits = [](uint64_t offset, uint64_t count, uint64_t size, uint64_t limit){
+        uint64_t bytes, end;
+        return !__builtin_mul_overflow(count, size, &bytes) && !__builtin_add_overflow(offset, bytes, &end) && end <= limit;
+    };
+    if(!fits(header->string_offset, header->string_size, 1, header->feat_offset)
+        || !fits(header->feat_offset, num_features, sizeof(float), header->den_offset)
+        || !fits(header->den_offset, num_features, sizeof(uint64_t), header->term_offset)
+        || !fits(header->term_offset, num_features + 1, sizeof(uint64_t), header->coeff_offset)
+        || !fits(header->coeff_offset, num_terms, sizeof(int64_t), header->exponent_offset)
+        || !fits(header->exponent_offset, num_terms, num_vars, header->block_size)
+        || header->feat_offset % 8 || header->den_offset % 8 || header->term_offset % 8 || header->coeff_offset % 8)
+        return corrupted("inconsistent layout");
+    if(num_vars > KernelInvariant::numInvariantType())
+        return corrupted("more invariants than supported");
+
+    // string table: names of the feature set, of the features and of the invariants
+    std::vector<StringRef> strings;
+    uint64_t num_strings = 1 + num_features + num_vars;
+    StringRef string_table(data.data() + header->string_offset, header->string_size);
+    while(!string_table.empty() && strings.size() < num_strings){
+        size_t end = string_table.find('\0');
+        if(end == StringRef::npos)
+            return corrupted("unterminated string");
+        strings.push_back(string_table.substr(0, end));
+        string_table = string_table.drop_front(end + 1);
+    }
+    if(strings.size() != num_strings)
+        return corrupted("truncated string table");
+    for(unsigned var = 0; var < num_vars; var++)
+        if(strings[1 + num_features + var] != InvariantTypeName[var])
+            return corrupted("invariants do not match InvariantTypeName");
+
+    PolFeatView view(header, std::move(strings));
+    const uint64_t *term_begin = view.section<uint64_t>(header->term_offset);
+    if(term_begin[0] != 0 || term_begin[num_features] != num_terms)
+        return corrupted("bad term ranges");
+    for(unsigned f = 0; f < num_features; f++)
+        if(term_begin[f] > term_begin[f + 1] || view.getDenominator(f) == 0)
+            return corrupted("bad feature terms");
+    return view;
+}
+
+Expected<IMPoly> PolFeatView::getPolynomial(unsigned feature_id) const {
+    IMPoly poly;
+    if(!poly.setTerms(getCoefficients(feature_id), getExponents(feature_id), getNumVars(), getDenominator(feature_id)))
+        return createStringError(inconvertibleErrorCode(), "polynomial feature %s exceeds the polynomial backend",
+                                 getFeatureName(feature_id).str().c_str());
+    return poly;
+}
+
+Expected<IMPoly> celerity::decodeIMPoly(StringRef data){
+    Expected<PolFeatView> view = PolFeatView::read(data);
+    if(!view)
+        return view.takeError();
+    if(view->getNumFeatures() != 1)
+        return createStringError(inconvertibleErrorCode(), "polynomial features: %u polynomials, one expected", view->getNumFeatures());
+    return view->getPolynomial(0);
+}
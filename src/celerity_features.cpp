@@ -0,0 +1,134 @@
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CBindingWrapping.h>
+#include <llvm-c/Core.h>
+using namespace llvm;
+
+#include "celerity_features.h"
+#include "FeatureExtraction.hpp"
+#include "FeatureSetDefinition.hpp"
+using namespace celerity;
+
+struct celerity_feature_extractor {
+    std::unique_ptr<FeatureExtractor> extractor;
+};
+
+/// message of the last error, per thread as the extractors are
+static thread_local std::string last_error;
+
+/// records the error, returns true if there was one
+static bool failed(Error err){
+    if(!err)
+        return false;
+    last_error = toString(std::move(err));
+    return true;
+}
+
+/// writes the rows of an extraction into the output buffers of the caller
+static long write_rows(Expected<size_t> rows, const std::vector<std::string> &names,
+                       celerity_features_output *output){
+    if(!rows){
+        failed(rows.takeError());
+        return -1;
+    }
+    if(output->names && output->names_size > 0){
+        size_t offset = 0;
+        for(size_t row = 0; row < names.size() && row < output->max_rows; row++){
+            if(offset + names[row].size() + 1 > output->names_size)
+                break;
+            memcpy(output->names + offset, names[row].c_str(), names[row].size() + 1);
+            offset += names[row].size() + 1;
+        }
+    }
+    last_error.clear();
+    return *rows;
+}
+
+static MutableArrayRef<float> feat_buffer(celerity_feature_extractor *ex, float *feat, size_t rows){
+    return feat ? MutableArrayRef<float>(feat, rows * ex->extractor->getNumFeatures()) : MutableArrayRef<float>();
+}
+
+static MutableArrayRef<unsigned> raw_buffer(celerity_feature_extractor *ex, unsigned *raw, size_t rows){
+    return raw ? MutableArrayRef<unsigned>(raw, rows * ex->extractor->getNumFeatures()) : MutableArrayRef<unsigned>();
+}
+
+
+//-----------------------------------------------------------------------------
+// C interface
+//-----------------------------------------------------------------------------
+int celerity_features_load_feature_set(const char *filename){
+    Expected<std::string> name = registerFeatureSetFile(filename);
+    if(!name){
+        failed(name.takeError());
+        return -1;
+    }
+    last_error.clear();
+    return 0;
+}
+
+celerity_feature_extractor *celerity_features_create(const char *analysis, const char *feature_set){
+    Expected<std::unique_ptr<FeatureExtractor>> extractor =
+        FeatureExtractor::create(analysis ? analysis : "default", feature_set ? feature_set : "fan19");
+    if(!extractor){
+        failed(extractor.takeError());
+        return nullptr;
+    }
+    last_error.clear();
+    return new celerity_feature_extractor{std::move(*extractor)};
+}
+
+void celerity_features_destroy(celerity_feature_extractor *extractor){
+    delete extractor;
+}
+
+unsigned celerity_features_num_features(const celerity_feature_extractor *extractor){
+    return extractor->extractor->getNumFeatures();
+}
+
+const char *celerity_features_feature_name(const celerity_feature_extractor *extractor, unsigned feature){
+    const FeatureSchema &schema = extractor->extractor->getSchema();
+    if(feature >= schema.size())
+        return nullptr;
+    return schema.getNames()[feature].c_str();
+}
+
+void celerity_features_set_kernels_only(celerity_feature_extractor *extractor, int kernels_only){
+    extractor->extractor->setKernelsOnly(kernels_only != 0);
+}
+
+long celerity_features_extract_bitcode(celerity_feature_extractor *ex, const void *bitcode, size_t size,
+                                       celerity_features_output *output){
+    MemoryBufferRef buffer(StringRef(static_cast<const char*>(bitcode), size), "bitcode");
+    std::vector<std::string> names;
+    Expected<size_t> rows = ex->extractor->extract(buffer, raw_buffer(ex, output->raw, output->max_rows),
+                                                   feat_buffer(ex, output->feat, output->max_rows), &names);
+    return write_rows(std::move(rows), names, output);
+}
+
+long celerity_features_extract_module(celerity_feature_extractor *ex, LLVMModuleRef module,
+                                      celerity_features_output *output){
+    std::vector<std::string> names;
+    Expected<size_t> rows = ex->extractor->extract(*unwrap(module), raw_buffer(ex, output->raw, output->max_rows),
+                                                   feat_buffer(ex, output->feat, output->max_rows), &names);
+    return write_rows(std::move(rows), names, output);
+}
+
+int celerity_features_extract_function(celerity_feature_extractor *ex, LLVMValueRef function, float *feat, unsigned *raw){
+    Function *fun = dyn_cast_or_null<Function>(unwrap(function));
+    if(!fun){
+        last_error = "not a function";
+        return -1;
+    }
+    if(failed(ex->extractor->extract(*fun, raw_buffer(ex, raw, 1), feat_buffer(ex, feat, 1))))
+        return -1;
+    last_error.clear();
+    return 0;
+}
+
+const char *celerity_features_last_error(void){
+    return last_error.c_str();
+}
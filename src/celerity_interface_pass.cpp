@@ -1,6 +1,22 @@
 
+#include <chrono>
+#include <ctime>
+
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
 #include "../include/celerity_interface_pass.h"
 
+#include "FeatureExtraction.hpp"
+#include "CalleeClassification.hpp"
+#include "Logging.hpp"
+#ifdef CELERITY_POLFEAT
+#include "IMPoly.hpp"
+#include "IMPolyEvaluator.hpp"
+#include "KernelInvariant.hpp"
+#endif
+
 using namespace celerity;
 
 // ------------------ Help functions
@@ -43,7 +59,7 @@ std::string extractFileName(std::string filePath, char seperator = '/')
 /**
  * Module run method
  */
-bool CelerityInterfacePass::runOnModule(Module &m) {
+PreservedAnalyses CelerityInterfacePass::run(Module &m, ModuleAnalysisManager &mam) {
 
     // Parse the module name and use it to name the output filename
     std::string filename = extractFileName(m.getModuleIdentifier());
@@ -63,69 +79,171 @@ bool CelerityInterfacePass::runOnModule(Module &m) {
     // Generate the header
     printInterfaceHeader();
 
+    // classify the called functions once, the feature analyses use the cached classification
+    mam.getResult<CalleeClassificationAnalysis>(m);
+    FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(m).getManager();
+
     // Then try looking for function representing sycl kernel and generate their corresponding templated class
-    for (Module::iterator mi = m.begin(), me = m.end(); mi != me; ++mi) {
-        runOnFunction(*mi);
+    SetVector<Function *> kernels = find_kernels(m);
+    for (Function &f : m) {
+        if (f.isDeclaration())
+            continue;
+        bool deviceKernel = kernels.count(&f);
+        std::string name = kernelName(f, deviceKernel);
+        if (!name.empty())
+            printKernelClass(name, f, deviceKernel, fam);
     }
 
     // Make sure to close the output stream
     fileOutputStream.close();
+    setOutputStream();
 
-    return false;
+    return PreservedAnalyses::all();
 }
 
 /**
- * This is the main function for generating the celerity runtime interface
- * This method runs on every llvm function and tries to extract the sycl kernel name by demangling the llvm function name.
- * It uses some regular expressions to extract the kernel name.
- * If kernel name is found, it runs some other passes to extract static features then generates the final celerity_interface.h
+ * This is the main function for identifying the kernels of a module.
+ * Device code: the functions with the SPIR kernel calling convention (or in the opencl.kernels metadata), SYCL names
+ * them after the typeinfo name of the kernel name type, which is the only name demangled.
+ * Host code: the celerity dispatch function, cl::sycl::detail::dispatch<..., void celerity::handler::..., kernel
+ * name const::name, ...>. The base name and the context are read with the partial demangler, the template arguments
+ * are demangled only for the dispatch function.
  */
-bool CelerityInterfacePass::runOnFunction(Function &f) {
-
-    // Regular expression constants
-    const std::regex SYCL_DISPATCH_REGEXPR("^void cl::sycl::detail::dispatch.*void celerity::handler::.*");
-    const std::regex SYCL_KERNEL_NAME_REGEXPR(".*const::(\\w+),.*");
-
-    const string SYCL_DISPATCH_EXPR = "void cl::sycl::detail::dispatch";
-    //const string SYCL_DISPATCH_EXPR = "mat_mul";
-
-    // demanlge the function name.
-    string demangledName = demangle(f.getName());
-
-    // Identify the kernel dispatch function by grepping for void cl::sycl::detail::dispatch.*void celerity::handler::
-    // There should be only one function defintion dispatching the kernel but can be called multiple times
-    if (std::regex_match(demangledName, SYCL_DISPATCH_REGEXPR)) {
-
-
-        std::smatch match;
-        std::string kernelName;
-        if (std::regex_search(demangledName, match, SYCL_KERNEL_NAME_REGEXPR) && match.size() > 1) {
-            kernelName = match.str(1);
-
-            // Generate the kernel interface templated class
-            printKernelClass(kernelName, f);
+std::string CelerityInterfacePass::kernelName(const Function &f, bool deviceKernel) {
+
+    StringRef name = f.getName();
+    if (deviceKernel) {
+        if (!name.startswith("_ZTS"))
+            return name.str();
+        // typeinfo name for <kernel name type>
+        std::string demangled = llvm::demangle(name.str());
+        StringRef type(demangled);
+        type.consume_front("typeinfo name for ");
+        return type.str();
+    }
 
+    // the source name of dispatch in the mangled name, a cheap filter before demangling
+    if (!name.contains("8dispatch"))
+        return "";
+    ItaniumPartialDemangler demangler;
+    if (demangler.partialDemangle(name.data()))
+        return "";
+    std::string kernel;
+    char *base = demangler.getFunctionBaseName(nullptr, nullptr);
+    char *context = demangler.getFunctionDeclContextName(nullptr, nullptr);
+    if (base && context && StringRef(base) == "dispatch" && StringRef(context) == "cl::sycl::detail") {
+        char *function = demangler.getFunctionName(nullptr, nullptr);
+        StringRef full(function ? function : "");
+        // the kernel name is the last const::name, template argument
+        size_t pos = full.rfind("const::");
+        if (full.contains("celerity::handler::") && pos != StringRef::npos) {
+            StringRef rest = full.drop_front(pos + strlen("const::"));
+            kernel = rest.take_while([](char c) { return isalnum(c) || c == '_'; }).str();
+            if (!rest.drop_front(kernel.size()).startswith(","))
+                kernel.clear();
         }
+        free(function);
     }
-
-    return false;
+    free(base);
+    free(context);
+    return kernel;
 }
 
 /**
  * This method is responsible for generating the celerity interface code for a certain kernel
  * @param kernelName
  */
-void CelerityInterfacePass::printKernelClass(const std::string& kernelName, Function &f) {
+void CelerityInterfacePass::printKernelClass(const std::string& kernelName, Function &f, bool deviceKernel,
+                                             FunctionAnalysisManager &fam) {
 
     outputstream() << "// efficiency_predictor for kernel: " <<  kernelName << endl;
     outputstream() << "template<>" << endl;
     outputstream() << "class efficiency_predictor<" << kernelName << "> {" << endl;
-    outputstream() << "     float operator(const runtime_features& rf) {" << endl;
+    outputstream() << "public:" << endl;
+    // the host dispatch function only launches the kernel, the header of the device compile resolves the features
+    if (deviceKernel)
+        printFeatureResolution(f, fam);
+    outputstream() << "     float operator()(const runtime_features& rf) {" << endl;
     outputstream() << "          return 1.0f; // TODO: replace this with a call to an internal modeling function" << endl;
     outputstream() << "     }" << endl;
-    outputstream() << "}" << endl;
+    outputstream() << "};" << endl << endl;
+
+}
+
+#ifdef CELERITY_POLFEAT
+/**
+ * C++ expression of the value of an invariant at kernel launch. aN is the IR argument N of the kernel function,
+ * pointers included (see KernelInvariant), thus scalar_args is indexed by the IR argument positions
+ * @param invariant
+ * @return
+ */
+static std::string launchValue(unsigned invariant) {
+    if (invariant <= InvariantType::a9)
+        return "scalar_args[" + std::to_string(invariant - InvariantType::a0) + "]";
+    if (invariant >= InvariantType::gs0 && invariant <= InvariantType::gs2)
+        return "double(rf.global_size[" + std::to_string(invariant - InvariantType::gs0) + "])";
+    if (invariant >= InvariantType::ls0 && invariant <= InvariantType::ls2)
+        return "double(rf.local_size[" + std::to_string(invariant - InvariantType::ls0) + "])";
+    if (invariant >= InvariantType::ng0 && invariant <= InvariantType::ng2) {
+        std::string dim = std::to_string(invariant - InvariantType::ng0);
+        return "double(rf.global_size[" + dim + "] / rf.local_size[" + dim + "])";
+    }
+    // sub-groups are not part of the runtime features, the features depending on them are flagged as unresolved
+    return std::string("0.0 /* ") + InvariantTypeName[invariant] + " */";
+}
 
+void CelerityInterfacePass::printFeatureResolution(Function &f, FunctionAnalysisManager &fam) {
+    // shared with the feature passes of the pipeline, computed if no other pass requested it
+    ResultPolFeatSet &features = fam.getResult<PolFeatAnalysis>(f);
+    const FeatureSchema &schema = *features.schema;
+
+    outputstream() << "     static constexpr std::size_t feature_num = " << schema.size() << ";" << endl;
+    outputstream() << "     static constexpr const char *feature_names[] = {";
+    for (unsigned i = 0; i < schema.size(); i++)
+        outputstream() << (i ? ", " : "") << "\"" << schema.getName(i).str() << "\"";
+    outputstream() << "};" << endl;
+
+    // the scalar arguments that may appear in the features: a0 ... a9 are the first IR arguments, pointers included
+    std::string arguments;
+    unsigned num_arguments = 0;
+    for (unsigned i = 0; i < f.arg_size() && i <= InvariantType::a9; i++) {
+        Type *type = f.getArg(i)->getType();
+        if (type->isPointerTy())
+            continue;
+        std::string type_name;
+        raw_string_ostream type_stream(type_name);
+        type->print(type_stream);
+        arguments += (num_arguments++ ? ", " : "") + std::string("{") + std::to_string(i) + ", \"" + type_stream.str() + "\"}";
+    }
+    outputstream() << "     // scalar_args[position] is the value of the IR argument at position of the kernel function, pointers" << endl;
+    outputstream() << "     // included: scalar_args holds argument_num values, only the scalar arguments below are read" << endl;
+    outputstream() << "     static constexpr std::size_t argument_num = " << f.arg_size() << ";" << endl;
+    outputstream() << "     static constexpr std::array<kernel_argument, " << num_arguments << "> scalar_arguments = {{"
+                   << arguments << "}};" << endl;
+
+    // features depending on sub-group invariants are computed with those set to zero
+    std::string resolved;
+    for (unsigned i = 0; i < schema.size(); i++) {
+        std::string missing;
+        for (unsigned invariant = InvariantType::nsg; invariant <= InvariantType::msgs; invariant++)
+            if (features.raw[i].degree(KernelInvariant::enumerate(InvariantType(invariant))) > 0)
+                missing += std::string(missing.empty() ? "" : ", ") + InvariantTypeName[invariant];
+        if (!missing.empty())
+            CELERITY_LOG(invariant, warning) << "WARNING: feature " << schema.getName(i) << " of " << f.getName()
+                                             << " depends on " << missing << ", unresolved at kernel launch\n";
+        resolved += std::string(i ? ", " : "") + (missing.empty() ? "true" : "false");
+    }
+    outputstream() << "     // false for the features depending on sub-group sizes, which are not part of the runtime features" << endl;
+    outputstream() << "     static constexpr bool feature_resolved[] = {" << resolved << "};" << endl;
+    outputstream() << "     // polynomial features of the kernel, scalar_args as described by scalar_arguments" << endl;
+    outputstream() << "     static void resolve_features(const runtime_features& rf, const double scalar_args[], "
+                   << "float features[feature_num]) {" << endl;
+    IMPolyEvaluator(features.raw).printCode(outputstream(), launchValue, "features", "          ");
+    outputstream() << "     }" << endl;
 }
+#else
+void CelerityInterfacePass::printFeatureResolution(Function &, FunctionAnalysisManager &) {}
+#endif
 /**
  * Print the header of the generated celerity_interface.h
  * Prints any common code
@@ -138,6 +256,7 @@ void CelerityInterfacePass::printInterfaceHeader() {
     outputstream() << "// " << std::ctime(&now_time) << endl;
 
     // Includes
+    outputstream() << "#include <array>" << endl;
     outputstream() << "#include <CL/sycl.hpp>" << endl << endl;
 
     // Structs
@@ -145,79 +264,79 @@ void CelerityInterfacePass::printInterfaceHeader() {
     outputstream() << "struct buffer_access {" << endl;
     outputstream() << "     cl::sycl::access::mode mode;" << endl;
     outputstream() << "     std::size_t range[3];" << endl;
-    outputstream() << "}" << endl;
+    outputstream() << "};" << endl;
 
     outputstream() << "// runtime_features  struct" << endl;
     outputstream() << "struct runtime_features {" << endl;
     outputstream() << "     std::size_t global_size[3];" << endl;
     outputstream() << "     std::size_t local_size[3];" << endl;
     outputstream() << "     std::vector<buffer_access> buffer_accesses;" << endl;
-    outputstream() << "}" << endl << endl;
-
-}
+    outputstream() << "};" << endl;
 
+    outputstream() << "// kernel_argument  struct" << endl;
+    outputstream() << "struct kernel_argument {" << endl;
+    outputstream() << "     std::size_t position; // among the IR arguments of the kernel function, pointers included" << endl;
+    outputstream() << "     const char *type;     // LLVM IR type" << endl;
+    outputstream() << "};" << endl << endl;
 
-/**
- * Demangles the name of a function
- * @param MangledName
- * @return
- */
-std::string CelerityInterfacePass::demangle(const std::string &MangledName) {
-    char *Demangled;
-    if (isItaniumEncoding(MangledName))
-        Demangled = itaniumDemangle(MangledName.c_str(), nullptr, nullptr, nullptr);
-    else
-        Demangled = microsoftDemangle(MangledName.c_str(), nullptr, nullptr, nullptr);
-
-    if (!Demangled)
-        return MangledName;
-
-    std::string Ret = Demangled;
-    free(Demangled);
-    return Ret;
 }
 
-/**
- * This checks whether we are using a ItaniumEncoding usually used by most posix compilers
- * @param MangledName
- * @return
- */
-bool CelerityInterfacePass::isItaniumEncoding(const std::string &MangledName) {
-    size_t Pos = MangledName.find_first_not_of('_');
-    // A valid Itanium encoding requires 1-4 leading underscores, followed by 'Z'.
-    return Pos > 0 && Pos <= 4 && MangledName[Pos] == 'Z';
-}
 
 // ------------------ Pass registration code
 
-// Pass loading stuff
-// To use, run: clang -Xclang -load -Xclang <your-pass>.so <other-args> ...
-static void registerKernelNamePass(const PassManagerBuilder &Builder, legacy::PassManagerBase &PM) {
-    PM.add(new CelerityInterfacePass());
+// To use, run: clang -fpass-plugin=<your-pass>.so <other-args> ... or opt -load-pass-plugin=<your-pass>.so
+// -passes=celerity-interface. Loaded with the feature analysis plugin, both share the analysis results.
+llvm::PassPluginLibraryInfo getCelerityInterfacePassPluginInfo()
+{
+    return {
+        LLVM_PLUGIN_API_VERSION, "CelerityInterface", LLVM_VERSION_STRING,
+        [](PassBuilder &PB)
+        {
+            // opt -passes=celerity-interface
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>)
+                {
+                    if (Name == "celerity-interface")
+                    {
+#ifdef CELERITY_POLFEAT
+                        FunctionPassManager FPM;
+                        PolFeatAnalysis().addCanonicalizationPasses(FPM);
+                        MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+#endif
+                        MPM.addPass(CelerityInterfacePass());
+                        return true;
+                    }
+                    return false;
+                });
+            // the header is written at the end of the optimization pipeline of the compile, on promoted IR
+            PB.registerOptimizerLastEPCallback(
+                [](ModulePassManager &MPM, PassBuilder::OptimizationLevel)
+                {
+#ifdef CELERITY_POLFEAT
+                    FunctionPassManager FPM;
+                    PolFeatAnalysis().addCanonicalizationPasses(FPM);
+                    MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+#endif
+                    MPM.addPass(CelerityInterfacePass());
+                });
+            // the feature analysis plugin registers the same analyses, the first registration is kept
+            PB.registerAnalysisRegistrationCallback(
+                [](FunctionAnalysisManager &FAM)
+                {
+#ifdef CELERITY_POLFEAT
+                    FAM.registerPass([&] { return PolFeatAnalysis(); });
+#endif
+                });
+            PB.registerAnalysisRegistrationCallback(
+                [](ModuleAnalysisManager &MAM)
+                {
+                    MAM.registerPass([&] { return CalleeClassificationAnalysis(); });
+                });
+        }};
 }
 
-// Pass info
-// LLVM uses the address of this static member to identify the pass
-char CelerityInterfacePass::ID = 0;
-// This registers this pass with -kernel-name command line argument for opt
-static RegisterPass<CelerityInterfacePass> X("celerity-interface", "CelerityInterfacePass");
-
-//static RegisterStandardPasses RegisterMyPass(PassManagerBuilder::EP_EarlyAsPossible, KernelNamePass::registerMyPass);
-
-// Note: The location EP_OptimizerLast places this pass at the end of the list
-// of *optimizations*. That means on -O0, it does not get run.
-//
-// In general, adding your pass twice will cause it to run twice, but in this
-// particular case, the two are disjoint (EP_EnabledOnOptLevel0 only runs if
-// you're in -O0, and EP_OptimizerLast only runs if you're not). You can check
-// include/llvm/Transforms/IPO/PassManagerBuilder.h header and
-// lib/Transforms/IPO/PassManagerBuilder.cpp file for the exact behavior.
-
-// These constructors add our pass to a list of global extensions.
-static RegisterStandardPasses celerityInterfacePassLoader_Ox(PassManagerBuilder::EP_ModuleOptimizerEarly,
-                                                             registerKernelNamePass);
-static RegisterStandardPasses celerityInterfacePassLoader_O0(PassManagerBuilder::EP_EnabledOnOptLevel0,
-                                                             registerKernelNamePass);
-
-
-
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo()
+{
+    return getCelerityInterfacePassPluginInfo();
+}
@@ -0,0 +1,197 @@
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/SourceMgr.h>
+using namespace llvm;
+
+#include "FeatureSet.hpp"
+#include "FeatureAnalysis.hpp"
+#include "FusedFeatureAnalysis.hpp"
+#include "FeatureSetDefinition.hpp"
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// Command line parsing
+//-----------------------------------------------------------------------------
+cl::opt<string> IRFilename(cl::Positional, cl::desc("<input_bitcode_file>"), cl::Required);
+cl::opt<unsigned> Repetitions("r", cl::desc("Number of passes over all the instructions of the module"), cl::init(100));
+cl::list<string> FSetDefs("fset-def", cl::desc("Feature set definition files (.fset), benchmarked with the built-in sets"), cl::value_desc("filename"));
+
+/// Time spent by a feature set to evaluate a list of instructions, in nanoseconds per instruction
+double bench_eval(FeatureSet &fs, const vector<Instruction*> &instructions, unsigned repetitions){
+    fs.reset();
+    for(Instruction *inst : instructions) // warm-up
+        fs.eval(*inst);
+    auto start = chrono::steady_clock::now();
+    for(unsigned r=0; r<repetitions; r++){
+        fs.reset();
+        for(Instruction *inst : instructions)
+            fs.eval(*inst);
+    }
+    auto stop = chrono::steady_clock::now();
+    double elapsed_ns = chrono::duration<double, nano>(stop - start).count();
+    return elapsed_ns / (double(instructions.size()) * repetitions);
+}
+
+/// evaluate the instructions of a block, one virtual call per instruction or a single one for the block
+static void eval_block(FeatureSet &fs, BasicBlock &bb, bool per_instruction){
+    if(per_instruction){
+        for(Instruction &inst : bb)
+            fs.eval(inst);
+    }else{
+        fs.eval(bb);
+    }
+}
+
+/// Same as bench_eval, walking the instructions of the basic blocks as the analyses do
+double bench_eval_blocks(FeatureSet &fs, const vector<BasicBlock*> &blocks, size_t num_instructions, unsigned repetitions,
+                         bool per_instruction){
+    fs.reset();
+    for(BasicBlock *bb : blocks) // warm-up
+        eval_block(fs, *bb, per_instruction);
+    auto start = chrono::steady_clock::now();
+    for(unsigned r=0; r<repetitions; r++){
+        fs.reset();
+        for(BasicBlock *bb : blocks)
+            eval_block(fs, *bb, per_instruction);
+    }
+    auto stop = chrono::steady_clock::now();
+    double elapsed_ns = chrono::duration<double, nano>(stop - start).count();
+    return elapsed_ns / (double(num_instructions) * repetitions);
+}
+
+/// Analysis managers for the function-level benchmarks
+struct BenchAnalysisManagers {
+    PassBuilder PB;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    BenchAnalysisManagers(){
+        FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+        MAM.registerPass([] { return CalleeClassificationAnalysis(); });
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    }
+};
+
+/// Time to extract all the (analysis, feature set) pairs from the module, in microseconds per repetition:
+/// one analysis run per pair, or a single fused run. The raw counters of all the pairs are appended to counts.
+double bench_pairs(Module &module, const vector<string> &analyses, const vector<string> &feature_sets, bool fused,
+                   unsigned repetitions, vector<unsigned> &counts){
+    BenchAnalysisManagers am;
+    vector<std::unique_ptr<FeatureAnalysis>> separate;
+    FusedFeatureAnalysis fused_analysis(feature_sets, analyses);
+    FunctionPassManager canonicalization;
+    if(fused)
+        fused_analysis.addCanonicalizationPasses(canonicalization);
+    else{
+        for(const string &analysis : analyses)
+            for(const string &feature_set : feature_sets)
+                separate.push_back(FARegistry::dispatch(analysis, feature_set));
+        for(auto &analysis : separate)
+            analysis->addCanonicalizationPasses(canonicalization);
+    }
+    // the IR is canonicalized once, as the tool does, only the analyses are measured
+    for(Function &fun : module)
+        if(!fun.isDeclaration())
+            canonicalization.run(fun, am.FAM);
+    am.MAM.getResult<CalleeClassificationAnalysis>(module);
+
+    auto extract = [&](bool keep){
+        for(Function &fun : module){
+            if(fun.isDeclaration())
+                continue;
+            if(fused){
+                ResultFusedFeatureAnalysis result = fused_analysis.run(fun, am.FAM);
+                for(ResultFeatureAnalysis &pair : result.results)
+                    if(keep) counts.insert(counts.end(), pair.raw.begin(), pair.raw.end());
+            }
+            else{
+                for(auto &analysis : separate){
+                    ResultFeatureAnalysis pair = analysis->run(fun, am.FAM);
+                    if(keep) counts.insert(counts.end(), pair.raw.begin(), pair.raw.end());
+                }
+            }
+        }
+    };
+    extract(true); // warm-up, also computes the loop analyses
+    auto start = chrono::steady_clock::now();
+    for(unsigned r=0; r<repetitions; r++)
+        extract(false);
+    auto stop = chrono::steady_clock::now();
+    am.FAM.clear();
+    am.MAM.clear();
+    return chrono::duration<double, micro>(stop - start).count() / repetitions;
+}
+
+/// Micro-benchmarks for the per-instruction cost of feature extraction
+int main(int argc, char *argv[]){
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv);
+    for(const string &filename : FSetDefs){
+        Expected<string> name = registerFeatureSetFile(filename);
+        if(!name){
+            cerr << "error: " << toString(name.takeError()) << endl;
+            return 1;
+        }
+    }
+    LLVMContext context;
+    SMDiagnostic error;
+    std::unique_ptr<Module> module = parseIRFile(IRFilename, error, context);
+    if (!module) {
+        cerr << "error: " << error.getMessage().str() << endl;
+        return 1;
+    }
+    vector<Instruction*> instructions;
+    vector<BasicBlock*> blocks;
+    for(Function &fun : *module)
+        for(BasicBlock &bb : fun){
+            blocks.push_back(&bb);
+            for(Instruction &inst : bb)
+                instructions.push_back(&inst);
+        }
+    if(instructions.empty()){
+        cerr << "error: no instructions in " << IRFilename << endl;
+        return 1;
+    }
+    cout << "module " << IRFilename << ": " << instructions.size() << " instructions, " 
+         << Repetitions << " repetitions" << endl;
+    for(StringRef key : FSRegistry::getKeyList()){
+        std::unique_ptr<FeatureSet> fs = FSRegistry::dispatch(key);
+        double ns = bench_eval(*fs, instructions, Repetitions);
+        double inst_ns = bench_eval_blocks(*fs, blocks, instructions.size(), Repetitions, true);
+        double block_ns = bench_eval_blocks(*fs, blocks, instructions.size(), Repetitions, false);
+        cout << "  eval " << setw(8) << fs->getName() << ": " << fixed << setprecision(2) << ns << " ns/instruction, "
+             << "in blocks " << inst_ns << " per instruction, " << block_ns << " per block" << endl;
+    }
+
+    // all the feature sets with all the analyses: separate runs versus a single fused traversal
+    const vector<string> analyses = {"default", "kofler13"};
+    vector<string> feature_sets;
+    for(StringRef key : FSRegistry::getKeyList())
+        feature_sets.push_back(key.str());
+    for(size_t num_sets = 1; num_sets <= feature_sets.size(); num_sets++){
+        vector<string> sets(feature_sets.begin(), feature_sets.begin() + num_sets);
+        vector<unsigned> separate_counts, fused_counts;
+        double separate_us = bench_pairs(*module, analyses, sets, false, Repetitions, separate_counts);
+        double fused_us = bench_pairs(*module, analyses, sets, true, Repetitions, fused_counts);
+        cout << "  " << analyses.size() << " analyses x " << num_sets << " sets: separate " << fixed << setprecision(1) 
+             << separate_us << " us, fused " << fused_us << " us" 
+             << (separate_counts == fused_counts ? "" : "  MISMATCH") << endl;
+    }
+    return 0;
+}
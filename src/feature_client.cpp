@@ -0,0 +1,145 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+using namespace llvm;
+
+#include "FeatureServer.hpp"
+using namespace celerity;
+
+//-----------------------------------------------------------------------------
+// Latency benchmark of the feature extraction server (feature_ext -serve).
+// Sends the input modules round-robin, keeping up to -pipeline requests in flight on one connection,
+// and reports the latency percentiles of the replies.
+//-----------------------------------------------------------------------------
+static cl::opt<string> SocketPath("socket", cl::desc("Unix socket of the server"), cl::value_desc("path"), cl::Required);
+static cl::list<string> InputFilenames(cl::Positional, cl::desc("<input_bitcode_files>"), cl::OneOrMore);
+static cl::opt<unsigned> NumRequests("n", cl::desc("Number of measured requests"), cl::init(1000));
+static cl::opt<unsigned> NumWarmup("warmup", cl::desc("Number of requests sent before the measure"), cl::init(10));
+static cl::opt<unsigned> Pipeline("pipeline", cl::desc("Maximum number of requests in flight"), cl::init(1));
+static cl::opt<bool> PrintFeatures("print", cl::desc("Print the features of the first reply of each input"), cl::init(false));
+
+/// Latency percentile, latencies must be sorted
+static double percentile(const std::vector<double> &latencies, double p){
+    size_t rank = std::max<size_t>(1, (size_t)(p * latencies.size() + 0.999999));
+    return latencies[std::min(rank, latencies.size()) - 1];
+}
+
+int main(int argc, char *argv[]){
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "feature extraction server latency benchmark\n");
+
+    std::vector<std::unique_ptr<MemoryBuffer>> modules;
+    for(const string &filename : InputFilenames){
+        ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(filename);
+        if(!buffer){
+            errs() << "error: cannot read " << filename << ": " << buffer.getError().message() << "\n";
+            return 1;
+        }
+        modules.push_back(std::move(*buffer));
+    }
+    FeatureClient client;
+    if(Error err = client.connect(SocketPath)){
+        errs() << "error: " << toString(std::move(err)) << "\n";
+        return 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+    const unsigned total = NumWarmup + NumRequests;
+    const unsigned max_in_flight = std::max(1u, (unsigned)Pipeline);
+    std::vector<clock::time_point> sent(total);
+    std::vector<double> latencies; // microseconds, measured requests only
+    latencies.reserve(NumRequests);
+    std::mutex lock;
+    std::condition_variable reply_received;
+    unsigned in_flight = 0;
+    unsigned errors = 0;
+    bool failed = false;
+
+    // replies are received on a separate thread, so that sending never waits for the server to write
+    std::thread receiver([&]{
+        for(unsigned r = 0; r < total; r++){
+            Expected<FeatureReply> reply = client.receive();
+            clock::time_point now = clock::now();
+            std::lock_guard<std::mutex> guard(lock);
+            in_flight--;
+            reply_received.notify_one();
+            if(!reply){
+                // after a send failure the connection was shut down on purpose, the error is already reported
+                if(failed)
+                    consumeError(reply.takeError());
+                else
+                    errs() << "error: " << toString(reply.takeError()) << "\n";
+                failed = true;
+                return;
+            }
+            if(reply->request_id >= total)
+                continue;
+            if(reply->status != FeatureReplyStatus::ok){
+                if(errors++ == 0)
+                    errs() << "error: request " << reply->request_id << ": " << reply->error << "\n";
+            }
+            else if(PrintFeatures && reply->request_id < modules.size()){
+                outs() << "module: " << modules[reply->request_id]->getBufferIdentifier() << "\n";
+                for(size_t row = 0; row < reply->kernels.size(); row++){
+                    outs() << reply->kernels[row];
+                    for(unsigned f = 0; f < reply->num_features; f++)
+                        outs() << " " << format("%.3f", reply->feat[row * reply->num_features + f]);
+                    outs() << "\n";
+                }
+            }
+            if(reply->request_id >= NumWarmup)
+                latencies.push_back(std::chrono::duration<double, std::micro>(now - sent[reply->request_id]).count());
+        }
+    });
+
+    clock::time_point start = clock::now();
+    for(uint32_t id = 0; id < total; id++){
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            reply_received.wait(guard, [&]{ return in_flight < max_in_flight || failed; });
+            if(failed)
+                break;
+            in_flight++;
+            sent[id] = clock::now();
+            if(id == NumWarmup)
+                start = sent[id];
+        }
+        if(Error err = client.send(id, modules[id % modules.size()]->getBuffer())){
+            errs() << "error: " << toString(std::move(err)) << "\n";
+            // the receiver may wait for replies that never come: its receive() fails once the socket is shut down
+            std::lock_guard<std::mutex> guard(lock);
+            failed = true;
+            client.shutdown();
+            break;
+        }
+    }
+    receiver.join();
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    if(failed || latencies.empty())
+        return 1;
+
+    std::sort(latencies.begin(), latencies.end());
+    double mean = 0;
+    for(double latency : latencies)
+        mean += latency;
+    mean /= latencies.size();
+    outs() << "requests " << latencies.size() << " (pipeline " << max_in_flight << ", " << modules.size() << " modules)"
+           << ", errors " << errors << "\n";
+    outs() << "latency us: p50 " << format("%.1f", percentile(latencies, 0.50))
+           << "  p99 " << format("%.1f", percentile(latencies, 0.99))
+           << "  mean " << format("%.1f", mean)
+           << "  max " << format("%.1f", latencies.back()) << "\n";
+    outs() << "throughput " << format("%.1f", latencies.size() / elapsed) << " requests/s\n";
+    return errors ? 1 : 0;
+}
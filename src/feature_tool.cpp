@@ -2,43 +2,54 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sys/resource.h>
 using namespace std;
 
+#include <llvm/ADT/SetVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IRReader/IRReader.h>
 #include "llvm/Analysis/AliasAnalysis.h"
 #include <llvm/Analysis/LoopAnalysisManager.h>
 #include <llvm/Pass.h>
-#include <llvm/Passes/PassPlugin.h>
 #include <llvm/Passes/PassBuilder.h>
-#include <llvm/Passes/StandardInstrumentations.h>
 #include <llvm/CodeGen/CommandFlags.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/GlobPattern.h>
 #include <llvm/Support/InitLLVM.h>
-//#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
 using namespace llvm;
 
 #include "FeatureSet.hpp"
 #include "DefaultFeatureAnalysis.hpp"
 #include "Kofler13Analysis.hpp"
 #include "FeaturePrinter.hpp"
+#include "DebugStream.hpp"
+#include "WorkStealingPool.hpp"
+#include "FeatureCache.hpp"
+#include "FeatureMatrix.hpp"
+#include "CalleeClassification.hpp"
+#include "FeatureServer.hpp"
+#include "FeatureExtraction.hpp"
+#include "FeatureSetDefinition.hpp"
 using namespace celerity;
 
-//-----------------------------------------------------------------------------
-// Register the analysis in a FeatureAnalysis registry
-//-----------------------------------------------------------------------------
-static celerity::FeatureAnalysis* _static_dfa_ptr_ = new celerity::DefaultFeatureAnalysis; // dynamic_cast<celerity::FeatureAnalysis*>(&_static_fa_);
-static bool _registered_feature_analysis_ = FARegistry::registerByKey("default", _static_dfa_ptr_ ); 
-//-----------------------------------------------------------------------------
-// Register the Kofler13 analysis in the FeatureAnalysis registry
-//-----------------------------------------------------------------------------
-static celerity::FeatureAnalysis* _static_kfa_ptr_ = new celerity::Kofler13Analysis; // dynamic_cast<celerity::FeatureAnalysis*>(&_static_fa_);
-static bool _registered_kofler13_analysis_ = FARegistry::registerByKey("kofler13", _static_kfa_ptr_ ); 
-
-
-
 //-----------------------------------------------------------------------------
 // Command line parsing
 //-----------------------------------------------------------------------------
@@ -49,18 +60,82 @@ cl::opt<FeatureSetOptions> FSet("fset", cl::desc("Specify the feature set:"),
                                     clEnumVal(fan19, "Default feature set for GPU used in [Fan et al. ICPP 19]"),
                                     clEnumVal(grewe13, "Feature set used in pGrewe et al. 13]"),
                                     clEnumVal(full, "Feature set mapping all LLVM IR opcode (very large, hard to cover)")));
+// feature sets declared in definition files, the last one is extracted instead of -fset
+cl::list<string> FSetDefs("fset-def", cl::desc("Load a feature set definition file (.fset) and extract its feature set"), cl::value_desc("filename"));
 // fanal={...} supported feature analyses
 cl::opt<string> FAnal("fanal", cl::desc("Specify the feature analysis algorithm"), cl::value_desc("feature_analysis"), cl::init("default"));
 // fnorm={...} supported normalization
 cl::opt<string> FNorm("fnorm", cl::desc("Specify the feature normalization algorithm"), cl::value_desc("feature_norm"), cl::init("default"));
-// in case of standalone tool (no opt), we need a positional param for the input IR file
-cl::opt<string> IRFilename(cl::Positional, cl::desc("<input_bitcode_file>"), cl::Required);
+// in case of standalone tool (no opt), we need positional params for the input IR files (wildcards in the file name are expanded)
+cl::list<string> IRFilenames(cl::Positional, cl::desc("<input_bitcode_files>"), cl::ZeroOrMore);
+// manifest file listing the input IR files, one per line
+cl::opt<string> Manifest("manifest", cl::desc("File listing the input bitcode files, one per line"), cl::value_desc("filename"), cl::init(""));
+// number of worker threads
+cl::opt<unsigned> Threads("j", cl::desc("Number of worker threads (default: all hardware threads)"), cl::init(0));
 // help
 //cl::opt<bool> Help("h", cl::desc("Enable binary output on terminals"), cl::init(false));
+// binary output
+cl::opt<string> OutputFilename("o", cl::desc("Write the features to a binary feature matrix file instead of the standard output"), cl::value_desc("filename"), cl::init(""));
+cl::opt<bool> Append("append", cl::desc("Append the features to an existing feature matrix file"), cl::init(false));
+// distribute the functions of a module over the worker threads, instead of the input files
+cl::opt<bool> SplitFunctions("split-functions", cl::desc("Extract the functions of each module concurrently (for large modules)"), cl::init(false));
+// lazy loading: only the kernels and the functions they call are materialized
+cl::opt<bool> LazyLoading("lazy", cl::desc("Load the bitcode lazily and extract only the kernels (spir_kernel or opencl.kernels metadata) and their callees"), cl::init(false));
+// server mode: extract the modules received on a Unix socket
+cl::opt<string> ServeSocket("serve", cl::desc("Run as a server extracting the features of the modules received on a Unix socket"), cl::value_desc("socket path"), cl::init(""));
+cl::opt<unsigned> MaxPending("max-pending", cl::desc("Maximum number of queued server requests (default: 4 per worker)"), cl::init(0));
 // verbose
 cl::opt<bool> Verbose("v", cl::desc("Verbose"), cl::init(false));
 
-Expected<FeatureAnalysisParam> parseAnalysisArguments(int argc, char **argv, bool printErrors)
+/// Expand a wildcard in the file name part of the path (e.g., "samples/*.bc") into the sorted list of matching files
+static Error expand_glob(const string &path, std::vector<string> &filenames){
+    StringRef dir = sys::path::parent_path(path);
+    Expected<GlobPattern> pattern = GlobPattern::create(sys::path::filename(path));
+    if(!pattern)
+        return pattern.takeError();
+    std::vector<string> matches;
+    std::error_code ec;
+    for(sys::fs::directory_iterator it(dir.empty() ? "." : dir, ec), end; it != end && !ec; it.increment(ec)){
+        StringRef name = sys::path::filename(it->path());
+        if(pattern->match(name))
+            matches.push_back(dir.empty() ? name.str() : it->path());
+    }
+    if(ec)
+        return createStringError(ec, "cannot read directory %s", dir.str().c_str());
+    std::sort(matches.begin(), matches.end());
+    filenames.insert(filenames.end(), matches.begin(), matches.end());
+    return Error::success();
+}
+
+/// Collect the input files from the positional arguments and from the manifest file
+static Error collect_input_files(std::vector<string> &filenames){
+    std::vector<string> inputs(IRFilenames.begin(), IRFilenames.end());
+    if(!Manifest.empty()){
+        ErrorOr<std::unique_ptr<MemoryBuffer>> manifest = MemoryBuffer::getFile(Manifest);
+        if(!manifest)
+            return createStringError(manifest.getError(), "cannot read manifest %s", Manifest.c_str());
+        SmallVector<StringRef, 64> lines;
+        (*manifest)->getBuffer().split(lines, '\n', -1, false);
+        for(StringRef line : lines){
+            line = line.trim();
+            if(!line.empty() && !line.startswith("#"))
+                inputs.push_back(line.str());
+        }
+    }
+    for(const string &input : inputs){
+        if(input.find_first_of("*?[") != string::npos){
+            if(Error err = expand_glob(input, filenames))
+                return err;
+        }
+        else
+            filenames.push_back(input);
+    }
+    if(filenames.empty())
+        return createStringError(inconvertibleErrorCode(), "no input bitcode files");
+    return Error::success();
+}
+
+Expected<FeatureAnalysisParam> parseAnalysisArguments(int argc, char **argv)
 {
   // LLVM command line parser
   string descr_list = "Specify the feature analysis algorithm. Supported: ";
@@ -70,90 +145,428 @@ Expected<FeatureAnalysisParam> parseAnalysisArguments(int argc, char **argv, boo
   FAnal.setDescription(descr_list);
   cl::ParseCommandLineOptions(argc, argv);
 
-  // if we are using the extractor tool, we need the input file
-  FeatureAnalysisParam param = {FeatureSetOptions::fan19, "default", "no-norm", "", false, false};
+  // if we are using the extractor tool, we need the input files
+  FeatureAnalysisParam param = {FeatureSetOptions::fan19, "default", "no-norm", {}, 1, false, false, "fan19"};
   param.feature_set = FSet;
+  param.feature_set_name = getFeatureSetName(FSet);
+  for(const string &filename : FSetDefs){
+    Expected<string> name = registerFeatureSetFile(filename);
+    if(!name)
+      return name.takeError();
+    param.feature_set_name = *name;
+  }
   param.analysis = FAnal;
   param.normalization = FNorm;
-  param.filename = IRFilename;
+  if(!FARegistry::isRegistered(param.analysis))
+    return createStringError(inconvertibleErrorCode(), "unknown feature analysis %s", param.analysis.c_str());
+  // the server receives its input modules on the socket
+  if(ServeSocket.empty()){
+    if(Error err = collect_input_files(param.filenames))
+      return err;
+  }
+  param.threads = Threads ? Threads : std::max(1u, std::thread::hardware_concurrency());
   //param.help = Help;
   param.verbose = Verbose;
   return param;
 }
 
-/// function to load a module from file
-std::unique_ptr<Module> load_module(LLVMContext &context, const std::string &fileName, bool verbose) {
+// loading statistics, reported in verbose mode
+static std::atomic<uint64_t> total_load_time_us(0);
+static std::atomic<unsigned> total_loaded_modules(0);
+
+/// function to load a module from file, returns nullptr (and reports the error on the output stream) if loading fails.
+/// In lazy mode only the kernels and their callees are materialized, the other functions become declarations.
+std::unique_ptr<Module> load_module(LLVMContext &context, const std::string &fileName, bool verbose, raw_ostream &out, bool lazy = false) {
     SMDiagnostic error;
     if (verbose)
-        cout << "loading module from file" << fileName << endl;
-    
-    std::unique_ptr<Module> module = llvm::parseIRFile(fileName, error, context);
+        out << "loading module from file" << fileName << "\n";
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Module> module = lazy ? llvm::getLazyIRFileModule(fileName, error, context) : llvm::parseIRFile(fileName, error, context);
     if (!module)
     {
-        std::string what = error.getMessage().str();
-        std::cerr << "error: " << what;
-        exit(1);
+        out << "error: " << fileName << ": " << error.getMessage() << "\n";
+        return nullptr;
     } // end if
+    unsigned materialized = 0;
+    if (lazy) {
+        Expected<unsigned> num_materialized = materialize_kernels(*module);
+        if (!num_materialized) {
+            out << "error: " << fileName << ": " << toString(num_materialized.takeError()) << "\n";
+            return nullptr;
+        }
+        materialized = *num_materialized;
+    }
+    uint64_t load_time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    total_load_time_us += load_time_us;
+    total_loaded_modules++;
     if (verbose) {
-        cout << "loading complete"  << endl;
-        cout << " - name " << module->getName().str() << endl;
-        cout << " - number of functions" << module->getFunctionList().size() << endl;
-        cout << " - instruction count #" << module->getInstructionCount() << endl;
-        
+        out << "loading complete in " << format("%.1f", load_time_us / 1e3) << "ms\n";
+        out << " - name " << module->getName() << "\n";
+        out << " - number of functions" << module->getFunctionList().size() << "\n";
+        if (lazy)
+            out << " - materialized functions " << materialized << "\n";
+        out << " - instruction count #" << module->getInstructionCount() << "\n";
     }
     return module;
 }
 
+/// Peak resident set size of the process, in kilobytes
+static long peak_rss_kb(){
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+/// Features of a function, collected for the binary output
+struct FeatureRow {
+    string kernel;
+    std::vector<unsigned> raw;
+    std::vector<float> feat;
+};
+
+/// Print the features of a function, or collect them in rows for the binary output
+static void emit_function_features(Function &fun, ResultFeatureAnalysis &result, raw_ostream &out, std::vector<FeatureRow> *rows){
+    if(rows){
+        rows->push_back({fun.getName().str(), std::move(result.raw), std::move(result.feat)});
+        return;
+    }
+    out << "function: " << fun.getName() << "\n";
+    print_feature_names(*result.schema, out);
+    print_feature_values(result.raw, out);
+    print_feature_values(result.feat, out);
+}
+
+
+/// Extraction state owned by a worker thread: LLVM context, analysis managers and feature analysis.
+/// Workers never share LLVM objects, thus extractions run concurrently without locking.
+struct ExtractionWorker {
+    LLVMContext context; // context of the split module, the other modules have a context of their own
+    PassBuilder PB;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    std::unique_ptr<FeatureAnalysis> analysis;
+    // IR canonicalization required by the analysis, run on each function before the extraction
+    FunctionPassManager canonicalization;
+    // lazily loaded copy of the module whose functions are split among the workers
+    std::unique_ptr<Module> split_module;
+    std::vector<Function*> split_functions;
+
+    ExtractionWorker(const FeatureAnalysisParam &param)
+      : analysis(FARegistry::dispatch(param.analysis, param.feature_set_name))
+    {
+        // Register the AA manager first so that our version is the one used.
+        FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+        MAM.registerPass([] { return CalleeClassificationAnalysis(); });
+        // Register all the basic analyses with the managers.
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        analysis->addCanonicalizationPasses(canonicalization);
+    }
+
+    /// extract the features of all the functions defined in an IR file, returns false if the file cannot be loaded.
+    /// Features are printed on out, or collected in rows if not null.
+    bool extract(const string &filename, bool verbose, raw_ostream &out, std::vector<FeatureRow> *rows){
+        // a fresh context per file: the types and constants of the previous modules are released with theirs
+        LLVMContext file_context;
+        std::unique_ptr<Module> module = load_module(file_context, filename, verbose, out, LazyLoading);
+        if(!module)
+            return false;
+        if(!rows)
+            out << "module: " << filename << "\n";
+        extract(*module, out, rows);
+        return true;
+    }
+
+    /// extract the features of a module received by the server, one reply row per function
+    void extract(std::unique_ptr<MemoryBuffer> buffer, FeatureReply &reply){
+        reply.num_features = analysis->getFeatureSet()->getSchema().size();
+        SMDiagnostic error;
+        // a fresh context per request, otherwise a long-running server accumulates the types, constants and
+        // metadata of all the modules it ever received
+        LLVMContext request_context;
+        // a lazy module owns its buffer, otherwise the buffer is only needed while parsing
+        std::unique_ptr<Module> module = LazyLoading ? getLazyIRModule(std::move(buffer), error, request_context)
+                                                     : parseIR(*buffer, error, request_context);
+        if(!module){
+            reply.status = FeatureReplyStatus::error;
+            reply.error = error.getMessage().str();
+            return;
+        }
+        if(LazyLoading){
+            Expected<unsigned> materialized = materialize_kernels(*module);
+            if(!materialized){
+                reply.status = FeatureReplyStatus::error;
+                reply.error = toString(materialized.takeError());
+                return;
+            }
+        }
+        std::vector<FeatureRow> rows;
+        extract(*module, nulls(), &rows);
+        for(FeatureRow &row : rows){
+            reply.kernels.push_back(std::move(row.kernel));
+            reply.feat.insert(reply.feat.end(), row.feat.begin(), row.feat.end());
+        }
+    }
+
+    /// extract the features of all the functions defined in a module
+    void extract(Module &module, raw_ostream &out, std::vector<FeatureRow> *rows){
+        // classify the called functions once for all the functions of the module
+        MAM.getResult<CalleeClassificationAnalysis>(module);
+        for(Function &fun : module){
+            if(fun.isDeclaration())
+                continue;
+            canonicalization.run(fun, FAM);
+            ResultFeatureAnalysis result = analysis->run(fun, FAM);
+            emit_function_features(fun, result, out, rows);
+        }
+        // drop the cached analysis results before the module is released
+        FAM.clear();
+        MAM.clear();
+    }
+
+    /// extract the features of the function at position fun_id of a module serialized as bitcode.
+    /// Each worker parses its own copy of the module, since LLVM contexts cannot be shared among threads;
+    /// the copy is loaded lazily, thus only the function bodies assigned to this worker are materialized.
+    bool extract(MemoryBufferRef bitcode, size_t fun_id, raw_ostream &out, std::vector<FeatureRow> *rows){
+        if(!split_module){
+            Expected<std::unique_ptr<Module>> module = getLazyBitcodeModule(bitcode, context);
+            if(!module){
+                out << "error: " << toString(module.takeError()) << "\n";
+                return false;
+            }
+            split_module = std::move(*module);
+            for(Function &fun : *split_module)
+                split_functions.push_back(&fun);
+            MAM.getResult<CalleeClassificationAnalysis>(*split_module);
+        }
+        Function &fun = *split_functions[fun_id];
+        if(Error err = fun.materialize()){
+            out << "error: " << toString(std::move(err)) << "\n";
+            return false;
+        }
+        canonicalization.run(fun, FAM);
+        ResultFeatureAnalysis result = analysis->run(fun, FAM);
+        emit_function_features(fun, result, out, rows);
+        return true;
+    }
+
+    /// release the module copy (must be called before the bitcode buffer is released)
+    void release(){
+        FAM.clear();
+        MAM.clear();
+        split_functions.clear();
+        split_module.reset();
+    }
+};
+
+
+/// Extract the features of the input files, one file per task. Rows are added to the matrix (if any) in input order.
+static bool extract_files(const FeatureAnalysisParam &param, std::vector<std::unique_ptr<ExtractionWorker>> &workers,
+                          FeatureMatrixWriter *matrix){
+    const std::vector<string> &filenames = param.filenames;
+
+    // Larger files are scheduled first, the smaller ones are then stolen by idle workers
+    std::vector<size_t> schedule(filenames.size());
+    std::vector<uint64_t> file_size(filenames.size(), 0);
+    for(size_t i = 0; i < filenames.size(); i++){
+        schedule[i] = i;
+        sys::fs::file_size(filenames[i], file_size[i]);
+    }
+    std::stable_sort(schedule.begin(), schedule.end(), [&](size_t a, size_t b){ return file_size[a] > file_size[b]; });
+
+    // Output is buffered per file and printed in input order, as soon as all the previous files are completed
+    std::vector<string> output(filenames.size());
+    std::vector<std::vector<FeatureRow>> rows(filenames.size());
+    std::vector<bool> completed(filenames.size(), false);
+    size_t next_output = 0;
+    bool failed = false;
+    std::mutex output_lock;
+
+    WorkStealingPool pool(workers.size());
+    for(size_t file_id : schedule){
+        pool.submit([&, file_id](unsigned worker_id){
+            raw_string_ostream out(output[file_id]);
+            bool loaded;
+            {
+                DebugStreamRedirect redirect(out);
+                loaded = workers[worker_id]->extract(filenames[file_id], param.verbose, out, matrix ? &rows[file_id] : nullptr);
+            }
+            out.flush();
+            std::lock_guard<std::mutex> guard(output_lock);
+            completed[file_id] = true;
+            failed |= !loaded;
+            for(; next_output < filenames.size() && completed[next_output]; next_output++){
+                outs() << output[next_output];
+                output[next_output].clear();
+                output[next_output].shrink_to_fit();
+                for(FeatureRow &row : rows[next_output])
+                    matrix->addRow(filenames[next_output], row.kernel, row.raw, row.feat);
+                rows[next_output].clear();
+            }
+            outs().flush();
+        });
+    }
+    pool.run();
+    return !failed;
+}
+
+/// Extract the features of the input files one at a time, splitting the functions of each module among the workers
+static bool extract_functions(const FeatureAnalysisParam &param, std::vector<std::unique_ptr<ExtractionWorker>> &workers,
+                              FeatureMatrixWriter *matrix){
+    bool failed = false;
+    for(const string &filename : param.filenames){
+        LLVMContext context;
+        std::unique_ptr<Module> module = load_module(context, filename, param.verbose, outs(), LazyLoading);
+        if(!module){
+            failed = true;
+            continue;
+        }
+        SmallVector<char, 0> bitcode;
+        raw_svector_ostream bitcode_stream(bitcode);
+        WriteBitcodeToFile(*module, bitcode_stream);
+        MemoryBufferRef bitcode_ref(StringRef(bitcode.data(), bitcode.size()), filename);
+
+        // one task per defined function, the output is printed in module order
+        std::vector<size_t> fun_ids;
+        size_t fun_id = 0;
+        for(Function &fun : *module){
+            if(!fun.isDeclaration())
+                fun_ids.push_back(fun_id);
+            fun_id++;
+        }
+        module.reset();
+
+        std::vector<string> output(fun_ids.size());
+        std::vector<std::vector<FeatureRow>> rows(fun_ids.size());
+        std::vector<char> extracted(fun_ids.size(), false);
+        WorkStealingPool pool(std::min<size_t>(workers.size(), std::max<size_t>(1, fun_ids.size())));
+        for(size_t i = 0; i < fun_ids.size(); i++){
+            pool.submit([&, i](unsigned worker_id){
+                raw_string_ostream out(output[i]);
+                DebugStreamRedirect redirect(out);
+                extracted[i] = workers[worker_id]->extract(bitcode_ref, fun_ids[i], out, matrix ? &rows[i] : nullptr);
+            });
+        }
+        pool.run();
+        for(auto &worker : workers)
+            worker->release();
+
+        if(!matrix)
+            outs() << "module: " << filename << "\n";
+        for(size_t i = 0; i < fun_ids.size(); i++){
+            outs() << output[i];
+            failed |= !extracted[i];
+            for(FeatureRow &row : rows[i])
+                matrix->addRow(filename, row.kernel, row.raw, row.feat);
+        }
+        outs().flush();
+    }
+    return !failed;
+}
+
+
+/// server stopped by SIGINT and SIGTERM
+static std::atomic<FeatureServer*> running_server{nullptr};
+
+static void stop_server(int){
+    if(FeatureServer *server = running_server.load())
+        server->stop();
+}
+
+/// Server mode: the workers keep their analysis managers warm and extract the modules received on the socket.
+/// Runs until SIGINT or SIGTERM: the server stops accepting connections and completes the queued requests.
+static bool serve(const FeatureAnalysisParam &param, const string &socket_path){
+    std::vector<std::unique_ptr<ExtractionWorker>> workers;
+    for(unsigned w = 0; w < param.threads; w++)
+        workers.push_back(std::make_unique<ExtractionWorker>(param));
+    // the messages of a request are printed at once, the workers do not share a stream
+    std::mutex log_lock;
+    FeatureServer server(workers.size(), MaxPending ? MaxPending : 4 * workers.size(),
+        [&](unsigned worker_id, std::unique_ptr<MemoryBuffer> module, FeatureReply &reply){
+            string log;
+            {
+                raw_string_ostream out(log);
+                DebugStreamRedirect redirect(out);
+                workers[worker_id]->extract(std::move(module), reply);
+            }
+            if(!log.empty()){
+                std::lock_guard<std::mutex> guard(log_lock);
+                errs() << log;
+            }
+        });
+    Error err = server.listen(socket_path);
+    if(!err){
+        if(param.verbose)
+            outs() << "Serving on " << socket_path << " with " << workers.size() << " workers\n";
+        outs().flush();
+        running_server = &server;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = stop_server;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        err = server.serve();
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        running_server = nullptr;
+    }
+    if(err){
+        errs() << "error: " << toString(std::move(err)) << "\n";
+        return false;
+    }
+    return true;
+}
 
 // Standalone tool that extracts different features representations out of a LLVM-IR program.
 int main(int argc, char *argv[]) {
     InitLLVM X(argc, argv);
-    LLVMContext context;
 
-    Expected<FeatureAnalysisParam> param = parseAnalysisArguments(argc, argv, true);
+    Expected<FeatureAnalysisParam> param = parseAnalysisArguments(argc, argv);
     if(!param){
-        cerr << "params not set\n";
-        exit(0);
-    }
-
-    // Module loading
-    std::unique_ptr<Module> module_ptr = load_module(context, param->filename, param->verbose);
-    
-    //DynamicLibrary::
-
-    // Pass management with the new pass pipeline
-    PassInstrumentationCallbacks PIC;
-    StandardInstrumentations SI(true, false);
-    SI.registerCallbacks(PIC);  
-    PassBuilder PB(false, nullptr, llvm::PipelineTuningOptions(), llvm::None, &PIC);    
-    Expected<PassPlugin> PassPlugin = PassPlugin::Load("./libfeature_pass.so");
-    if (!PassPlugin) {
-      errs() << "Failed to load passes from libfeature_pass.so plugin\n";
-      errs() << "Problem while loading libfeature_pass: " << toString(std::move(PassPlugin.takeError())) ;
-      errs() << "\n";
-      return 1;
-    }
-    PassPlugin->registerPassBuilderCallbacks(PB);
-
-    AAManager AA;
-    LoopAnalysisManager LAM(true);
-    FunctionAnalysisManager FAM(true);
-    CGSCCAnalysisManager CGAM(true);
-    ModuleAnalysisManager MAM(true);
-    // Register the AA manager first so that our version is the one used.
-    FAM.registerPass([&] { return std::move(AA); });
-    // Register all the basic analyses with the managers.
-    PB.registerModuleAnalyses(MAM);
-    PB.registerCGSCCAnalyses(CGAM);
-    PB.registerFunctionAnalyses(FAM);
-    PB.registerLoopAnalyses(LAM);
-    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-    ModulePassManager MPM(true);
- 
-    // Run!
-    if(param->verbose) cout << "Pass manager run.." << endl;
-    MPM.run(*module_ptr, MAM); 
-    if(param->verbose) cout << "Pass manager run completed" << endl;
-
-    return 0;
+        errs() << "error: " << toString(param.takeError()) << "\n";
+        return 1;
+    }
+    if(!ServeSocket.empty())
+        return serve(*param, ServeSocket) ? 0 : 1;
+    // in split mode the functions are the unit of work, otherwise the files
+    unsigned num_workers = SplitFunctions ? param->threads : std::min<size_t>(param->threads, param->filenames.size());
+    if(param->verbose)
+        outs() << "Extracting features from " << param->filenames.size() << " files with " << num_workers << " threads\n";
+
+    std::vector<std::unique_ptr<ExtractionWorker>> workers;
+    for(unsigned w = 0; w < num_workers; w++)
+        workers.push_back(std::make_unique<ExtractionWorker>(*param));
+
+    // binary output: all the rows are written as a single chunk of the feature matrix file
+    std::unique_ptr<FeatureSet> feature_set = FSRegistry::dispatch(param->feature_set_name);
+    std::unique_ptr<FeatureMatrixWriter> matrix;
+    if(!OutputFilename.empty())
+        matrix = std::make_unique<FeatureMatrixWriter>(feature_set->getName(), param->analysis, feature_set->getSchema());
+
+    bool success = SplitFunctions ? extract_functions(*param, workers, matrix.get()) : extract_files(*param, workers, matrix.get());
+    if(matrix){
+        if(Error err = matrix->write(OutputFilename, Append)){
+            errs() << "error: " << toString(std::move(err)) << "\n";
+            success = false;
+        }
+        else if(param->verbose)
+            outs() << "Wrote " << matrix->getNumRows() << " rows to " << OutputFilename << "\n";
+    }
+    if(param->verbose){
+        outs() << "Feature extraction completed\n";
+        outs() << "Loaded " << total_loaded_modules << " modules (" << (LazyLoading ? "lazy, kernels only" : "full") << "), loading time "
+               << format("%.1f", total_load_time_us / 1e3) << "ms (sum over the workers), peak RSS " << format("%.1f", peak_rss_kb() / 1024.0) << " MB\n";
+        if(FeatureCache *cache = FeatureCache::getGlobalCache())
+            cache->printStats(outs());
+    }
+
+    return success ? 0 : 1;
 } // end main
@@ -0,0 +1,216 @@
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <iostream>
+using namespace std;
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+using namespace llvm;
+
+#include "FeatureSet.hpp"
+#include "FeatureAnalysis.hpp"
+#include "DebugStream.hpp"
+#include "CalleeClassification.hpp"
+#include "FeatureMatrix.hpp"
+using namespace celerity;
+
+/// Test module: a triangular loop nest with memory accesses, calls and barriers, plus a constant-bound loop
+static const char *test_module = R"IR(
+declare i64 @_Z13get_global_idj(i32)
+declare float @_Z4sqrtf(float)
+declare void @_Z7barrierj(i32)
+declare float @llvm.fmuladd.f32(float, float, float)
+
+define spir_kernel void @mm(float addrspace(1)* %a, float addrspace(1)* %b, float addrspace(1)* %c, i32 %n, i32 %m) {
+entry:
+  %gid = call i64 @_Z13get_global_idj(i32 0)
+  %cmp0 = icmp sgt i32 %n, 0
+  br i1 %cmp0, label %outer, label %exit
+outer:
+  %i = phi i32 [0, %entry], [%i.next, %outer.latch]
+  %cmpi = icmp sgt i32 %i, 0
+  br i1 %cmpi, label %inner, label %outer.latch
+inner:
+  %j = phi i32 [0, %outer], [%j.next, %inner]
+  %acc = phi float [0.0, %outer], [%s, %inner]
+  %idx = mul i32 %i, %m
+  %idx2 = add i32 %idx, %j
+  %ix = sext i32 %idx2 to i64
+  %pa = getelementptr float, float addrspace(1)* %a, i64 %ix
+  %va = load float, float addrspace(1)* %pa
+  %pb = getelementptr float, float addrspace(1)* %b, i64 %gid
+  %vb = load float, float addrspace(1)* %pb
+  %s0 = call float @llvm.fmuladd.f32(float %va, float %vb, float %acc)
+  %sq = call float @_Z4sqrtf(float %s0)
+  %s = fadd float %sq, %s0
+  %sh = shl i32 %j, 1
+  %x = xor i32 %sh, %idx
+  %dv = sdiv i32 %x, 3
+  %fd = fdiv float %s, 2.0
+  %j.next = add nsw i32 %j, 1
+  %cmpj = icmp slt i32 %j.next, %i
+  br i1 %cmpj, label %inner, label %inner.exit
+inner.exit:
+  %pc = getelementptr float, float addrspace(1)* %c, i64 %gid
+  store float %s, float addrspace(1)* %pc
+  call void @_Z7barrierj(i32 1)
+  br label %outer.latch
+outer.latch:
+  %i.next = add nsw i32 %i, 1
+  %cmpn = icmp slt i32 %i.next, %n
+  br i1 %cmpn, label %outer, label %exit
+exit:
+  ret void
+}
+
+define spir_kernel void @scale(float addrspace(1)* %a, float %f) {
+entry:
+  %gid = call i64 @_Z13get_global_idj(i32 0)
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %off = mul i64 %gid, 16
+  %ii = zext i32 %i to i64
+  %ix = add i64 %off, %ii
+  %p = getelementptr float, float addrspace(1)* %a, i64 %ix
+  %v = load float, float addrspace(1)* %p
+  %w = fmul float %v, %f
+  store float %w, float addrspace(1)* %p
+  %i.next = add nuw nsw i32 %i, 1
+  %cmp = icmp ult i32 %i.next, 16
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}
+)IR";
+
+/// Features of all the functions of the module, flattened in a single vector
+struct Extraction {
+    std::vector<unsigned> raw;
+    std::vector<float> feat;
+    bool operator==(const Extraction &other) const { return raw == other.raw && feat == other.feat; }
+};
+
+/// Parse the test module and run a new instance of the analysis on all the functions,
+/// as a worker does: every call owns its context, analysis managers and feature analysis.
+/// Callees are classified per module if module_classification is set, otherwise per function.
+static Extraction extract(const string &analysis_name, const string &feature_set, bool module_classification = false){
+    LLVMContext context;
+    SMDiagnostic error;
+    std::unique_ptr<Module> module = parseAssemblyString(test_module, error, context);
+    if(!module){
+        error.print("test_concurrency", errs());
+        exit(1);
+    }
+    PassBuilder PB;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+    MAM.registerPass([] { return CalleeClassificationAnalysis(); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    std::unique_ptr<FeatureAnalysis> analysis = FARegistry::dispatch(analysis_name, feature_set);
+    FunctionPassManager canonicalization;
+    analysis->addCanonicalizationPasses(canonicalization);
+    if(module_classification)
+        MAM.getResult<CalleeClassificationAnalysis>(*module);
+    Extraction extraction;
+    for(Function &fun : *module){
+        if(fun.isDeclaration())
+            continue;
+        canonicalization.run(fun, FAM);
+        ResultFeatureAnalysis result = analysis->run(fun, FAM);
+        extraction.raw.insert(extraction.raw.end(), result.raw.begin(), result.raw.end());
+        extraction.feat.insert(extraction.feat.end(), result.feat.begin(), result.feat.end());
+    }
+    FAM.clear();
+    MAM.clear();
+    return extraction;
+}
+
+/// The features of the test module written as a feature matrix read back unchanged, a chunk whose string table
+/// size wraps around the address space is rejected
+static bool matrix_round_trip(const Extraction &extraction, const string &feature_set){
+    std::unique_ptr<FeatureSet> features = FSRegistry::dispatch(feature_set);
+    const FeatureSchema &schema = features->getSchema();
+    FeatureMatrixWriter writer(feature_set, "default", schema);
+    unsigned num_rows = extraction.raw.size() / schema.size();
+    for(unsigned row = 0; row < num_rows; row++)
+        writer.addRow("test", "kernel" + std::to_string(row), ArrayRef<unsigned>(extraction.raw).slice(row * schema.size(), schema.size()),
+                      ArrayRef<float>(extraction.feat).slice(row * schema.size(), schema.size()));
+    std::vector<char> chunk;
+    writer.serialize(chunk);
+
+    Expected<FeatureMatrixReader> reader = FeatureMatrixReader::read(MemoryBuffer::getMemBufferCopy(StringRef(chunk.data(), chunk.size())));
+    if(!reader){
+        errs() << toString(reader.takeError()) << "\n";
+        return false;
+    }
+    const FeatureMatrixChunk &read_chunk = reader->getChunks()[0];
+    bool equal = read_chunk.getNumRows() == num_rows;
+    for(unsigned f = 0; equal && f < schema.size(); f++)
+        for(unsigned row = 0; row < num_rows; row++)
+            equal = equal && read_chunk.getRawColumn(f)[row] == extraction.raw[row * schema.size() + f];
+
+    FeatureMatrixHeader *header = reinterpret_cast<FeatureMatrixHeader*>(chunk.data());
+    header->string_size = UINT64_MAX - header->string_offset + 1 + header->string_size;
+    Expected<FeatureMatrixReader> corrupted = FeatureMatrixReader::read(MemoryBuffer::getMemBufferCopy(StringRef(chunk.data(), chunk.size())));
+    bool rejected = !corrupted;
+    consumeError(corrupted.takeError());
+    cout << " * feature matrix of " << feature_set << ": " << num_rows << " rows " << (equal ? "read back" : "MISMATCH")
+         << ", wrapping string table " << (rejected ? "rejected" : "ACCEPTED") << endl;
+    return equal && rejected;
+}
+
+/// Stress test: the same extraction runs on many threads at once, each result must match the sequential one.
+/// Half of the extractions use the module callee classification, which must not change the features.
+int main(){
+    const unsigned num_threads = 8;
+    const unsigned repetitions = 50;
+    // analyses print their debug output on the thread's debug stream, which is discarded here
+    raw_null_ostream discard_stream;
+
+    bool failed = false;
+    for(StringRef analysis_name : FARegistry::getKeyList()){
+        for(StringRef feature_set : FSRegistry::getKeyList()){
+            Extraction reference;
+            {
+                DebugStreamRedirect redirect(discard_stream);
+                reference = extract(analysis_name.str(), feature_set.str());
+            }
+            std::atomic<unsigned> mismatches(0);
+            std::vector<std::thread> threads;
+            for(unsigned t = 0; t < num_threads; t++){
+                threads.emplace_back([&]{
+                    raw_null_ostream thread_stream;
+                    DebugStreamRedirect redirect(thread_stream);
+                    for(unsigned r = 0; r < repetitions; r++)
+                        if(!(extract(analysis_name.str(), feature_set.str(), r % 2) == reference))
+                            mismatches++;
+                });
+            }
+            for(std::thread &thread : threads)
+                thread.join();
+            cout << " * " << analysis_name.str() << "/" << feature_set.str() << ": 1 vs " << num_threads << " threads, "
+                 << num_threads * repetitions << " extractions, " << mismatches << " mismatches" << endl;
+            failed |= mismatches > 0;
+            if(analysis_name == "default")
+                failed |= !matrix_round_trip(reference, feature_set.str());
+        }
+    }
+    cout << (failed ? "FAILED" : "PASSED") << endl;
+    return failed ? 1 : 0;
+}
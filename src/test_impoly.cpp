@@ -1,14 +1,325 @@
 #include <map>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <sys/resource.h>
 using namespace std;
 
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/SourceMgr.h>
+
 #include "KernelInvariant.hpp"
 #include "IMPoly.hpp"
+#include "IMPolyEvaluator.hpp"
+#include "PolFeatEncoding.hpp"
+#include "PolFeatAnalysis.hpp"
 
 using namespace celerity;
 
-/// Simple test application for IMPoly
-int main(){
+/// Loop nests whose executions are sums over the enclosing iterations: the global stores of the innermost body
+/// count the executions of the body. Arguments: a1 = n, a2 = m.
+static const char *nest_module = R"IR(
+define spir_kernel void @triangular(float addrspace(1)* %a, i32 %n) {
+entry:
+  %cmpn = icmp sgt i32 %n, 0
+  br i1 %cmpn, label %outer, label %exit
+outer:
+  %i = phi i32 [0, %entry], [%i.next, %outer.latch]
+  %cmpi = icmp sgt i32 %i, 0
+  br i1 %cmpi, label %inner, label %outer.latch
+inner:
+  %j = phi i32 [0, %outer], [%j.next, %inner]
+  store float 1.0, float addrspace(1)* %a
+  %j.next = add nsw i32 %j, 1
+  %cmpj = icmp slt i32 %j.next, %i
+  br i1 %cmpj, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add nsw i32 %i, 1
+  %cmpo = icmp slt i32 %i.next, %n
+  br i1 %cmpo, label %outer, label %exit
+exit:
+  ret void
+}
+
+define spir_kernel void @trapezoidal(float addrspace(1)* %a, i32 %n, i32 %m) {
+entry:
+  %cmpn = icmp sgt i32 %n, 0
+  %cmpm = icmp sgt i32 %m, 0
+  %cmpnm = and i1 %cmpn, %cmpm
+  br i1 %cmpnm, label %outer, label %exit
+outer:
+  %i = phi i32 [0, %entry], [%i.next, %outer.latch]
+  %bound = add nsw i32 %i, %m
+  br label %inner
+inner:
+  %j = phi i32 [0, %outer], [%j.next, %inner]
+  store float 1.0, float addrspace(1)* %a
+  %j.next = add nsw i32 %j, 1
+  %cmpj = icmp slt i32 %j.next, %bound
+  br i1 %cmpj, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add nsw i32 %i, 1
+  %cmpo = icmp slt i32 %i.next, %n
+  br i1 %cmpo, label %outer, label %exit
+exit:
+  ret void
+}
+
+define spir_kernel void @simplex(float addrspace(1)* %a, i32 %n) {
+entry:
+  %cmpn = icmp sgt i32 %n, 0
+  br i1 %cmpn, label %outer, label %exit
+outer:
+  %i = phi i32 [0, %entry], [%i.next, %outer.latch]
+  %cmpi = icmp sgt i32 %i, 0
+  br i1 %cmpi, label %middle, label %outer.latch
+middle:
+  %j = phi i32 [0, %outer], [%j.next, %middle.latch]
+  %cmpj0 = icmp sgt i32 %j, 0
+  br i1 %cmpj0, label %inner, label %middle.latch
+inner:
+  %k = phi i32 [0, %middle], [%k.next, %inner]
+  store float 1.0, float addrspace(1)* %a
+  %k.next = add nsw i32 %k, 1
+  %cmpk = icmp slt i32 %k.next, %j
+  br i1 %cmpk, label %inner, label %middle.latch
+middle.latch:
+  %j.next = add nsw i32 %j, 1
+  %cmpj = icmp slt i32 %j.next, %i
+  br i1 %cmpj, label %middle, label %outer.latch
+outer.latch:
+  %i.next = add nsw i32 %i, 1
+  %cmpo = icmp slt i32 %i.next, %n
+  br i1 %cmpo, label %outer, label %exit
+exit:
+  ret void
+}
+)IR";
+
+/// PolFeatAnalysis regression: the global memory counter of each kernel of nest_module is its expected polynomial
+static bool polfeat_nests(){
+    llvm::LLVMContext context;
+    llvm::SMDiagnostic error;
+    std::unique_ptr<llvm::Module> module = llvm::parseAssemblyString(nest_module, error, context);
+    if(!module){
+        error.print("test_impoly", llvm::errs());
+        return false;
+    }
+    llvm::PassBuilder PB;
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    MAM.registerPass([] { return CalleeClassificationAnalysis(); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    PolFeatAnalysis analysis("fan19");
+    llvm::FunctionPassManager canonicalization;
+    analysis.addCanonicalizationPasses(canonicalization);
+    int mem_gl = analysis.getFeatureSet()->getSchema().getId("mem_gl");
+    std::map<std::string, std::string> expected = {
+        {"triangular",  "(a1^2 - a1)/2"},
+        {"trapezoidal", "(a1^2 + 2*a1*a2 - a1)/2"},
+        {"simplex",     "(a1^3 - 3*a1^2 + 2*a1)/6"}};
+    bool passed = mem_gl >= 0;
+    for(llvm::Function &fun : *module){
+        canonicalization.run(fun, FAM);
+        std::string counter = analysis.run(fun, FAM).raw[mem_gl].str();
+        bool match = counter == expected[fun.getName().str()];
+        cout << " * polfeat " << fun.getName().str() << ": " << counter << (match ? "" : ", expected " + expected[fun.getName().str()]) << endl;
+        passed = passed && match;
+    }
+    FAM.clear();
+    MAM.clear();
+    return passed;
+}
+
+/// peak resident set size in KiB
+static long peak_rss(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/// Allocation benchmark: the operations of a polynomial extraction (copies, temporaries of operator+ and
+/// operator-, products, max) repeated in a loop. The peak RSS must not grow with the iterations.
+static int alloc_bench(unsigned long iterations){
+    IMPoly n(1, KernelInvariant::enumerate(celerity::InvariantType::a0));
+    IMPoly gs(1, KernelInvariant::enumerate(celerity::InvariantType::gs0));
+    IMPoly acc;
+    unsigned long checkpoint = iterations < 10 ? 1 : iterations / 10;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned long i = 1; i <= iterations; i++){
+        IMPoly trip = n + IMPoly(1L);
+        IMPoly body = IMPoly::max(trip, gs);
+        body *= trip;
+        acc = body - acc; // alternates between body and zero
+        if(i % checkpoint == 0){
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            cout << " * " << i << " iterations, peak RSS " << peak_rss() << " KiB, "
+                 << seconds * 1e9 / i << " ns per iteration" << endl;
+        }
+    }
+    return 0;
+}
+
+/// a feature vector as extracted from a kernel: counts of the nest, of the enclosing loop and of the kernel body
+static std::vector<IMPoly> feature_vector(const IMPoly &nest){
+    IMPoly gs(1, KernelInvariant::enumerate(celerity::InvariantType::gs0));
+    std::vector<IMPoly> features;
+    for(long k = 1; k <= 12; k++){
+        IMPoly poly = nest;
+        poly *= k;
+        poly += IMPoly(k % 3 == 0 ? 1 : 0, KernelInvariant::enumerate(celerity::InvariantType::a0));
+        if(k % 4 == 0)
+            poly = IMPoly(k);
+        poly *= k % 2 == 0 ? IMPoly(1L) : gs;
+        features.push_back(poly);
+    }
+    return features;
+}
+
+/// Backend benchmark: the arithmetic of a triangular loop nest (sum over the counter, products with the executions
+/// of the enclosing loop, accumulation of a feature) and the evaluation of the resulting feature polynomial.
+static int backend_bench(unsigned long iterations){
+    IMPoly n(1, KernelInvariant::enumerate(celerity::InvariantType::a0));
+    IMPoly m(1, KernelInvariant::enumerate(celerity::InvariantType::a1));
+    IMPoly counter(1, KernelInvariant::enumerate(celerity::InvariantType::it0));
+    IMPoly feature;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned long i = 0; i < iterations; i++){
+        IMPoly inner = m - counter;
+        IMPoly executions = inner.sum(KernelInvariant::enumerate(celerity::InvariantType::it0), n);
+        executions *= n;
+        executions *= 3L;
+        feature = executions + IMPoly(long(i & 7));
+    }
+    double arithmetic = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<IMPoly> features = feature_vector(feature);
+    IMPolyEvaluator plan(features);
+    double values[InvariantTypeNum] = {};
+    std::vector<double> result(features.size());
+    double polynomial_total = 0, plan_total = 0;
+    start = std::chrono::steady_clock::now();
+    for(unsigned long i = 0; i < iterations; i++){
+        values[celerity::InvariantType::a0] = double(i & 1023);
+        values[celerity::InvariantType::a1] = 64;
+        values[celerity::InvariantType::gs0] = 4096;
+        for(const IMPoly &poly : features)
+            polynomial_total += poly.evaluate(values);
+    }
+    double evaluation = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for(unsigned long i = 0; i < iterations; i++){
+        values[celerity::InvariantType::a0] = double(i & 1023);
+        values[celerity::InvariantType::a1] = 64;
+        values[celerity::InvariantType::gs0] = 4096;
+        plan.evaluate(values, result.data());
+        for(double value : result)
+            plan_total += value;
+    }
+    double plan_evaluation = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cout << " * feature " << feature << ", " << features.size() << " features, " << plan.getNumMonomials()
+         << " monomials (checksums " << polynomial_total << " " << plan_total << ")" << endl;
+    cout << " * arithmetic " << arithmetic * 1e9 / iterations << " ns per iteration" << endl;
+    cout << " * feature vector: " << evaluation * 1e9 / iterations << " ns polynomials, "
+         << plan_evaluation * 1e9 / iterations << " ns evaluation plan" << endl;
+    return 0;
+}
+
+/// Batch benchmark: the scheduler scores the candidate ND-range configurations of a launch, each candidate needs the
+/// whole feature vector. Compares the scalar evaluation plan, one candidate at a time, with the batch evaluation.
+static int batch_bench(unsigned candidates, unsigned long iterations){
+    IMPoly n(1, KernelInvariant::enumerate(celerity::InvariantType::a0));
+    IMPoly m(1, KernelInvariant::enumerate(celerity::InvariantType::a1));
+    IMPoly counter(1, KernelInvariant::enumerate(celerity::InvariantType::it0));
+    IMPoly nest = (m - counter).sum(KernelInvariant::enumerate(celerity::InvariantType::it0), n);
+    nest *= IMPoly(1, KernelInvariant::enumerate(celerity::InvariantType::ls0));
+    std::vector<IMPoly> features = feature_vector(nest);
+    IMPolyEvaluator plan(features);
+
+    // structure of arrays: one column of candidates for each invariant, one for each feature
+    std::vector<std::vector<double>> columns(InvariantTypeNum, std::vector<double>(candidates));
+    for(unsigned c = 0; c < candidates; c++){
+        columns[celerity::InvariantType::a0][c] = 1024;
+        columns[celerity::InvariantType::a1][c] = 64;
+        columns[celerity::InvariantType::gs0][c] = double(4096 >> (c % 4));
+        columns[celerity::InvariantType::ls0][c] = double(1 << (c % 9));
+    }
+    std::vector<std::vector<double>> results(features.size(), std::vector<double>(candidates));
+    std::vector<const double *> values;
+    for(const std::vector<double> &column : columns)
+        values.push_back(column.data());
+    std::vector<double *> batch_features;
+    for(std::vector<double> &result : results)
+        batch_features.push_back(result.data());
+
+    double row[InvariantTypeNum];
+    std::vector<double> scalar_features(features.size());
+    double scalar_total = 0, batch_total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned long i = 0; i < iterations; i++){
+        for(unsigned c = 0; c < candidates; c++){
+            for(unsigned var = 0; var < InvariantTypeNum; var++)
+                row[var] = columns[var][c];
+            plan.evaluate(row, scalar_features.data());
+            for(double value : scalar_features)
+                scalar_total += value;
+        }
+    }
+    double scalar = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for(unsigned long i = 0; i < iterations; i++){
+        plan.evaluateBatch(values.data(), candidates, batch_features.data());
+        for(const std::vector<double> &result : results)
+            for(double value : result)
+                batch_total += value;
+    }
+    double batch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // the batch must match the scalar evaluation of each candidate, up to contractions of the products
+    for(unsigned c = 0; c < candidates; c++){
+        for(unsigned var = 0; var < InvariantTypeNum; var++)
+            row[var] = columns[var][c];
+        plan.evaluate(row, scalar_features.data());
+        for(unsigned f = 0; f < features.size(); f++)
+            if(std::fabs(scalar_features[f] - results[f][c]) > 1e-12 * std::fabs(scalar_features[f])){
+                cout << " * mismatch for candidate " << c << ", feature " << f << ": " << scalar_features[f]
+                     << " != " << results[f][c] << endl;
+                return 1;
+            }
+    }
+    double evaluated = double(candidates) * iterations;
+    cout << " * " << features.size() << " features, " << plan.getNumMonomials() << " monomials, " << candidates
+         << " candidates (checksums " << scalar_total << " " << batch_total << ")" << endl;
+    cout << " * scalar: " << evaluated / scalar << " candidates/s, batch: " << evaluated / batch
+         << " candidates/s" << endl;
+    return 0;
+}
+
+/// Simple test application for IMPoly, "test_impoly alloc [iterations]" runs the allocation benchmark,
+/// "test_impoly bench [iterations]" the benchmark of the polynomial backend, "test_impoly batch [candidates]
+/// [iterations]" the batch evaluation benchmark
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "alloc") == 0)
+        return alloc_bench(argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000);
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+        return backend_bench(argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000);
+    if(argc > 1 && strcmp(argv[1], "batch") == 0)
+        return batch_bench(argc > 2 ? strtoul(argv[2], nullptr, 10) : 256,
+                           argc > 3 ? strtoul(argv[3], nullptr, 10) : 10000);
+
     IMPoly test1;
     cout << " * poly empty: " << test1 << endl;
 
@@ -46,7 +357,122 @@ int main(){
     IMPoly test7 = IMPoly::max(test5, test6);  
     cout << test7 << endl;
 
-    std::map<InvariantType,float> runtime_values;
+    // the halving of max is exact: the coefficients over a denominator are not truncated
+    IMPoly half_a0(1, KernelInvariant::enumerate(celerity::InvariantType::a0));
+    half_a0 /= 2;
+    IMPoly max_half = IMPoly::max(half_a0, half_a0);
+    cout << " * max(" << half_a0 << "," << half_a0 << ") = " << max_half << endl;
+    if(max_half.str() != half_a0.str())
+        return 1;
+
+    IMPoly test8(1, KernelInvariant::enumerate(celerity::InvariantType::a1));
+    test8 += IMPoly(-1L);
+    cout << " * poly a1-1 constant: " << test8 << " " << test8.isConstant() << endl;
+    test8 *= 3L;
+    cout << " * poly 3*(a1-1): " << test8 << endl;
+    IMPoly test9(4L);
+    cout << " * poly 4 constant: " << test9 << " " << test9.isConstant() << endl;
+
+    // triangular loop nests: for i < a0, for j < i
+    IMPoly counter(1, KernelInvariant::enumerate(celerity::InvariantType::it0));
+    IMPoly bound(1, KernelInvariant::enumerate(celerity::InvariantType::a0));
+    IMPoly triangle = counter.sum(KernelInvariant::enumerate(celerity::InvariantType::it0), bound);
+    cout << " * sum it0 for it0 < a0: " << triangle << endl;
+    IMPoly square = counter;
+    square *= counter;
+    IMPoly pyramid = square.sum(KernelInvariant::enumerate(celerity::InvariantType::it0), bound);
+    cout << " * sum it0^2 for it0 < a0: " << pyramid << endl;
+    IMPoly rectangle(1, KernelInvariant::enumerate(celerity::InvariantType::a1));
+    rectangle = rectangle.sum(KernelInvariant::enumerate(celerity::InvariantType::it0), bound);
+    cout << " * sum a1 for it0 < a0: " << rectangle << endl;
+    bool faulhaber = triangle.str() == "(a0^2 - a0)/2" && pyramid.str() == "(2*a0^3 - 3*a0^2 + a0)/6" && rectangle.str() == "a0*a1";
+    triangle *= 2L;
+    cout << " * 2*(a0^2-a0)/2: " << triangle << " degree " << triangle.degree() << endl;
+    if(!faulhaber || triangle.str() != "a0^2 - a0" || triangle.degree() != 2)
+        return 1;
+
+    std::map<InvariantType,float> runtime_values = {{celerity::InvariantType::a0, 10}, {celerity::InvariantType::gs0, 4}};
+    double values[InvariantTypeNum] = {};
+    for(auto &value : runtime_values)
+        values[value.first] = value.second;
+    cout << " * " << triangle << " at a0=10: " << triangle.evaluate(values) << endl;
+    cout << " * " << test7 << " at a0=10, gs0=4: " << test7.evaluate(values) << endl;
+    IMPoly half_triangle = triangle;
+    half_triangle /= 4;
+    cout << " * " << half_triangle << " at a0=10: " << half_triangle.evaluate(values) << endl;
+    // the evaluation plan shares a0 and a0^2 between the features
+    IMPolyEvaluator plan({triangle, test7, half_triangle, test9});
+    double features[4];
+    plan.evaluate(values, features);
+    cout << " * plan of " << plan.getNumMonomials() << " monomials: " << features[0] << " " << features[1] << " "
+         << features[2] << " " << features[3] << endl;
+
+    // binary encoding: the decoded polynomials print as the originals, the plan of the encoded block evaluates alike
+    std::vector<IMPoly> polys = {triangle, test7, half_triangle, test9, test1, test8};
+    FeatureSchema schema({"triangle", "max", "half_triangle", "constant", "zero", "a1"});
+    std::vector<float> feat = {0.5f, 1.f, 0.25f, 0.f, 0.f, 2.f};
+    std::vector<char> buffer;
+    llvm::cantFail(encodePolFeatures("test", schema, polys, feat, buffer));
+    size_t set_size = buffer.size();
+    llvm::cantFail(encodeIMPoly(half_triangle, buffer));
+    std::vector<uint64_t> aligned((buffer.size() + 7) / 8);
+    memcpy(aligned.data(), buffer.data(), buffer.size());
+    llvm::StringRef data(reinterpret_cast<const char*>(aligned.data()), buffer.size());
+    PolFeatView view = llvm::cantFail(PolFeatView::read(data));
+    bool round_trip = view.getSize() == set_size && view.getFeatureSetName() == "test" && view.getNumFeatures() == polys.size();
+    for(unsigned f = 0; round_trip && f < polys.size(); f++){
+        IMPoly decoded = llvm::cantFail(view.getPolynomial(f));
+        round_trip = decoded.str() == polys[f].str() && view.getFeatureName(f) == schema.getName(f) && view.getFeatValues()[f] == feat[f];
+    }
+    IMPoly single = llvm::cantFail(decodeIMPoly(data.drop_front(set_size)));
+    round_trip = round_trip && single.str() == half_triangle.str();
+    IMPolyEvaluator encoded_plan(view);
+    double encoded_features[6], plan_features[6];
+    encoded_plan.evaluate(values, encoded_features);
+    IMPolyEvaluator(polys).evaluate(values, plan_features);
+    for(unsigned f = 0; f < polys.size(); f++)
+        round_trip = round_trip && encoded_features[f] == plan_features[f];
+    cout << " * binary encoding: " << set_size << " bytes, " << single << ", round trip "
+         << (round_trip ? "ok" : "FAILED") << endl;
+    if(!round_trip)
+        return 1;
+    // a term count whose exponent section overflows 64 bits is rejected, not wrapped around
+    PolFeatHeader *header = reinterpret_cast<PolFeatHeader*>(aligned.data());
+    header->num_terms = UINT64_MAX / header->num_vars + 1;
+    llvm::Expected<PolFeatView> corrupted = PolFeatView::read(data);
+    bool rejected = !corrupted;
+    llvm::consumeError(corrupted.takeError());
+    cout << " * overflowing term count " << (rejected ? "rejected" : "ACCEPTED") << endl;
+    if(!rejected)
+        return 1;
+
+    // results beyond the backend are flagged and the flag propagates, instead of aborting the extraction
+    IMPoly most_negative(long(INT64_MIN));
+    most_negative /= 2;
+    IMPoly tiny(1L);
+    tiny /= INT64_MAX;
+    tiny /= 2;
+    bool overflows = most_negative.str() == "-4611686018427387904" && tiny.overflowed() && (tiny + test2).overflowed()
+                     && llvm::errorToBool(encodeIMPoly(tiny, buffer));
+#ifdef CELERITY_IMPOLY_PACKED
+    IMPoly large(long(INT64_MAX));
+    large *= 2L;
+    IMPoly high(1, KernelInvariant::enumerate(celerity::InvariantType::a0), 8);
+    high *= high;
+    IMPoly high_product(1L);
+    high_product *= high;
+    IMPoly repeated;
+    int64_t repeated_coeffs[] = {INT64_MAX, 1};
+    uint8_t repeated_exponents[] = {1, 1};
+    overflows = overflows && large.overflowed() && large.str() == "overflow" && high.overflowed()
+                && high_product.overflowed() && !repeated.setTerms(repeated_coeffs, repeated_exponents, 1, 1);
+#endif
+    cout << " * overflow: " << most_negative << ", " << tiny << (overflows ? " ok" : " FAILED") << endl;
+    if(!overflows)
+        return 1;
+
+    if(!polfeat_nests())
+        return 1;
 
     return 0;
 }